@@ -27,10 +27,25 @@ LOCAL_MODULE_PATH := $(TARGET_OUT_SHARED_LIBRARIES)/hw
 
 LOCAL_MODULE_TAGS := optional
 
-LOCAL_SRC_FILES := sensors.c
+LOCAL_SRC_FILES := sensors.c sensors_channel.c sensors_fusion.c \
+                   sensors_latest.c sensors_record.c
 LOCAL_SHARED_LIBRARIES := liblog libcutils
 LOCAL_PRELINK_MODULE := false
 
 include $(BUILD_SHARED_LIBRARY)
 
+# for native processes reading the samples of the HAL, see sensors_channel.h
+# and sensors_latest.h
+include $(CLEAR_VARS)
+
+LOCAL_MODULE := libsensors_channel
+
+LOCAL_MODULE_TAGS := optional
+
+LOCAL_SRC_FILES := sensors_channel.c sensors_latest.c
+
+include $(BUILD_STATIC_LIBRARY)
+
 endif # !TARGET_SIMULATOR
+
+include $(call all-makefiles-under,$(LOCAL_PATH))
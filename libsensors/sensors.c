@@ -22,36 +22,81 @@
 #include <fcntl.h>
 #include <errno.h>
 #include <dirent.h>
+#include <malloc.h>
 #include <math.h>
 #include <poll.h>
 #include <pthread.h>
-#include <sys/select.h>
-
+#include <stddef.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/inotify.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#include <linux/futex.h>
 #include <linux/input.h>
 #include <linux/akm8973.h>
 #include <linux/capella_cm3602.h>
 #include <linux/lightsensor.h>
 
+#include <cutils/ashmem.h>
 #include <cutils/atomic.h>
 #include <cutils/log.h>
 #include <cutils/native_handle.h>
+#include <cutils/properties.h>
 
-#define __MAX(a,b) ((a)>=(b)?(a):(b))
+#include "sensors_channel.h"
+#include "sensors_ext.h"
+#include "sensors_fusion.h"
+#include "sensors_latest.h"
+#include "sensors_record.h"
 
 /*****************************************************************************/
 
-#define MAX_NUM_SENSORS 6
+#ifndef SENSOR_TYPE_ROTATION_VECTOR
+#define SENSOR_TYPE_ROTATION_VECTOR 11
+#endif
+
+#ifndef SENSOR_TYPE_GRAVITY
+#define SENSOR_TYPE_GRAVITY 9
+#endif
+
+#ifndef SENSOR_TYPE_LINEAR_ACCELERATION
+#define SENSOR_TYPE_LINEAR_ACCELERATION 10
+#endif
+
+#ifndef SENSOR_TYPE_STEP_DETECTOR
+#define SENSOR_TYPE_STEP_DETECTOR 18
+#endif
+
+#ifndef SENSOR_TYPE_STEP_COUNTER
+#define SENSOR_TYPE_STEP_COUNTER 19
+#endif
+
+#ifndef SENSOR_TYPE_SIGNIFICANT_MOTION
+#define SENSOR_TYPE_SIGNIFICANT_MOTION 17
+#endif
+
+#define MAX_NUM_SENSORS 12
 
 #define SUPPORTED_SENSORS  ((1<<MAX_NUM_SENSORS)-1)
 
 #define ARRAY_SIZE(a) (sizeof(a) / sizeof(a[0]))
 
+#define CACHE_LINE_SIZE 64
+
 #define ID_A  (0)
 #define ID_M  (1)
 #define ID_O  (2)
 #define ID_T  (3)
 #define ID_P  (4)
 #define ID_L  (5)
+#define ID_RV (6)
+#define ID_G  (7)
+#define ID_LA (8)
+#define ID_SD (9)
+#define ID_SC (10)
+#define ID_SM (11)
 
 static int id_to_sensor[MAX_NUM_SENSORS] = {
     [ID_A] = SENSOR_TYPE_ACCELEROMETER,
@@ -60,13 +105,68 @@ static int id_to_sensor[MAX_NUM_SENSORS] = {
     [ID_T] = SENSOR_TYPE_TEMPERATURE,
     [ID_P] = SENSOR_TYPE_PROXIMITY,
     [ID_L] = SENSOR_TYPE_LIGHT,
+    [ID_RV] = SENSOR_TYPE_ROTATION_VECTOR,
+    [ID_G] = SENSOR_TYPE_GRAVITY,
+    [ID_LA] = SENSOR_TYPE_LINEAR_ACCELERATION,
+    [ID_SD] = SENSOR_TYPE_STEP_DETECTOR,
+    [ID_SC] = SENSOR_TYPE_STEP_COUNTER,
+    [ID_SM] = SENSOR_TYPE_SIGNIFICANT_MOTION,
 };
 
+static int sensor_to_id(int sensor)
+{
+    int i;
+    for (i = 0; i < MAX_NUM_SENSORS; i++) {
+        if (id_to_sensor[i] == sensor)
+            return i;
+    }
+    return -1;
+}
+
+static int64_t clock_ns(clockid_t clock)
+{
+    struct timespec t;
+    clock_gettime(clock, &t);
+    return t.tv_sec*1000000000LL + t.tv_nsec;
+}
+
+/*
+ * Waits on cond until the CLOCK_MONOTONIC time due, in ns, so that the
+ * wall clock being set doesn't move the deadline. Without the bionic call
+ * the condition must have been initialized with cond_init_monotonic().
+ */
+static int cond_timedwait_monotonic(pthread_cond_t *cond,
+                                    pthread_mutex_t *lock, int64_t due)
+{
+    struct timespec ts = {
+        .tv_sec = due / 1000000000LL,
+        .tv_nsec = due % 1000000000LL };
+#ifdef HAVE_PTHREAD_COND_TIMEDWAIT_MONOTONIC
+    return pthread_cond_timedwait_monotonic_np(cond, lock, &ts);
+#else
+    return pthread_cond_timedwait(cond, lock, &ts);
+#endif
+}
+
+static void cond_init_monotonic(pthread_cond_t *cond)
+{
+#ifdef HAVE_PTHREAD_COND_TIMEDWAIT_MONOTONIC
+    pthread_cond_init(cond, NULL);
+#else
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(cond, &attr);
+    pthread_condattr_destroy(&attr);
+#endif
+}
+
 #define SENSORS_AKM_ACCELERATION   (1<<ID_A)
 #define SENSORS_AKM_MAGNETIC_FIELD (1<<ID_M)
 #define SENSORS_AKM_ORIENTATION    (1<<ID_O)
 #define SENSORS_AKM_TEMPERATURE    (1<<ID_T)
 #define SENSORS_AKM_GROUP          ((1<<ID_A)|(1<<ID_M)|(1<<ID_O)|(1<<ID_T))
+#define NUM_AKM_SENSORS            (ID_T+1)
 
 #define SENSORS_CM_PROXIMITY       (1<<ID_P)
 #define SENSORS_CM_GROUP           (1<<ID_P)
@@ -74,21 +174,267 @@ static int id_to_sensor[MAX_NUM_SENSORS] = {
 #define SENSORS_LIGHT              (1<<ID_L)
 #define SENSORS_LIGHT_GROUP        (1<<ID_L)
 
+// only report when their value changes
+#define SENSORS_ON_CHANGE          ((1<<ID_P)|(1<<ID_L))
+
+/* the sensor devices, see sBackends */
+#define BACKEND_AKM         0
+#define BACKEND_CM          1
+#define BACKEND_LIGHT       2
+#define NUM_BACKENDS        3
+
+// computed in the HAL from the acceleration and the magnetic field
+#define SENSORS_ROTATION_VECTOR    (1<<ID_RV)
+#define SENSORS_FUSION_INPUTS      ((1<<ID_A)|(1<<ID_M))
+
+// computed in the HAL from the acceleration alone
+#define SENSORS_GRAVITY            (1<<ID_G)
+#define SENSORS_LINEAR_ACCELERATION (1<<ID_LA)
+#define SENSORS_GRAVITY_GROUP      ((1<<ID_G)|(1<<ID_LA))
+#define SENSORS_GRAVITY_INPUTS     (1<<ID_A)
+
+// counted by the AK8973 firmware when it can, or in the HAL from the
+// acceleration. The step counter's value is the number of steps since it
+// was first enabled, in vector.x; the step detector's is always 1.
+#define SENSORS_STEP_DETECTOR      (1<<ID_SD)
+#define SENSORS_STEP_COUNTER       (1<<ID_SC)
+#define SENSORS_STEP_GROUP         ((1<<ID_SD)|(1<<ID_SC))
+#define SENSORS_STEP_INPUTS        (1<<ID_A)
+
+// computed in the HAL from the acceleration, sampled slowly. It fires
+// once and turns itself off, see control__oneshot_thread().
+#define SENSORS_SIGNIFICANT_MOTION (1<<ID_SM)
+#define SENSORS_MOTION_INPUTS      (1<<ID_A)
+#define SENSORS_ONE_SHOT           (1<<ID_SM)
+
+// every one of their events is reported, however close together
+#define SENSORS_EVENTS             ((1<<ID_SD)|(1<<ID_SC)|(1<<ID_SM))
+
 /*****************************************************************************/
 
+/*
+ * State the control device shares with the data devices it hands out data
+ * sources to, which can live in another process. It is an ashmem region
+ * only the process of the control device can write, see
+ * control__shared_open(): the data devices of other processes only read
+ * it, whatever they do can't reach the others.
+ */
+struct sensors_shared_t {
+    /*
+     * what the trusted data contexts decoded last, see
+     * shared_write_latest(). It comes first: other processes map it
+     * alone, see sensors_latest.h
+     */
+    struct sensors_latest_t latest[SENSORS_LATEST_MAX];
+    /* sensors enabled through control__activate */
+    volatile int32_t active;
+    /* delay between two samples asked for each sensor, in ms */
+    volatile int32_t delays[MAX_NUM_SENSORS];
+    /* how long samples can be held back before poll returns them, in ms */
+    volatile int32_t latencies[MAX_NUM_SENSORS];
+    /* bumped by control__flush, see data__check_batches() */
+    volatile int32_t flushes[MAX_NUM_SENSORS];
+    /* bumped by control__wake, to tell wakes from flushes */
+    volatile int32_t wakes;
+    /*
+     * bumped when an on-change sensor is enabled, see data__snapshot(),
+     * or a one-shot one, see data__significant_motion()
+     */
+    volatile int32_t enables[MAX_NUM_SENSORS];
+    /* one-shot sensors that fired, see shared_fire_oneshot() */
+    volatile int32_t fired;
+    /* bumped along with fired, control__oneshot_thread sleeps on it */
+    volatile int32_t oneshots;
+    /* set once the firmware counted steps, see shared_firmware_steps() */
+    volatile int32_t firmware_steps;
+};
+
 struct sensors_control_context_t {
-    struct sensors_control_device_t device; // must be first
-    int akmd_fd;
-    int cmd_fd;
-    int lsd_fd;
+    struct sensors_control_ext_device_t device; // must be first
+    int fds[NUM_BACKENDS];
+    int wake_fd;
+    int shared_fd;
+    struct sensors_shared_t *shared;
+    int channel_fd;
+    struct sensors_channel_t *channel;
     uint32_t active_sensors;
+    uint32_t requested_sensors;
+    uint32_t fusion_sensors;
+    int32_t delays[MAX_NUM_SENSORS];
+    // what each backend was last programmed with, -1 if unknown
+    int32_t backend_delays[NUM_BACKENDS];
+    // groups whose state must be read back from the driver before use
+    uint32_t stale_groups;
+    // groups not brought to the requested state since open
+    uint32_t unsynced_groups;
+    uint32_t activations;
+    uint32_t ioctls;
+    // sensors kept on only for their grace period, see control__activate
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    pthread_t power_thread;
+    int power_thread_running;
+    pthread_t oneshot_thread;
+    int oneshot_thread_running;
+    int stopping;
+    uint32_t lingering_sensors;
+    int32_t grace_ms[NUM_BACKENDS];
+    int64_t power_off_at[NUM_BACKENDS]; // CLOCK_MONOTONIC
+    uint32_t cold_starts_saved;
+};
+
+/* a decoded sample handed over from the reader thread to data__poll */
+struct ring_item_t {
+    int id;
+    sensors_data_t data;
+};
+
+/*
+ * Lock-free ring with a single producer (the reader thread) and a single
+ * consumer (data__poll). head and tail are free running, depth is a power
+ * of two.
+ */
+struct sensors_ring_t {
+    volatile int32_t head;
+    volatile int32_t tail;
+    uint32_t depth;
+    uint32_t high_water;
+    volatile int32_t overruns;
+    struct ring_item_t *items;
+};
+
+/*
+ * Samples of one sensor waiting to be picked by data__poll. Queues are only
+ * touched by the thread calling data__poll and their storage is allocated
+ * once in data_open.
+ */
+struct sensor_queue_t {
+    uint32_t head;
+    uint32_t count;
+    uint32_t depth;
+    int policy;
+    uint32_t drops;
+    uint32_t skips;
+    sensors_data_t *items;
+} __attribute__((aligned(CACHE_LINE_SIZE)));
+
+/*
+ * Running estimate of the period of a stream of timestamps. It starts
+ * over when an interval is less than half or more than twice the period,
+ * e.g. after a gap or a rate change.
+ */
+struct rate_estimator_t {
+    int64_t last;
+    int64_t period;
+    int64_t jitter;
+    uint32_t count;
+};
+
+/* timestamps of the frames of an input device */
+struct frame_clock_t {
+    struct rate_estimator_t rate;
+    int64_t smoothed;
+};
+
+/*
+ * What has been decoded from an input device since its last EV_SYN. Each
+ * device has its own, so a frame is only ever committed by its own SYN,
+ * even when it is split across reads or interleaved with other devices.
+ */
+struct input_frame_t {
+    uint32_t sensors;
+    uint32_t frames;
+    uint32_t split;
+    uint32_t silent;
+};
+
+struct sensor_stats_t {
+    struct rate_estimator_t rate;
+    int64_t latency;
+};
+
+struct sensors_reader_t {
+    pthread_t thread;
+    int running;
+    int epoll_fd;
+    int stop_fd;
+    int notify_fd;
+    // set by the reader thread when it gives up, before its last notify
+    volatile int32_t dead;
+    struct sensors_ring_t ring;
 };
 
+// the most light levels we can translate to lux, see data__scale_open()
+#define LUX_TABLE_SIZE      16
+
 struct sensors_data_context_t {
-    struct sensors_data_device_t device; // must be first
-    int events_fd[3];
+    struct sensors_data_ext_device_t device; // must be first
+    int events_fd[NUM_BACKENDS];
+    int wake_fd;
+    int epoll_fd;
+    int use_reader;
+    struct sensors_reader_t reader;
+    struct sensors_recorder_t *recorder;
+    struct sensors_replay_t *replay;
+    struct sensors_shared_t *shared;
+    // in the process of the control device: writes shared, can write channel
+    int trusted;
+    struct sensors_channel_t *channel;
+    int channelWriter;
+    // when to look again whether the writer of the channel died
+    int64_t channelClaimAt;
     sensors_data_t sensors[MAX_NUM_SENSORS];
+    struct frame_clock_t frameClocks[NUM_BACKENDS];
+    struct input_frame_t frames[NUM_BACKENDS];
+    struct sensor_stats_t stats[MAX_NUM_SENSORS];
+    int64_t lastReported[MAX_NUM_SENSORS];
+    int64_t heldUntil[MAX_NUM_SENSORS];
+    uint32_t heldSensors;
+    int32_t akmRaw[NUM_AKM_SENSORS][4] __attribute__((aligned(16)));
+    sensors_vec_t *akmVectors[NUM_AKM_SENSORS];
+    sensors_vec_t akmReference;
+    uint32_t fusionSensors;
+    uint32_t fusionInputs;
+    struct sensors_fusion_t fusion;
+    struct sensors_fusion_error_t fusionError;
+    uint32_t fusionUpdates;
+    int64_t fusionCpuNs;
+    struct sensors_gravity_t gravity;
+    struct sensors_step_t step;
+    uint32_t stepCount;
+    // last count from the firmware, once it sent one
+    int32_t stepFirmware;
+    int32_t stepFirmwareLast;
+    int stepFromFirmware;
+    // step detector events due with the next publish, see data__steps
+    int stepEvents;
+    struct sensors_motion_t motion;
+    int motionArmed;
+    // fired while we couldn't tell the control device, until enabled again
+    int motionFired;
+    int32_t motionEnables;
+    // on-change sensors whose current value is due, see data__snapshot
+    uint32_t snapshotSensors;
+    int32_t enablesSeen[MAX_NUM_SENSORS];
+    int32_t proximityMin;
+    float proximityScale;
+    int32_t lightMin;
+    int32_t lightLevels;
+    float luxTable[LUX_TABLE_SIZE];
+    int64_t openTime;
+    uint32_t firstSamples;
+    struct sensor_queue_t queues[MAX_NUM_SENSORS];
     uint32_t pendingSensors;
+    // queued samples held back until their report latency, see data__queue
+    uint32_t batchedSensors;
+    int batchFull;
+    int64_t batchDeadline[MAX_NUM_SENSORS];
+    int32_t flushesSeen[MAX_NUM_SENSORS];
+    int32_t wakesSeen;
+    uint32_t batchFlushes;
+    uint32_t batchedSamples;
+    uint32_t maxSkips;
+    int lastPicked;
 };
 
 /*
@@ -128,6 +474,31 @@ static const struct sensor_t sSensorList[] = {
                 "Capella Microsystems",
                 1, SENSORS_HANDLE_BASE+ID_L,
                 SENSOR_TYPE_LIGHT, 10240.0f, 1.0f, 0.5f, { } },
+        { "Rotation vector sensor",
+                "The Android Open Source Project",
+                1, SENSORS_HANDLE_BASE+ID_RV,
+                SENSOR_TYPE_ROTATION_VECTOR, 1.0f, 1.0f/(1<<24), 7.0f, { } },
+        { "Gravity sensor",
+                "The Android Open Source Project",
+                1, SENSORS_HANDLE_BASE+ID_G,
+                SENSOR_TYPE_GRAVITY, 4.0f*9.81f, (4.0f*9.81f)/256.0f, 0.2f, { } },
+        { "Linear acceleration sensor",
+                "The Android Open Source Project",
+                1, SENSORS_HANDLE_BASE+ID_LA,
+                SENSOR_TYPE_LINEAR_ACCELERATION,
+                4.0f*9.81f, (4.0f*9.81f)/256.0f, 0.2f, { } },
+        { "Step detector",
+                "The Android Open Source Project",
+                1, SENSORS_HANDLE_BASE+ID_SD,
+                SENSOR_TYPE_STEP_DETECTOR, 1.0f, 1.0f, 0.2f, { } },
+        { "Step counter",
+                "The Android Open Source Project",
+                1, SENSORS_HANDLE_BASE+ID_SC,
+                SENSOR_TYPE_STEP_COUNTER, 16777216.0f, 1.0f, 0.2f, { } },
+        { "Significant motion sensor",
+                "The Android Open Source Project",
+                1, SENSORS_HANDLE_BASE+ID_SM,
+                SENSOR_TYPE_SIGNIFICANT_MOTION, 1.0f, 1.0f, 0.2f, { } },
 };
 
 static const float sLuxValues[8] = {
@@ -214,756 +585,2693 @@ const struct sensors_module_t HAL_MODULE_INFO_SYM = {
 
 #define SENSOR_STATE_MASK           (0x7FFF)
 
+// slowest the acceleration can come in for the steps to be found in it
+#define STEP_DELAY_MS               20
+
+// most step detector events a frame reports, one per step: a firmware
+// count that jumped further, after the device slept, is only counted
+#define STEP_MAX_EVENTS             16
+
+// the rate the acceleration is watched at for significant motion, what
+// it costs next to an app reading it is in sensors_motion_bench
+#define SIGNIFICANT_MOTION_DELAY_MS 200
+
+// a full compass frame is about a dozen events, read a few frames at once
+#define INPUT_EVENT_BATCH           32
+
+// index of the wake eventfd in the data source handle and epoll set,
+// right after the input devices of the backends
+#define WAKE_FD_INDEX               NUM_BACKENDS
+
+// how often a data device not writing the channel checks its writer is gone
+#define CHANNEL_CLAIM_INTERVAL_MS   1000
+
+// default number of samples the reader thread can queue up for data__poll
+#define READER_RING_DEPTH           64
+
+// default number of samples each sensor can queue up for data__poll
+#define SENSOR_QUEUE_DEPTH          16
+
+// index of the shared state in the data source handle, only there when
+// the wake fd is
+#define SHARED_FD_INDEX             (NUM_BACKENDS + 1)
+
+// index of the sample channel in the data source handle, only there when
+// the shared state is
+#define CHANNEL_FD_INDEX            (NUM_BACKENDS + 2)
+
+/*
+ * What sensors_latest_map() relies on: these fail to compile when the
+ * layout of the data source handle or of the shared state moves.
+ */
+typedef char check_latest_fd_index[
+        SHARED_FD_INDEX == SENSORS_LATEST_FD_INDEX ? 1 : -1];
+typedef char check_latest_max[
+        MAX_NUM_SENSORS <= SENSORS_LATEST_MAX ? 1 : -1];
+typedef char check_latest_offset[
+        offsetof(struct sensors_shared_t, latest) == 0 ? 1 : -1];
+
 /*****************************************************************************/
 
-static int open_inputs(int mode, int *akm_fd, int *p_fd, int *l_fd)
+typedef uint32_t (*process_abs_t)(struct sensors_data_context_t *dev,
+                                  int fd, struct input_event *event);
+
+static uint32_t data__poll_process_akm_abs(struct sensors_data_context_t *dev,
+                                           int fd, struct input_event *event);
+static uint32_t data__poll_process_cm_abs(struct sensors_data_context_t *dev,
+                                          int fd, struct input_event *event);
+static uint32_t data__poll_process_ls_abs(struct sensors_data_context_t *dev,
+                                          int fd, struct input_event *event);
+
+/* a driver flag turning some sensors of a backend on and off */
+struct backend_flag_t {
+    uint32_t sensors;
+    int set;
+    int get;
+    const char *name;
+};
+
+#define BACKEND_FLAG(_sensors, _set, _get) \
+    { .sensors = (_sensors), .set = (_set), .get = (_get), .name = #_set }
+
+/*
+ * A sensor device: the driver node the control device turns its sensors
+ * on and off through, the input device the data device reads them from
+ * and how to decode its events. Everything that deals with devices walks
+ * this table, so a new device is a new entry (and a new ID) and nothing
+ * else. Turning a device off is deferred by a grace period of
+ * "ro.sensors.grace_ms.<name>" ms.
+ */
+struct sensors_backend_t {
+    const char *name;
+    uint32_t mask;
+    int32_t grace_ms;
+    const char *control_node;
+    const char *input_name;
+    process_abs_t process;
+    const struct backend_flag_t *flags;
+    int num_flags;
+    // the flags are shorts rather than ints
+    int short_flags;
+    // ioctl setting the delay between samples in ms (a short), 0 if none
+    int set_delay;
+    // the flags outlive the fd, which can be closed when all are off
+    int close_when_off;
+};
+
+static const struct backend_flag_t sAkmFlags[] = {
+    BACKEND_FLAG(SENSORS_AKM_ORIENTATION,
+                 ECS_IOCTL_APP_SET_MFLAG, ECS_IOCTL_APP_GET_MFLAG),
+    BACKEND_FLAG(SENSORS_AKM_ACCELERATION,
+                 ECS_IOCTL_APP_SET_AFLAG, ECS_IOCTL_APP_GET_AFLAG),
+    BACKEND_FLAG(SENSORS_AKM_TEMPERATURE,
+                 ECS_IOCTL_APP_SET_TFLAG, ECS_IOCTL_APP_GET_TFLAG),
+    BACKEND_FLAG(SENSORS_AKM_MAGNETIC_FIELD,
+                 ECS_IOCTL_APP_SET_MVFLAG, ECS_IOCTL_APP_GET_MVFLAG),
+};
+
+static const struct backend_flag_t sCmFlags[] = {
+    BACKEND_FLAG(SENSORS_CM_PROXIMITY,
+                 CAPELLA_CM3602_IOCTL_ENABLE, CAPELLA_CM3602_IOCTL_GET_ENABLED),
+};
+
+static const struct backend_flag_t sLsFlags[] = {
+    BACKEND_FLAG(SENSORS_LIGHT,
+                 LIGHTSENSOR_IOCTL_ENABLE, LIGHTSENSOR_IOCTL_GET_ENABLED),
+};
+
+static const struct sensors_backend_t sBackends[NUM_BACKENDS] = {
+    [BACKEND_AKM] = {
+        .name = "akm",
+        .mask = SENSORS_AKM_GROUP,
+        .grace_ms = 2000,
+        .control_node = AKM_DEVICE_NAME,
+        .input_name = "compass",
+        .process = data__poll_process_akm_abs,
+        .flags = sAkmFlags,
+        .num_flags = ARRAY_SIZE(sAkmFlags),
+        .short_flags = 1,
+#ifdef ECS_IOCTL_APP_SET_DELAY
+        .set_delay = ECS_IOCTL_APP_SET_DELAY,
+#endif
+        .close_when_off = 1,
+    },
+    [BACKEND_CM] = {
+        .name = "cm",
+        .mask = SENSORS_CM_GROUP,
+        .grace_ms = 500,
+        .control_node = CM_DEVICE_NAME,
+        .input_name = "proximity",
+        .process = data__poll_process_cm_abs,
+        .flags = sCmFlags,
+        .num_flags = ARRAY_SIZE(sCmFlags),
+    },
+    [BACKEND_LIGHT] = {
+        .name = "ls",
+        .mask = SENSORS_LIGHT_GROUP,
+        .grace_ms = 1000,
+        .control_node = LS_DEVICE_NAME,
+        .input_name = "lightsensor-level",
+        .process = data__poll_process_ls_abs,
+        .flags = sLsFlags,
+        .num_flags = ARRAY_SIZE(sLsFlags),
+    },
+};
+
+/*
+ * Where to find the input devices we read from. Scanning /dev/input means
+ * an open() and an EVIOCGNAME ioctl for every node, so the name -> path
+ * mapping is cached and only rebuilt when inotify tells us that something
+ * in the directory changed. "ro.sensors.input_dir" can name another
+ * directory.
+ */
+struct input_cache_t {
+    pthread_mutex_t lock;
+    char dirname[PATH_MAX];
+    char paths[NUM_BACKENDS][PATH_MAX];
+    int inotify_fd;
+    int valid;
+};
+
+static struct input_cache_t sInputCache = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .dirname = "/dev/input",
+    .inotify_fd = -1,
+    .valid = 0,
+};
+
+/* look for the input devices in dirname from now on */
+static void input_cache_set_dir(struct input_cache_t *cache,
+                                const char *dirname)
+{
+    pthread_mutex_lock(&cache->lock);
+    strncpy(cache->dirname, dirname, sizeof(cache->dirname) - 1);
+    cache->dirname[sizeof(cache->dirname) - 1] = '\0';
+    // the watch is on the old directory
+    if (cache->inotify_fd >= 0) {
+        close(cache->inotify_fd);
+        cache->inotify_fd = -1;
+    }
+    cache->valid = 0;
+    pthread_mutex_unlock(&cache->lock);
+}
+
+static int input_get_name(int fd, char *name, size_t size)
+{
+    if (ioctl(fd, EVIOCGNAME(size - 1), name) < 1) {
+        name[0] = '\0';
+        return -1;
+    }
+    name[size - 1] = '\0';
+    return 0;
+}
+
+/* drop the cache if anything was added, removed or chmod'ed in dirname */
+static void input_cache_check_locked(struct input_cache_t *cache)
+{
+    char buf[512];
+    int nread;
+
+    if (cache->inotify_fd < 0) {
+        cache->valid = 0;
+        cache->inotify_fd = inotify_init();
+        if (cache->inotify_fd < 0) {
+            LOGE("Couldn't init inotify (%s)", strerror(errno));
+            return;
+        }
+        fcntl(cache->inotify_fd, F_SETFL, O_NONBLOCK);
+        if (inotify_add_watch(cache->inotify_fd, cache->dirname,
+                              IN_CREATE | IN_DELETE | IN_ATTRIB |
+                              IN_MOVED_FROM | IN_MOVED_TO) < 0) {
+            LOGE("Couldn't watch %s (%s)", cache->dirname, strerror(errno));
+            close(cache->inotify_fd);
+            cache->inotify_fd = -1;
+        }
+        return;
+    }
+
+    while ((nread = read(cache->inotify_fd, buf, sizeof(buf))) > 0) {
+        LOGV("%s changed, dropping the input device cache", cache->dirname);
+        cache->valid = 0;
+    }
+}
+
+static void input_cache_scan_locked(struct input_cache_t *cache, int mode,
+                                    int *fds)
 {
-    /* scan all input drivers and look for "compass" */
-    int fd = -1;
-    const char *dirname = "/dev/input";
     char devname[PATH_MAX];
     char *filename;
     DIR *dir;
     struct dirent *de;
-    dir = opendir(dirname);
-    if(dir == NULL)
-        return -1;
-    strcpy(devname, dirname);
+    int i;
+
+    for (i = 0; i < NUM_BACKENDS; i++)
+        cache->paths[i][0] = '\0';
+
+    dir = opendir(cache->dirname);
+    if (dir == NULL)
+        return;
+    strcpy(devname, cache->dirname);
     filename = devname + strlen(devname);
     *filename++ = '/';
-    *akm_fd = *p_fd = -1;
     while((de = readdir(dir))) {
         if(de->d_name[0] == '.' &&
            (de->d_name[1] == '\0' ||
             (de->d_name[1] == '.' && de->d_name[2] == '\0')))
             continue;
         strcpy(filename, de->d_name);
-        fd = open(devname, mode);
+        int fd = open(devname, mode);
         if (fd>=0) {
             char name[80];
-            if (ioctl(fd, EVIOCGNAME(sizeof(name) - 1), &name) < 1) {
-                name[0] = '\0';
-            }
-            if (!strcmp(name, "compass")) {
-                LOGV("using %s (name=%s)", devname, name);
-                *akm_fd = fd;
-            }
-            else if (!strcmp(name, "proximity")) {
-                LOGV("using %s (name=%s)", devname, name);
-                *p_fd = fd;
-            }
-            else if (!strcmp(name, "lightsensor-level")) {
-                LOGV("using %s (name=%s)", devname, name);
-                *l_fd = fd;
+            input_get_name(fd, name, sizeof(name));
+            for (i = 0; i < NUM_BACKENDS; i++) {
+                if (fds[i] < 0 && !strcmp(name, sBackends[i].input_name)) {
+                    LOGV("using %s (name=%s)", devname, name);
+                    strcpy(cache->paths[i], devname);
+                    fds[i] = fd;
+                    break;
+                }
             }
-            else
+            if (i == NUM_BACKENDS)
                 close(fd);
         }
     }
     closedir(dir);
 
-    fd = 0;
-    if (*akm_fd < 0) {
-        LOGE("Couldn't find or open 'compass' driver (%s)", strerror(errno));
-        fd = -1;
-    }
-    if (*p_fd < 0) {
-        LOGE("Couldn't find or open 'proximity' driver (%s)", strerror(errno));
-        fd = -1;
-    }
-    if (*l_fd < 0) {
-        LOGE("Couldn't find or open 'light' driver (%s)", strerror(errno));
-        fd = -1;
-    }
-    return fd;
+    // only trust the result if inotify will tell us when it gets stale
+    cache->valid = cache->inotify_fd >= 0;
 }
 
-static int open_akm(struct sensors_control_context_t* dev)
+/* open the cached nodes, checking they still are what we think they are */
+static int input_cache_open_locked(struct input_cache_t *cache, int mode,
+                                   int *fds)
 {
-    if (dev->akmd_fd < 0) {
-        dev->akmd_fd = open(AKM_DEVICE_NAME, O_RDONLY);
-        LOGV("%s, fd=%d", __PRETTY_FUNCTION__, dev->akmd_fd);
-        LOGE_IF(dev->akmd_fd<0, "Couldn't open %s (%s)",
-                AKM_DEVICE_NAME, strerror(errno));
-        if (dev->akmd_fd >= 0) {
-            dev->active_sensors &= ~SENSORS_AKM_GROUP;
+    int i;
+    for (i = 0; i < NUM_BACKENDS; i++) {
+        char name[80];
+        if (!cache->paths[i][0])
+            continue;
+        fds[i] = open(cache->paths[i], mode);
+        if (fds[i] < 0)
+            goto stale;
+        if (input_get_name(fds[i], name, sizeof(name)) ||
+                strcmp(name, sBackends[i].input_name))
+            goto stale;
+    }
+    return 0;
+
+stale:
+    LOGV("%s is stale, rescanning %s", cache->paths[i], cache->dirname);
+    for (i = 0; i < NUM_BACKENDS; i++) {
+        if (fds[i] >= 0) {
+            close(fds[i]);
+            fds[i] = -1;
         }
     }
-    return dev->akmd_fd;
+    cache->valid = 0;
+    return -1;
 }
 
-static void close_akm(struct sensors_control_context_t* dev)
+static int input_cache_open(struct input_cache_t *cache, int mode, int *fds)
 {
-    if (dev->akmd_fd >= 0) {
-        LOGV("%s, fd=%d", __PRETTY_FUNCTION__, dev->akmd_fd);
-        close(dev->akmd_fd);
-        dev->akmd_fd = -1;
+    int i;
+    for (i = 0; i < NUM_BACKENDS; i++)
+        fds[i] = -1;
+
+    pthread_mutex_lock(&cache->lock);
+    input_cache_check_locked(cache);
+    if (!cache->valid || input_cache_open_locked(cache, mode, fds) < 0)
+        input_cache_scan_locked(cache, mode, fds);
+    pthread_mutex_unlock(&cache->lock);
+
+    for (i = 0; i < NUM_BACKENDS; i++) {
+        if (fds[i] < 0)
+            return -1;
     }
+    return 0;
 }
 
-static uint32_t read_akm_sensors_state(int fd)
+static int open_inputs(int mode, int *fds)
 {
-    short flags;
-    uint32_t sensors = 0;
-    // read the actual value of all sensors
-    if (!ioctl(fd, ECS_IOCTL_APP_GET_MFLAG, &flags)) {
-        if (flags)  sensors |= SENSORS_AKM_ORIENTATION;
-        else        sensors &= ~SENSORS_AKM_ORIENTATION;
-    }
-    if (!ioctl(fd, ECS_IOCTL_APP_GET_AFLAG, &flags)) {
-        if (flags)  sensors |= SENSORS_AKM_ACCELERATION;
-        else        sensors &= ~SENSORS_AKM_ACCELERATION;
-    }
-    if (!ioctl(fd, ECS_IOCTL_APP_GET_TFLAG, &flags)) {
-        if (flags)  sensors |= SENSORS_AKM_TEMPERATURE;
-        else        sensors &= ~SENSORS_AKM_TEMPERATURE;
-    }
-    if (!ioctl(fd, ECS_IOCTL_APP_GET_MVFLAG, &flags)) {
-        if (flags)  sensors |= SENSORS_AKM_MAGNETIC_FIELD;
-        else        sensors &= ~SENSORS_AKM_MAGNETIC_FIELD;
+    int err = input_cache_open(&sInputCache, mode, fds);
+    int i;
+    for (i = 0; i < NUM_BACKENDS; i++) {
+        LOGE_IF(fds[i] < 0, "Couldn't find or open '%s' driver (%s)",
+                sBackends[i].input_name, strerror(errno));
     }
-    return sensors;
+    return err;
 }
 
-static uint32_t enable_disable_akm(struct sensors_control_context_t *dev,
-                                   uint32_t active, uint32_t sensors,
-                                   uint32_t mask)
-{
-    uint32_t now_active_akm_sensors;
-
-    int fd = open_akm(dev);
-    if (fd < 0)
-        return 0;
-
-    LOGV("(before) akm sensors = %08x, real = %08x",
-         sensors, read_akm_sensors_state(fd));
+/*
+ * The control device whose shared state and channel this process can
+ * write, see control__shared_open(). A child forked from its process
+ * can't, it only inherited the pointer.
+ */
+static pthread_mutex_t sOwnerLock = PTHREAD_MUTEX_INITIALIZER;
+static struct sensors_control_context_t *sOwner;
+static pid_t sOwnerPid;
 
-    short flags;
-    if (mask & SENSORS_AKM_ORIENTATION) {
-        flags = (sensors & SENSORS_AKM_ORIENTATION) ? 1 : 0;
-        if (ioctl(fd, ECS_IOCTL_APP_SET_MFLAG, &flags) < 0) {
-            LOGE("ECS_IOCTL_APP_SET_MFLAG error (%s)", strerror(errno));
-        }
-    }
-    if (mask & SENSORS_AKM_ACCELERATION) {
-        flags = (sensors & SENSORS_AKM_ACCELERATION) ? 1 : 0;
-        if (ioctl(fd, ECS_IOCTL_APP_SET_AFLAG, &flags) < 0) {
-            LOGE("ECS_IOCTL_APP_SET_AFLAG error (%s)", strerror(errno));
-        }
-    }
-    if (mask & SENSORS_AKM_TEMPERATURE) {
-        flags = (sensors & SENSORS_AKM_TEMPERATURE) ? 1 : 0;
-        if (ioctl(fd, ECS_IOCTL_APP_SET_TFLAG, &flags) < 0) {
-            LOGE("ECS_IOCTL_APP_SET_TFLAG error (%s)", strerror(errno));
-        }
-    }
-    if (mask & SENSORS_AKM_MAGNETIC_FIELD) {
-        flags = (sensors & SENSORS_AKM_MAGNETIC_FIELD) ? 1 : 0;
-        if (ioctl(fd, ECS_IOCTL_APP_SET_MVFLAG, &flags) < 0) {
-            LOGE("ECS_IOCTL_APP_SET_MVFLAG error (%s)", strerror(errno));
-        }
+static struct sensors_shared_t *shared_map(int fd, int prot)
+{
+    void *p = mmap(NULL, sizeof(struct sensors_shared_t), prot,
+                   MAP_SHARED, fd, 0);
+    if (p == MAP_FAILED) {
+        LOGE("Couldn't map the shared state (%s)", strerror(errno));
+        return NULL;
     }
-
-    now_active_akm_sensors = read_akm_sensors_state(fd);
-
-    LOGV("(after) akm sensors = %08x, real = %08x",
-         sensors, now_active_akm_sensors);
-
-    if (!sensors)
-        close_akm(dev);
-
-    return now_active_akm_sensors;
+    return p;
 }
 
-static uint32_t read_cm_sensors_state(int fd)
+static void shared_unmap(struct sensors_shared_t *shared)
 {
-    int flags;
-    uint32_t sensors = 0;
-    // read the actual value of all sensors
-    if (!ioctl(fd, CAPELLA_CM3602_IOCTL_GET_ENABLED, &flags)) {
-        if (flags)  sensors |= SENSORS_CM_PROXIMITY;
-        else        sensors &= ~SENSORS_CM_PROXIMITY;
-    }
-
-    return sensors;
+    if (shared)
+        munmap(shared, sizeof(*shared));
 }
 
-static int open_cm(struct sensors_control_context_t* dev)
+/*
+ * Map the pages 'p' maps once more, writable if they are there: with an
+ * old size of 0, mremap() copies a shared mapping rather than moving it.
+ * The copy is the caller's to unmap. Returns NULL on failure.
+ */
+static void *map_again(void *p, size_t size)
 {
-    if (dev->cmd_fd < 0) {
-        dev->cmd_fd = open(CM_DEVICE_NAME, O_RDONLY);
-        LOGV("%s, fd=%d", __PRETTY_FUNCTION__, dev->cmd_fd);
-        LOGE_IF(dev->cmd_fd<0, "Couldn't open %s (%s)",
-                CM_DEVICE_NAME, strerror(errno));
-        if (dev->cmd_fd >= 0) {
-            dev->active_sensors &= ~SENSORS_CM_GROUP;
-        }
-    }
-    return dev->cmd_fd;
+    void *q = mremap(p, 0, size, MREMAP_MAYMOVE);
+    return q == MAP_FAILED ? NULL : q;
 }
 
-static void close_cm(struct sensors_control_context_t* dev)
+/*
+ * Only the data contexts of the process of the control device write the
+ * latest values, the processes they are shared with can't forge them.
+ * They all decode the same events, so when another one is already writing
+ * the value of a sensor we leave it to it rather than wait: there is never
+ * more than one writer per value.
+ */
+static void shared_write_latest(struct sensors_shared_t *shared, int id,
+                                const sensors_data_t *data)
 {
-    if (dev->cmd_fd >= 0) {
-        LOGV("%s, fd=%d", __PRETTY_FUNCTION__, dev->cmd_fd);
-        close(dev->cmd_fd);
-        dev->cmd_fd = -1;
-    }
+    struct sensors_latest_t *latest = &shared->latest[id];
+    int32_t seq = latest->seq;
+    if ((seq & 1) || android_atomic_acquire_cas(seq, seq + 1, &latest->seq))
+        return;
+    latest->data = *data;
+    // skip 0 when wrapping around, it means "no value"
+    seq += 2;
+    android_atomic_release_store(seq ? seq : 2, &latest->seq);
 }
 
-static int enable_disable_cm(struct sensors_control_context_t *dev,
-                             uint32_t active, uint32_t sensors, uint32_t mask)
+static int futex(volatile int32_t *addr, int op, int32_t value)
 {
-    int rc = 0;
-    uint32_t now_active_cm_sensors;
-    int fd = open_cm(dev);
+    // not FUTEX_PRIVATE_FLAG, the data devices can be in other processes
+    return syscall(__NR_futex, addr, op, value, NULL, NULL, 0);
+}
 
-    if (fd < 0) {
-        LOGE("Couldn't open %s (%s)", CM_DEVICE_NAME, strerror(errno));
+/*
+ * Fire the one-shot sensors in mask and have the control device turn them
+ * off, from its process only. Only the first data device to fire them gets to report them, the
+ * others see them fired until the control device clears them again.
+ * Returns whether we were first.
+ */
+static int shared_fire_oneshot(struct sensors_shared_t *shared,
+                               uint32_t mask)
+{
+    if (android_atomic_or(mask, &shared->fired) & mask)
         return 0;
-    }
+    android_atomic_inc(&shared->oneshots);
+    futex(&shared->oneshots, FUTEX_WAKE, 1);
+    return 1;
+}
 
-    LOGV("(before) cm sensors = %08x, real = %08x",
-         sensors, read_cm_sensors_state(fd));
+/*
+ * The firmware counts the steps, the acceleration doesn't have to come
+ * in at STEP_DELAY_MS for us to find them any more. The control device
+ * hears about it like about the one-shots, see control__update_delay().
+ */
+static void shared_firmware_steps(struct sensors_shared_t *shared)
+{
+    if (android_atomic_acquire_cas(0, 1, &shared->firmware_steps))
+        return;
+    android_atomic_inc(&shared->oneshots);
+    futex(&shared->oneshots, FUTEX_WAKE, 1);
+}
 
-    if (mask & SENSORS_CM_PROXIMITY) {
-        int flags = (sensors & SENSORS_CM_PROXIMITY) ? 1 : 0;
-        rc = ioctl(fd, CAPELLA_CM3602_IOCTL_ENABLE, &flags);
-        if (rc < 0)
-            LOGE("CAPELLA_CM3602_IOCTL_ENABLE error (%s)", strerror(errno));
-    }
+static int shared_read_latest(struct sensors_shared_t *shared, int id,
+                              sensors_data_t *data)
+{
+    return sensors_latest_read(shared->latest, SENSORS_HANDLE_BASE + id,
+                               data);
+}
 
-    now_active_cm_sensors = read_cm_sensors_state(fd);
+/*
+ * Sensors computed in the HAL by fusing the acceleration and the magnetic
+ * field. When "ro.sensors.orientation" is "hal", this includes the
+ * orientation, which akmd computes otherwise.
+ */
+static uint32_t fusion_sensors(void)
+{
+    char value[PROPERTY_VALUE_MAX];
+    property_get("ro.sensors.orientation", value, "akmd");
+    if (!strcmp(value, "hal"))
+        return SENSORS_ROTATION_VECTOR | SENSORS_AKM_ORIENTATION;
+    return SENSORS_ROTATION_VECTOR;
+}
 
-    LOGV("(after) cm sensors = %08x, real = %08x",
-         sensors, now_active_cm_sensors);
+/*
+ * Recording and replaying the input streams are for debugging only. The
+ * debug.* properties asking for them can be set from the shell, and every
+ * process opening a data device, system_server included, would write or
+ * read whatever file they name.
+ */
+static int debug_streams_allowed(void)
+{
+    char value[PROPERTY_VALUE_MAX];
+    property_get("ro.debuggable", value, "0");
+    return !strcmp(value, "1");
+}
 
-    return now_active_cm_sensors;
+/*
+ * Every ioctl the control device makes to the sensor drivers goes through
+ * here, so we can see how many activation changes cost.
+ */
+static int control__ioctl(struct sensors_control_context_t *dev, int fd,
+                          int request, void *arg)
+{
+    dev->ioctls++;
+    return ioctl(fd, request, arg);
 }
 
-static uint32_t read_ls_sensors_state(int fd)
+static int backend__open(struct sensors_control_context_t *dev, int i)
 {
-    int flags;
-    uint32_t sensors = 0;
-    // read the actual value of all sensors
-    if (!ioctl(fd, LIGHTSENSOR_IOCTL_GET_ENABLED, &flags)) {
-        if (flags)  sensors |= SENSORS_LIGHT;
-        else        sensors &= ~SENSORS_LIGHT;
+    const char *node = sBackends[i].control_node;
+    if (dev->fds[i] < 0) {
+        dev->fds[i] = open(node, O_RDONLY);
+        LOGV("%s %s, fd=%d", __PRETTY_FUNCTION__, node, dev->fds[i]);
+        LOGE_IF(dev->fds[i]<0, "Couldn't open %s (%s)",
+                node, strerror(errno));
     }
+    return dev->fds[i];
+}
 
-    return sensors;
+static void backend__close(struct sensors_control_context_t *dev, int i)
+{
+    if (dev->fds[i] >= 0) {
+        LOGV("%s %s, fd=%d", __PRETTY_FUNCTION__, sBackends[i].control_node,
+             dev->fds[i]);
+        close(dev->fds[i]);
+        dev->fds[i] = -1;
+        dev->backend_delays[i] = -1;
+    }
 }
 
-static int open_ls(struct sensors_control_context_t* dev)
+/* get or set a flag of backend b, whatever its size */
+static int backend__flag_ioctl(struct sensors_control_context_t *dev,
+                               const struct sensors_backend_t *b, int fd,
+                               int request, int *value)
 {
-    if (dev->lsd_fd < 0) {
-        dev->lsd_fd = open(LS_DEVICE_NAME, O_RDONLY);
-        LOGV("%s, fd=%d", __PRETTY_FUNCTION__, dev->lsd_fd);
-        LOGE_IF(dev->lsd_fd<0, "Couldn't open %s (%s)",
-                LS_DEVICE_NAME, strerror(errno));
-        if (dev->lsd_fd >= 0) {
-            dev->active_sensors &= ~SENSORS_LIGHT_GROUP;
-        }
+    if (b->short_flags) {
+        short flags = *value;
+        int err = control__ioctl(dev, fd, request, &flags);
+        *value = flags;
+        return err;
     }
-    return dev->lsd_fd;
+    return control__ioctl(dev, fd, request, value);
 }
 
-static void close_ls(struct sensors_control_context_t* dev)
+static uint32_t backend__read_state(struct sensors_control_context_t *dev,
+                                    int i, int fd)
 {
-    if (dev->lsd_fd >= 0) {
-        LOGV("%s, fd=%d", __PRETTY_FUNCTION__, dev->lsd_fd);
-        close(dev->lsd_fd);
-        dev->lsd_fd = -1;
+    const struct sensors_backend_t *b = &sBackends[i];
+    uint32_t sensors = 0;
+    int j;
+    // read the actual value of all sensors
+    for (j = 0; j < b->num_flags; j++) {
+        int flags;
+        if (!backend__flag_ioctl(dev, b, fd, b->flags[j].get, &flags) &&
+                flags)
+            sensors |= b->flags[j].sensors;
     }
+    return sensors;
 }
 
-static int enable_disable_ls(struct sensors_control_context_t *dev,
-                             uint32_t active, uint32_t sensors, uint32_t mask)
+/*
+ * Set the flag of every sensor of backend i in mask and return the new
+ * state of the backend. The state is only read back from the driver when
+ * we don't trust what we think it is: when the control device was just
+ * opened or after an ioctl failed.
+ */
+static uint32_t backend__enable_disable(struct sensors_control_context_t *dev,
+                                        int i, uint32_t active,
+                                        uint32_t sensors, uint32_t mask)
 {
-    int rc = 0;
-    uint32_t now_active_ls_sensors;
-    int fd = open_ls(dev);
+    const struct sensors_backend_t *b = &sBackends[i];
+    int j;
 
+    int fd = backend__open(dev, i);
     if (fd < 0) {
-        LOGE("Couldn't open %s (%s)", LS_DEVICE_NAME, strerror(errno));
+        dev->stale_groups |= b->mask;
         return 0;
     }
 
-    LOGV("(before) ls sensors = %08x, real = %08x",
-         sensors, read_ls_sensors_state(fd));
-
-    if (mask & SENSORS_LIGHT) {
-        int flags = (sensors & SENSORS_LIGHT) ? 1 : 0;
-        rc = ioctl(fd, LIGHTSENSOR_IOCTL_ENABLE, &flags);
-        if (rc < 0)
-            LOGE("LIGHTSENSOR_IOCTL_ENABLE error (%s)", strerror(errno));
+    if (dev->stale_groups & b->mask) {
+        active = backend__read_state(dev, i, fd);
+        mask = active ^ sensors;
+        dev->stale_groups &= ~b->mask;
     }
 
-    now_active_ls_sensors = read_ls_sensors_state(fd);
+    LOGV("%s sensors = %08x -> %08x", b->name, active, sensors);
+
+    for (j = 0; j < b->num_flags; j++) {
+        if (!(mask & b->flags[j].sensors))
+            continue;
+        int flags = (sensors & b->flags[j].sensors) ? 1 : 0;
+        if (backend__flag_ioctl(dev, b, fd, b->flags[j].set, &flags) < 0) {
+            LOGE("%s error (%s)", b->flags[j].name, strerror(errno));
+            mask &= ~b->flags[j].sensors;
+            dev->stale_groups |= b->mask;
+        }
+    }
+    active = (active & ~mask) | (sensors & mask);
 
-    LOGV("(after) ls sensors = %08x, real = %08x",
-         sensors, now_active_ls_sensors);
+    // the state we know stays right
+    if (!active && b->close_when_off)
+        backend__close(dev, i);
 
-    return now_active_ls_sensors;
+    return active;
 }
 
 /*****************************************************************************/
 
-static native_handle_t* control__open_data_source(struct sensors_control_context_t *dev)
+/*
+ * Create the state shared with the data devices, and the channel that goes
+ * with it in the data source handle. We keep the only writable mappings of
+ * them, every other one is read-only: the data devices of this process
+ * copy ours, see data__map_shared(). Without them, the data side computes
+ * everything it can.
+ */
+static void control__shared_open(struct sensors_control_context_t *dev)
 {
-    native_handle_t* handle;
-    int akm_fd, p_fd, l_fd;
-
-    if (open_inputs(O_RDONLY, &akm_fd, &p_fd, &l_fd) < 0 ||
-            akm_fd < 0 || p_fd < 0 || l_fd < 0) {
-        return NULL;
+    dev->channel_fd = -1;
+    dev->shared_fd = ashmem_create_region("sensors",
+                                          sizeof(struct sensors_shared_t));
+    if (dev->shared_fd >= 0)
+        dev->shared = shared_map(dev->shared_fd, PROT_READ | PROT_WRITE);
+    if (dev->shared && ashmem_set_prot_region(dev->shared_fd, PROT_READ) < 0) {
+        shared_unmap(dev->shared);
+        dev->shared = NULL;
     }
+    if (!dev->shared) {
+        LOGE("Couldn't create the shared state (%s)", strerror(errno));
+        if (dev->shared_fd >= 0)
+            close(dev->shared_fd);
+        dev->shared_fd = -1;
+        return;
+    }
+    dev->channel_fd = sensors_channel_create(&dev->channel);
 
-    handle = native_handle_create(3, 0);
-    handle->data[0] = akm_fd;
-    handle->data[1] = p_fd;
-    handle->data[2] = l_fd;
-
-    return handle;
+    pthread_mutex_lock(&sOwnerLock);
+    sOwner = dev;
+    sOwnerPid = getpid();
+    pthread_mutex_unlock(&sOwnerLock);
 }
 
-static int control__activate(struct sensors_control_context_t *dev,
-        int handle, int enabled)
+/*
+ * Make the handle of a data source reading the input devices from fds[],
+ * which it takes over, along with the fds the control device shares.
+ */
+static native_handle_t* control__make_data_source(
+        struct sensors_control_context_t *dev, const int *fds)
 {
-    if ((handle < SENSORS_HANDLE_BASE) ||
-            (handle >= SENSORS_HANDLE_BASE+MAX_NUM_SENSORS))
-        return -1;
+    native_handle_t* handle;
+    int i;
 
-    uint32_t mask = (1 << handle);
-    uint32_t sensors = enabled ? mask : 0;
+    int numFds = NUM_BACKENDS;
+    if (dev->wake_fd >= 0)
+        numFds = WAKE_FD_INDEX + 1;
+    if (numFds > WAKE_FD_INDEX && dev->shared_fd >= 0)
+        numFds = SHARED_FD_INDEX + 1;
+    if (numFds > SHARED_FD_INDEX && dev->channel_fd >= 0)
+        numFds = CHANNEL_FD_INDEX + 1;
+    handle = native_handle_create(numFds, 0);
+    for (i = 0; i < NUM_BACKENDS; i++)
+        handle->data[i] = fds[i];
+    if (numFds > WAKE_FD_INDEX)
+        handle->data[WAKE_FD_INDEX] = dup(dev->wake_fd);
+    if (numFds > SHARED_FD_INDEX)
+        handle->data[SHARED_FD_INDEX] = dup(dev->shared_fd);
+    if (numFds > CHANNEL_FD_INDEX)
+        handle->data[CHANNEL_FD_INDEX] = dup(dev->channel_fd);
 
-    uint32_t active = dev->active_sensors;
-    uint32_t new_sensors = (active & ~mask) | (sensors & mask);
-    uint32_t changed = active ^ new_sensors;
+    return handle;
+}
 
-    if (changed) {
-        if (!active && new_sensors)
-            // force all sensors to be updated
-            changed = SUPPORTED_SENSORS;
-
-        dev->active_sensors =
-            enable_disable_akm(dev,
-                               active & SENSORS_AKM_GROUP,
-                               new_sensors & SENSORS_AKM_GROUP,
-                               changed & SENSORS_AKM_GROUP) |
-            enable_disable_cm(dev,
-                              active & SENSORS_CM_GROUP,
-                              new_sensors & SENSORS_CM_GROUP,
-                              changed & SENSORS_CM_GROUP) |
-            enable_disable_ls(dev,
-                              active & SENSORS_LIGHT_GROUP,
-                              new_sensors & SENSORS_LIGHT_GROUP,
-                              changed & SENSORS_LIGHT_GROUP);
-    }
+static native_handle_t* control__open_data_source(struct sensors_control_context_t *dev)
+{
+    int fds[NUM_BACKENDS];
+    int i;
+
+    if (open_inputs(O_RDONLY, fds) < 0) {
+        char value[PROPERTY_VALUE_MAX];
+        for (i = 0; i < NUM_BACKENDS; i++) {
+            if (fds[i] >= 0)
+                close(fds[i]);
+        }
+        // a replaying data source doesn't read from the input devices
+        if (!debug_streams_allowed() ||
+                !property_get("debug.sensors.replay", value, ""))
+            return NULL;
+        for (i = 0; i < NUM_BACKENDS; i++)
+            fds[i] = open("/dev/null", O_RDONLY);
+    }
+
+    return control__make_data_source(dev, fds);
+}
+
+/* the physical sensors needed to produce the sensors in mask */
+static uint32_t control__inputs(struct sensors_control_context_t *dev,
+                                uint32_t sensors)
+{
+    uint32_t inputs = sensors & ~(dev->fusion_sensors | SENSORS_GRAVITY_GROUP |
+                                  SENSORS_STEP_GROUP |
+                                  SENSORS_SIGNIFICANT_MOTION);
+    if (sensors & dev->fusion_sensors)
+        inputs |= SENSORS_FUSION_INPUTS;
+    if (sensors & SENSORS_GRAVITY_GROUP)
+        inputs |= SENSORS_GRAVITY_INPUTS;
+    if (sensors & SENSORS_STEP_GROUP)
+        inputs |= SENSORS_STEP_INPUTS;
+    if (sensors & SENSORS_SIGNIFICANT_MOTION)
+        inputs |= SENSORS_MOTION_INPUTS;
+    return inputs;
+}
+
+/*
+ * Run every backend that can be programmed at the fastest rate any enabled
+ * sensor that needs it asked for. The data side decimates the samples for
+ * the slower ones.
+ */
+static int control__update_delay(struct sensors_control_context_t *dev)
+{
+    int firmware_steps = dev->shared &&
+            android_atomic_acquire_load(&dev->shared->firmware_steps);
+    int err = 0;
+    int b;
+    for (b = 0; b < NUM_BACKENDS; b++) {
+        uint32_t mask = dev->requested_sensors;
+        int32_t ms = -1;
+        if (!sBackends[b].set_delay || dev->fds[b] < 0)
+            continue;
+        while (mask) {
+            uint32_t i = 31 - __builtin_clz(mask);
+            mask &= ~(1<<i);
+            if (!(control__inputs(dev, 1<<i) & sBackends[b].mask))
+                continue;
+            int32_t delay = dev->delays[i];
+            // whatever rate the steps are asked at, they are found at this
+            // one, unless the firmware counts them
+            if ((SENSORS_STEP_GROUP & (1<<i)) && delay > STEP_DELAY_MS &&
+                    !firmware_steps)
+                delay = STEP_DELAY_MS;
+            // and significant motion is watched for at a low rate
+            if (SENSORS_SIGNIFICANT_MOTION & (1<<i))
+                delay = SIGNIFICANT_MOTION_DELAY_MS;
+            if (ms < 0 || delay < ms)
+                ms = delay;
+        }
+        if (ms < 0 || ms == dev->backend_delays[b])
+            continue;
+        short delay = ms;
+        if (control__ioctl(dev, dev->fds[b], sBackends[b].set_delay,
+                           &delay) < 0) {
+            LOGE("%s: set delay error (%s)", sBackends[b].name,
+                 strerror(errno));
+            dev->backend_delays[b] = -1;
+            err = -errno;
+            continue;
+        }
+        dev->backend_delays[b] = ms;
+    }
+    return err;
+}
+
+/*
+ * Bring the drivers to the state the requested sensors need, plus the
+ * lingering ones. Only the groups that change are touched.
+ */
+static void control__apply_locked(struct sensors_control_context_t *dev)
+{
+    // the sensors we compute need the ones we compute them from
+    uint32_t new_sensors = control__inputs(dev, dev->requested_sensors) |
+            dev->lingering_sensors;
+
+    uint32_t active = dev->active_sensors;
+    uint32_t changed = active ^ new_sensors;
+    int i;
+
+    // the first time, every group: a process that died holding the
+    // control device may have left a driver on that nobody asks for
+    changed |= dev->unsynced_groups;
+    dev->unsynced_groups = 0;
+
+    for (i = 0; i < NUM_BACKENDS; i++) {
+        uint32_t group = sBackends[i].mask;
+        if (changed & group)
+            active = (active & ~group) |
+                backend__enable_disable(dev, i, active & group,
+                                        new_sensors & group,
+                                        changed & group);
+    }
+    dev->active_sensors = active;
+}
+
+/*
+ * Turns the sensors that lingered past their group's grace period off.
+ * It only runs while something lingers.
+ */
+static void *control__power_thread(void *arg)
+{
+    struct sensors_control_context_t *dev = arg;
+    int i;
+
+    pthread_mutex_lock(&dev->lock);
+    while (!dev->stopping) {
+        int64_t now = clock_ns(CLOCK_MONOTONIC);
+        int64_t due = 0;
+        uint32_t expired = 0;
+
+        for (i = 0; i < NUM_BACKENDS; i++) {
+            if (!(dev->lingering_sensors & sBackends[i].mask))
+                continue;
+            if (dev->power_off_at[i] <= now)
+                expired |= sBackends[i].mask;
+            else if (!due || dev->power_off_at[i] < due)
+                due = dev->power_off_at[i];
+        }
+        if (expired) {
+            LOGV("grace period over for %08x",
+                 dev->lingering_sensors & expired);
+            dev->lingering_sensors &= ~expired;
+            control__apply_locked(dev);
+        } else if (due) {
+            cond_timedwait_monotonic(&dev->cond, &dev->lock, due);
+        } else {
+            pthread_cond_wait(&dev->cond, &dev->lock);
+        }
+    }
+    pthread_mutex_unlock(&dev->lock);
+    return NULL;
+}
+
+static int control__kick(struct sensors_control_context_t *dev);
+
+static void control__activate_locked(struct sensors_control_context_t *dev,
+        uint32_t mask, int enabled)
+{
+    int i;
+    uint32_t sensors = enabled ? mask : 0;
+    uint32_t requested = (dev->requested_sensors & ~mask) | (sensors & mask);
+    dev->requested_sensors = requested;
+    if (dev->shared) {
+        // a one-shot enabled again can fire again
+        uint32_t oneshots = sensors & SENSORS_ONE_SHOT;
+        if (oneshots)
+            android_atomic_and(~oneshots, &dev->shared->fired);
+        while (oneshots) {
+            i = 31 - __builtin_clz(oneshots);
+            oneshots &= ~(1<<i);
+            android_atomic_inc(&dev->shared->enables[i]);
+        }
+        android_atomic_release_store(requested, &dev->shared->active);
+    }
+
+    dev->activations++;
+
+    /*
+     * Sensors going off stay on for the grace period of their group, in
+     * case somebody wants them back right away: that saves a reopen and
+     * the warm-up of the chip.
+     */
+    uint32_t wanted = control__inputs(dev, requested);
+    uint32_t going = dev->active_sensors & ~wanted & ~dev->lingering_sensors;
+    int64_t now = clock_ns(CLOCK_MONOTONIC);
+    for (i = 0; i < NUM_BACKENDS; i++) {
+        uint32_t group = sBackends[i].mask;
+        if (dev->lingering_sensors & wanted & group) {
+            dev->cold_starts_saved++;
+            LOGV("%s still on, no cold start", sBackends[i].name);
+        }
+        if ((going & group) && dev->grace_ms[i] > 0) {
+            dev->lingering_sensors |= going & group;
+            dev->power_off_at[i] = now + dev->grace_ms[i] * 1000000LL;
+        }
+    }
+    dev->lingering_sensors &= ~wanted;
+
+    control__apply_locked(dev);
+
+    /*
+     * Once their driver is on, the data devices publish the current value
+     * of the on-change sensors just enabled, see data__snapshot.
+     */
+    uint32_t on_change = sensors & SENSORS_ON_CHANGE & dev->active_sensors;
+    if (dev->shared && on_change) {
+        uint32_t mask = on_change;
+        while (mask) {
+            i = 31 - __builtin_clz(mask);
+            mask &= ~(1<<i);
+            android_atomic_inc(&dev->shared->enables[i]);
+        }
+        if (dev->wake_fd >= 0)
+            control__kick(dev);
+    }
+    if (dev->lingering_sensors) {
+        if (!dev->power_thread_running) {
+            if (!pthread_create(&dev->power_thread, NULL,
+                                control__power_thread, dev))
+                dev->power_thread_running = 1;
+            else
+                LOGE("Couldn't start the power thread, grace periods lost");
+        }
+        pthread_cond_signal(&dev->cond);
+    }
+
+    // the fastest rate asked for may have changed
+    control__update_delay(dev);
+}
+
+/*
+ * Turns the one-shot sensors off once they fired. The data devices can't
+ * reach the drivers, they tell us through the shared block instead, see
+ * shared_fire_oneshot(). The same way, it slows the acceleration down
+ * once the firmware counts the steps, see shared_firmware_steps().
+ * Started by the first one-shot or step activation, it sleeps on a futex
+ * the rest of the time.
+ */
+static void *control__oneshot_thread(void *arg)
+{
+    struct sensors_control_context_t *dev = arg;
+    struct sensors_shared_t *shared = dev->shared;
+    int firmware_steps = 0;
+
+    while (1) {
+        int32_t seq = android_atomic_acquire_load(&shared->oneshots);
+        pthread_mutex_lock(&dev->lock);
+        if (dev->stopping) {
+            pthread_mutex_unlock(&dev->lock);
+            break;
+        }
+        // they stay fired, and unreported, until they are off
+        uint32_t fired = android_atomic_acquire_load(&shared->fired);
+        if (fired & dev->requested_sensors) {
+            LOGV("one-shot sensors %08x fired", fired);
+            control__activate_locked(dev, fired & dev->requested_sensors, 0);
+        }
+        if (fired)
+            android_atomic_and(~fired, &shared->fired);
+        if (!firmware_steps &&
+                android_atomic_acquire_load(&shared->firmware_steps)) {
+            LOGV("the firmware counts the steps");
+            firmware_steps = 1;
+            control__update_delay(dev);
+        }
+        pthread_mutex_unlock(&dev->lock);
+        futex(&shared->oneshots, FUTEX_WAIT, seq);
+    }
+    return NULL;
+}
+
+static int control__activate(struct sensors_control_context_t *dev,
+        int handle, int enabled)
+{
+    if ((handle < SENSORS_HANDLE_BASE) ||
+            (handle >= SENSORS_HANDLE_BASE+MAX_NUM_SENSORS))
+        return -1;
+
+    uint32_t mask = (1 << handle);
+
+    pthread_mutex_lock(&dev->lock);
+    control__activate_locked(dev, mask, enabled);
+    if (enabled && (mask & (SENSORS_ONE_SHOT | SENSORS_STEP_GROUP)) &&
+            dev->shared && !dev->oneshot_thread_running) {
+        if (!pthread_create(&dev->oneshot_thread, NULL,
+                            control__oneshot_thread, dev))
+            dev->oneshot_thread_running = 1;
+        else
+            LOGE("Couldn't start the one-shot thread");
+    }
+    pthread_mutex_unlock(&dev->lock);
+    return 0;
+}
+
+static int control__set_delay_handle(struct sensors_control_context_t *dev,
+                                     int handle, int32_t ms)
+{
+    if ((handle < SENSORS_HANDLE_BASE) ||
+            (handle >= SENSORS_HANDLE_BASE+MAX_NUM_SENSORS) || ms < 0)
+        return -EINVAL;
+    int id = handle - SENSORS_HANDLE_BASE;
+    pthread_mutex_lock(&dev->lock);
+    dev->delays[id] = ms;
+    if (dev->shared)
+        android_atomic_release_store(ms, &dev->shared->delays[id]);
+    int err = control__update_delay(dev);
+    pthread_mutex_unlock(&dev->lock);
+    return err;
+}
+
+static int control__set_delay(struct sensors_control_context_t *dev, int32_t ms)
+{
+    int i;
+    if (ms < 0)
+        return -EINVAL;
+    pthread_mutex_lock(&dev->lock);
+    for (i = 0; i < MAX_NUM_SENSORS; i++) {
+        dev->delays[i] = ms;
+        if (dev->shared)
+            android_atomic_release_store(ms, &dev->shared->delays[i]);
+    }
+    int err = control__update_delay(dev);
+    pthread_mutex_unlock(&dev->lock);
+    return err;
+}
+
+static int control__get_control_stats(struct sensors_control_context_t *dev,
+                                     struct sensors_control_stats_t *stats)
+{
+    pthread_mutex_lock(&dev->lock);
+    stats->activations = dev->activations;
+    stats->ioctls = dev->ioctls;
+    stats->cold_starts_saved = dev->cold_starts_saved;
+    pthread_mutex_unlock(&dev->lock);
+    return 0;
+}
+
+static int control__get_latest(struct sensors_control_context_t *dev,
+                               int handle, sensors_data_t *data)
+{
+    if ((handle < SENSORS_HANDLE_BASE) ||
+            (handle >= SENSORS_HANDLE_BASE+MAX_NUM_SENSORS))
+        return -EINVAL;
+    if (!dev->shared)
+        return -ENOSYS;
+    return shared_read_latest(dev->shared, handle - SENSORS_HANDLE_BASE, data);
+}
+
+static int control__get_channel_fd(struct sensors_control_context_t *dev)
+{
+    if (dev->channel_fd < 0)
+        return -ENOSYS;
+    int fd = dup(dev->channel_fd);
+    return fd < 0 ? -errno : fd;
+}
+
+static int control__kick(struct sensors_control_context_t *dev)
+{
+    /*
+     * The data side never reads this eventfd, it watches it edge-triggered.
+     * Every write is one new edge for every data context sharing it, so
+     * this wakes all of them up no matter how many there are.
+     */
+    uint64_t one = 1;
+    int err = write(dev->wake_fd, &one, sizeof(one));
+    LOGE_IF(err<0, "control__kick, fd=%d (%s)", dev->wake_fd, strerror(errno));
+    return err < 0 ? -errno : 0;
+}
+
+static int control__wake(struct sensors_control_context_t *dev)
+{
+    // without it, the data side takes every kick for a wake
+    if (dev->shared)
+        android_atomic_inc(&dev->shared->wakes);
+    return control__kick(dev);
+}
+
+static int control__flush(struct sensors_control_context_t *dev, int handle)
+{
+    if ((handle < SENSORS_HANDLE_BASE) ||
+            (handle >= SENSORS_HANDLE_BASE+MAX_NUM_SENSORS))
+        return -EINVAL;
+    if (!dev->shared)
+        return -ENOSYS;
+    android_atomic_inc(&dev->shared->flushes[handle - SENSORS_HANDLE_BASE]);
+    return control__kick(dev);
+}
+
+static int control__batch(struct sensors_control_context_t *dev,
+                          int handle, int32_t ms)
+{
+    if ((handle < SENSORS_HANDLE_BASE) ||
+            (handle >= SENSORS_HANDLE_BASE+MAX_NUM_SENSORS) || ms < 0)
+        return -EINVAL;
+    if (!dev->shared)
+        return -ENOSYS;
+    int id = handle - SENSORS_HANDLE_BASE;
+    pthread_mutex_lock(&dev->lock);
+    int32_t old = dev->shared->latencies[id];
+    android_atomic_release_store(ms, &dev->shared->latencies[id]);
+    pthread_mutex_unlock(&dev->lock);
+    // what is held back already was due by the old latency
+    if (ms < old)
+        return control__flush(dev, handle);
+    return 0;
+}
+
+/*****************************************************************************/
+
+/* time in the same base as the sensor timestamps */
+static int64_t data__now(void)
+{
+    return clock_ns(CLOCK_MONOTONIC);
+}
+
+static int ring_init(struct sensors_ring_t *ring, uint32_t depth)
+{
+    uint32_t size = 1;
+    while (size < depth)
+        size <<= 1;
+    ring->items = malloc(size * sizeof(*ring->items));
+    if (!ring->items)
+        return -ENOMEM;
+    ring->depth = size;
+    ring->head = 0;
+    ring->tail = 0;
+    ring->high_water = 0;
+    ring->overruns = 0;
+    return 0;
+}
+
+/* reader thread side; the newest sample is dropped if the ring is full */
+static void ring_push(struct sensors_ring_t *ring, int id,
+                      const sensors_data_t *data)
+{
+    uint32_t head = ring->head;
+    uint32_t used = head - (uint32_t)android_atomic_acquire_load(&ring->tail);
+    if (used >= ring->depth) {
+        android_atomic_inc(&ring->overruns);
+        return;
+    }
+    struct ring_item_t *item = &ring->items[head & (ring->depth - 1)];
+    item->id = id;
+    item->data = *data;
+    android_atomic_release_store(head + 1, &ring->head);
+    if (used + 1 > ring->high_water)
+        ring->high_water = used + 1;
+}
+
+/* data__poll side, returns 0 if the ring is empty */
+static int ring_pop(struct sensors_ring_t *ring, struct ring_item_t *item)
+{
+    uint32_t tail = ring->tail;
+    if (tail == (uint32_t)android_atomic_acquire_load(&ring->head))
+        return 0;
+    *item = ring->items[tail & (ring->depth - 1)];
+    android_atomic_release_store(tail + 1, &ring->tail);
+    return 1;
+}
+
+static int sensor_queue_init(struct sensor_queue_t *q, uint32_t depth)
+{
+    uint32_t size = 1;
+    while (size < depth)
+        size <<= 1;
+    q->items = memalign(CACHE_LINE_SIZE, size * sizeof(*q->items));
+    if (!q->items)
+        return -ENOMEM;
+    q->depth = size;
+    q->head = 0;
+    q->count = 0;
+    q->drops = 0;
+    q->skips = 0;
+    return 0;
+}
+
+static void sensor_queue_release(struct sensor_queue_t *q)
+{
+    free(q->items);
+    q->items = NULL;
+    q->depth = 0;
+    q->count = 0;
+}
+
+static void sensor_queue_push(struct sensor_queue_t *q,
+                              const sensors_data_t *data)
+{
+    if (q->count == q->depth) {
+        q->drops++;
+        if (q->policy == SENSORS_QUEUE_DROP_NEWEST)
+            return;
+        q->head = (q->head + 1) & (q->depth - 1);
+        q->count--;
+    }
+    q->items[(q->head + q->count) & (q->depth - 1)] = *data;
+    q->count++;
+}
+
+static void sensor_queue_pop(struct sensor_queue_t *q, sensors_data_t *data)
+{
+    *data = q->items[q->head];
+    q->head = (q->head + 1) & (q->depth - 1);
+    q->count--;
+}
+
+/* report latency of sensor id set through control__batch, in ms */
+static int32_t data__latency(struct sensors_data_context_t *dev, int id)
+{
+    if (!dev->shared)
+        return 0;
+    return android_atomic_acquire_load(&dev->shared->latencies[id]);
+}
+
+/*
+ * queue a sample of sensor id for data__poll. Samples of a sensor with a
+ * report latency are held back in its queue until data__check_batches()
+ * finds one of the reasons to return them.
+ */
+static void data__queue(struct sensors_data_context_t *dev, int id,
+                        const sensors_data_t *data)
+{
+    struct sensor_queue_t *q = &dev->queues[id];
+    if (!q->items)
+        return;
+    // once pending, the queue is being returned anyway
+    int32_t latency = (dev->pendingSensors & (1<<id)) ?
+            0 : data__latency(dev, id);
+    if (latency <= 0) {
+        sensor_queue_push(q, data);
+        dev->pendingSensors |= 1<<id;
+        return;
+    }
+    if (!(dev->batchedSensors & (1<<id))) {
+        dev->batchedSensors |= 1<<id;
+        dev->batchDeadline[id] = data->time + latency * 1000000LL;
+    }
+    sensor_queue_push(q, data);
+    dev->batchedSamples++;
+    if (q->count == q->depth)
+        dev->batchFull = 1;
+}
+
+/*
+ * Return what is held back, all of it at once: when the oldest sample
+ * is due, when a queue is full, when another sample wakes poll up anyway
+ * or when control__flush asked for it.
+ */
+static void data__check_batches(struct sensors_data_context_t *dev)
+{
+    uint32_t mask = dev->batchedSensors;
+    int flush = dev->batchFull || dev->pendingSensors;
+    int64_t now = 0;
+    int i;
+    if (dev->shared) {
+        for (i = 0; i < MAX_NUM_SENSORS; i++) {
+            int32_t gen =
+                    android_atomic_acquire_load(&dev->shared->flushes[i]);
+            if (gen != dev->flushesSeen[i]) {
+                dev->flushesSeen[i] = gen;
+                flush = 1;
+            }
+        }
+    }
+    if (!mask)
+        return;
+    while (!flush && mask) {
+        uint32_t id = 31 - __builtin_clz(mask);
+        mask &= ~(1<<id);
+        if (!now)
+            now = data__now();
+        if (dev->batchDeadline[id] <= now)
+            flush = 1;
+    }
+    if (flush) {
+        dev->pendingSensors |= dev->batchedSensors;
+        dev->batchedSensors = 0;
+        dev->batchFull = 0;
+        dev->batchFlushes++;
+    }
+}
+
+/* how long poll can wait before samples held back are due, in ms */
+static int data__batch_timeout(struct sensors_data_context_t *dev)
+{
+    uint32_t mask = dev->batchedSensors;
+    int64_t due = 0;
+    if (!mask)
+        return -1;
+    while (mask) {
+        uint32_t i = 31 - __builtin_clz(mask);
+        mask &= ~(1<<i);
+        if (!due || dev->batchDeadline[i] < due)
+            due = dev->batchDeadline[i];
+    }
+    due -= data__now();
+    return due > 0 ? (int)((due + 999999) / 1000000) : 0;
+}
+
+/* whether control__wake kicked the wake fd, rather than control__flush */
+static int data__woken(struct sensors_data_context_t *dev)
+{
+    if (!dev->shared)
+        return 1;
+    int32_t gen = android_atomic_acquire_load(&dev->shared->wakes);
+    if (gen == dev->wakesSeen)
+        return 0;
+    dev->wakesSeen = gen;
+    return 1;
+}
+
+/*
+ * make the current values of the sensors in mask available to get_latest,
+ * when we are trusted with it
+ */
+static void data__update_latest(struct sensors_data_context_t *dev,
+                                uint32_t sensors)
+{
+    if (!dev->trusted)
+        return;
+    while (sensors) {
+        uint32_t i = 31 - __builtin_clz(sensors);
+        sensors &= ~(1<<i);
+        dev->sensors[i].sensor = id_to_sensor[i];
+        shared_write_latest(dev->shared, i, &dev->sensors[i]);
+    }
+}
+
+/*
+ * Take the channel over when its writer is gone. Only the data devices of
+ * the process of the control device write it, so that is when the one
+ * writing it was closed: it left the channel free, that costs a load to
+ * see. While it is taken, we only look again every
+ * CHANNEL_CLAIM_INTERVAL_MS. Returns whether we write it.
+ */
+static int data__claim_channel(struct sensors_data_context_t *dev)
+{
+    if (android_atomic_acquire_load(&dev->channel->writer)) {
+        int64_t now = data__now();
+        if (now < dev->channelClaimAt)
+            return 0;
+        dev->channelClaimAt = now + CHANNEL_CLAIM_INTERVAL_MS * 1000000LL;
+    }
+    dev->channelWriter = !sensors_channel_claim(dev->channel);
+    LOGI_IF(dev->channelWriter, "took over the sensors channel");
+    return dev->channelWriter;
+}
+
+/*
+ * make the current values of the sensors in mask available to data__poll
+ * and to the readers of the channel
+ */
+static void data__publish(struct sensors_data_context_t *dev, uint32_t sensors)
+{
+    sensors_data_t samples[MAX_NUM_SENSORS + STEP_MAX_EVENTS];
+    int writer = dev->channelWriter ||
+            (dev->channel && data__claim_channel(dev));
+    int count = 0;
+    while (sensors) {
+        uint32_t i = 31 - __builtin_clz(sensors);
+        // the step detector has an event for every step found
+        int events = 1;
+        sensors &= ~(1<<i);
+        dev->sensors[i].sensor = id_to_sensor[i];
+        if (i == ID_SD && dev->stepEvents) {
+            events = dev->stepEvents;
+            dev->stepEvents = 0;
+        }
+        while (events--) {
+            if (dev->use_reader)
+                ring_push(&dev->reader.ring, i, &dev->sensors[i]);
+            else
+                data__queue(dev, i, &dev->sensors[i]);
+            if (writer)
+                samples[count++] = dev->sensors[i];
+        }
+    }
+    if (count)
+        sensors_channel_write(dev->channel, samples, count);
+}
+
+static void *data__reader_thread(void *arg);
+
+static int data__reader_init(struct sensors_data_context_t *dev)
+{
+    struct sensors_reader_t *reader = &dev->reader;
+    char value[PROPERTY_VALUE_MAX];
+
+    property_get("ro.sensors.ring_depth", value, "");
+    int depth = atoi(value);
+    if (depth <= 0)
+        depth = READER_RING_DEPTH;
+    if (ring_init(&reader->ring, depth) < 0)
+        return -ENOMEM;
+
+    reader->dead = 0;
+    reader->epoll_fd = epoll_create(WAKE_FD_INDEX + 1);
+    reader->stop_fd = eventfd(0, 0);
+    reader->notify_fd = eventfd(0, 0);
+    if (reader->epoll_fd < 0 || reader->stop_fd < 0 || reader->notify_fd < 0) {
+        LOGE("Couldn't create reader thread fds (%s)", strerror(errno));
+        return -1;
+    }
+    // data__poll clears it after every wake up, it must never block
+    fcntl(reader->notify_fd, F_SETFL, O_NONBLOCK);
+
+    struct epoll_event ev = {
+        .events = EPOLLIN, .data = { .u32 = WAKE_FD_INDEX } };
+    return epoll_ctl(reader->epoll_fd, EPOLL_CTL_ADD, reader->stop_fd, &ev);
+}
+
+static void data__reader_release(struct sensors_data_context_t *dev)
+{
+    struct sensors_reader_t *reader = &dev->reader;
+    uint64_t one = 1;
+
+    if (reader->running) {
+        write(reader->stop_fd, &one, sizeof(one));
+        pthread_join(reader->thread, NULL);
+        reader->running = 0;
+        LOGI("reader ring: depth %u, high water %u, overruns %d",
+             reader->ring.depth, reader->ring.high_water,
+             reader->ring.overruns);
+    }
+    if (reader->epoll_fd >= 0)
+        close(reader->epoll_fd);
+    if (reader->stop_fd >= 0)
+        close(reader->stop_fd);
+    if (reader->notify_fd >= 0)
+        close(reader->notify_fd);
+    reader->epoll_fd = reader->stop_fd = reader->notify_fd = -1;
+    free(reader->ring.items);
+    reader->ring.items = NULL;
+}
+
+/* EVIOCGABS, or what the recorded device answered when replaying */
+static int data__get_absinfo(struct sensors_data_context_t *dev, int input,
+                             int code, struct input_absinfo *absinfo)
+{
+    if (dev->replay)
+        return sensors_replay_get_absinfo(dev->replay, input, code, absinfo);
+    return ioctl(dev->events_fd[input], EVIOCGABS(code), absinfo);
+}
+
+/*
+ * The ranges of the proximity and light axes don't change, read them once
+ * here so that decoding an event is only arithmetic and a table lookup.
+ * Without them we fall back to the ranges of the CM3602 driver: 0..1 for
+ * the proximity and 8 light levels.
+ */
+static void data__scale_open(struct sensors_data_context_t *dev)
+{
+    struct input_absinfo absinfo;
+    int i;
+
+    dev->proximityMin = 0;
+    dev->proximityScale = PROXIMITY_THRESHOLD_CM;
+    if (!data__get_absinfo(dev, BACKEND_CM, EVENT_TYPE_PROXIMITY,
+                           &absinfo) &&
+            absinfo.maximum > absinfo.minimum) {
+        dev->proximityMin = absinfo.minimum;
+        dev->proximityScale = PROXIMITY_THRESHOLD_CM /
+                (float)(absinfo.maximum - absinfo.minimum);
+    }
+
+    dev->lightMin = 0;
+    dev->lightLevels = ARRAY_SIZE(sLuxValues);
+    if (!data__get_absinfo(dev, BACKEND_LIGHT, EVENT_TYPE_LIGHT, &absinfo) &&
+            absinfo.maximum >= absinfo.minimum) {
+        dev->lightMin = absinfo.minimum;
+        dev->lightLevels = absinfo.maximum - absinfo.minimum + 1;
+        if (dev->lightLevels > LUX_TABLE_SIZE)
+            dev->lightLevels = LUX_TABLE_SIZE;
+    }
+    // levels above the ones we know about read as the brightest
+    for (i = 0; i < dev->lightLevels; i++)
+        dev->luxTable[i] = sLuxValues[i < (int)ARRAY_SIZE(sLuxValues) ?
+                                      i : (int)ARRAY_SIZE(sLuxValues) - 1];
+    LOGV("proximity: min %d scale %f, light: min %d, %d levels",
+         dev->proximityMin, dev->proximityScale,
+         dev->lightMin, dev->lightLevels);
+}
+
+/*
+ * Replay a recording instead of reading the input devices, or record what
+ * they send, see sensors_record.h. Every process opening a data device
+ * records to its own file, "<debug.sensors.record>.<pid>".
+ */
+static void data__streams_open(struct sensors_data_context_t *dev)
+{
+    char value[PROPERTY_VALUE_MAX];
+    int i;
+
+    if (property_get("debug.sensors.replay", value, "")) {
+        char fast[PROPERTY_VALUE_MAX];
+        int fds[NUM_BACKENDS];
+        property_get("debug.sensors.replay_fast", fast, "0");
+        dev->replay = sensors_replay_open(value, strcmp(fast, "1"),
+                                          fds, NUM_BACKENDS);
+        if (dev->replay) {
+            for (i = 0; i < NUM_BACKENDS; i++) {
+                close(dev->events_fd[i]);
+                dev->events_fd[i] = fds[i];
+            }
+        }
+    } else if (property_get("debug.sensors.record", value, "")) {
+        const char *names[NUM_BACKENDS];
+        char path[PATH_MAX];
+        snprintf(path, sizeof(path), "%s.%d", value, getpid());
+        for (i = 0; i < NUM_BACKENDS; i++)
+            names[i] = sBackends[i].input_name;
+        dev->recorder = sensors_record_open(path, dev->events_fd,
+                                            names, NUM_BACKENDS);
+    }
+}
+
+/*
+ * Map the shared state and the channel of the data source 'handle'. In the
+ * process of the control device, they are copies of its mappings and we
+ * can write them. Anywhere else, the shared state is mapped read-only and
+ * the channel not at all: only get_channel_fd() readers read it.
+ */
+static void data__map_shared(struct sensors_data_context_t *dev,
+                             const native_handle_t *handle)
+{
+    pthread_mutex_lock(&sOwnerLock);
+    if (sOwner && sOwnerPid == getpid()) {
+        dev->shared = map_again(sOwner->shared, sizeof(*dev->shared));
+        if (dev->shared && sOwner->channel &&
+                handle->numFds > CHANNEL_FD_INDEX)
+            dev->channel = map_again(sOwner->channel, sizeof(*dev->channel));
+    }
+    pthread_mutex_unlock(&sOwnerLock);
+
+    dev->trusted = dev->shared != NULL;
+    if (!dev->trusted)
+        dev->shared = shared_map(handle->data[SHARED_FD_INDEX], PROT_READ);
+}
+
+static void data__snapshot_open(struct sensors_data_context_t *dev);
+
+static int data__data_open(struct sensors_data_context_t *dev, native_handle_t* handle)
+{
+    int i;
+    memset(&dev->sensors, 0, sizeof(dev->sensors));
+    memset(&dev->frameClocks, 0, sizeof(dev->frameClocks));
+    memset(&dev->frames, 0, sizeof(dev->frames));
+    memset(&dev->stats, 0, sizeof(dev->stats));
+    memset(&dev->lastReported, 0, sizeof(dev->lastReported));
+    dev->heldSensors = 0;
+
+    for (i = 0; i < MAX_NUM_SENSORS; i++) {
+        // by default all sensors have high accuracy
+        // (we do this because we don't get an update if the value doesn't
+        // change).
+        dev->sensors[i].vector.status = SENSOR_STATUS_ACCURACY_HIGH;
+    }
+
+    dev->sensors[ID_A].sensor = SENSOR_TYPE_ACCELEROMETER;
+    dev->sensors[ID_M].sensor = SENSOR_TYPE_MAGNETIC_FIELD;
+    dev->sensors[ID_O].sensor = SENSOR_TYPE_ORIENTATION;
+    dev->sensors[ID_T].sensor = SENSOR_TYPE_TEMPERATURE;
+    dev->sensors[ID_P].sensor = SENSOR_TYPE_PROXIMITY;
+    dev->sensors[ID_L].sensor = SENSOR_TYPE_LIGHT;
+    dev->sensors[ID_RV].sensor = SENSOR_TYPE_ROTATION_VECTOR;
+    dev->sensors[ID_G].sensor = SENSOR_TYPE_GRAVITY;
+    dev->sensors[ID_LA].sensor = SENSOR_TYPE_LINEAR_ACCELERATION;
+    dev->sensors[ID_SD].sensor = SENSOR_TYPE_STEP_DETECTOR;
+    dev->sensors[ID_SC].sensor = SENSOR_TYPE_STEP_COUNTER;
+    dev->sensors[ID_SM].sensor = SENSOR_TYPE_SIGNIFICANT_MOTION;
+
+    dev->fusionSensors = fusion_sensors();
+    dev->fusionInputs = 0;
+    sensors_fusion_init(&dev->fusion);
+    memset(&dev->fusionError, 0, sizeof(dev->fusionError));
+    dev->fusionUpdates = 0;
+    dev->fusionCpuNs = 0;
+    sensors_gravity_init(&dev->gravity);
+    sensors_step_init(&dev->step);
+    dev->stepCount = 0;
+    dev->stepFromFirmware = 0;
+    dev->stepEvents = 0;
+    dev->motionArmed = 0;
+    dev->motionFired = 0;
+    memset(dev->akmRaw, 0, sizeof(dev->akmRaw));
+    for (i = 0; i < NUM_AKM_SENSORS; i++)
+        dev->akmVectors[i] = &dev->sensors[i].vector;
+    if (dev->fusionSensors & SENSORS_AKM_ORIENTATION)
+        dev->akmVectors[ID_O] = &dev->akmReference;
+
+    char value[PROPERTY_VALUE_MAX];
+    property_get("ro.sensors.queue_depth", value, "");
+    int depth = atoi(value);
+    if (depth <= 0)
+        depth = SENSOR_QUEUE_DEPTH;
+    for (i = 0; i < MAX_NUM_SENSORS; i++) {
+        if (sensor_queue_init(&dev->queues[i], depth) < 0) {
+            LOGE("Couldn't allocate the sensor queues");
+            while (i--)
+                sensor_queue_release(&dev->queues[i]);
+            return -ENOMEM;
+        }
+    }
+    dev->maxSkips = dev->queues[0].depth * (MAX_NUM_SENSORS - 1);
+
+    for (i = 0; i < NUM_BACKENDS; i++) {
+        dev->events_fd[i] = dup(handle->data[i]);
+        LOGV("data__data_open: %s fd = %d", sBackends[i].input_name,
+             handle->data[i]);
+    }
+    dev->wake_fd = handle->numFds > WAKE_FD_INDEX ?
+            dup(handle->data[WAKE_FD_INDEX]) : -1;
+    LOGV("data__data_open: wake fd = %d", dev->wake_fd);
+    if (handle->numFds > SHARED_FD_INDEX)
+        data__map_shared(dev, handle);
+    // the other data devices decode the same samples, one writer is enough
+    dev->channelWriter = dev->channel && !sensors_channel_claim(dev->channel);
+    // Framework will close the handle
+    native_handle_delete(handle);
+
+    if (debug_streams_allowed())
+        data__streams_open(dev);
+
+    dev->epoll_fd = epoll_create(WAKE_FD_INDEX + 1);
+    if (dev->epoll_fd < 0) {
+        LOGE("Couldn't create epoll set (%s)", strerror(errno));
+        return -errno;
+    }
+
+    property_get("ro.sensors.reader_thread", value, "0");
+    dev->use_reader = !strcmp(value, "1");
+    if (dev->use_reader && data__reader_init(dev) < 0) {
+        LOGE("Couldn't set up the reader thread, reading from data__poll");
+        data__reader_release(dev);
+        dev->use_reader = 0;
+    }
+
+    // with a reader thread, data__poll only waits for it (and for wake)
+    int inputs_epoll_fd = dev->use_reader ? dev->reader.epoll_fd : dev->epoll_fd;
+    for (i = 0; i < NUM_BACKENDS; i++) {
+        struct epoll_event ev = { .events = EPOLLIN, .data = { .u32 = i } };
+        // data__poll drains each device until it is empty
+        fcntl(dev->events_fd[i], F_SETFL,
+              fcntl(dev->events_fd[i], F_GETFL) | O_NONBLOCK);
+        if (epoll_ctl(inputs_epoll_fd, EPOLL_CTL_ADD, dev->events_fd[i], &ev) < 0)
+            LOGE("Couldn't watch input fd=%d (%s)",
+                 dev->events_fd[i], strerror(errno));
+    }
+    if (dev->use_reader) {
+        struct epoll_event ev = { .events = EPOLLIN, .data = { .u32 = 0 } };
+        epoll_ctl(dev->epoll_fd, EPOLL_CTL_ADD, dev->reader.notify_fd, &ev);
+    }
+    if (dev->wake_fd >= 0) {
+        // see control__wake(), nobody ever reads the counter
+        struct epoll_event ev = {
+            .events = EPOLLIN | EPOLLET, .data = { .u32 = WAKE_FD_INDEX } };
+        if (epoll_ctl(dev->epoll_fd, EPOLL_CTL_ADD, dev->wake_fd, &ev) < 0)
+            LOGE("Couldn't watch wake fd=%d (%s)",
+                 dev->wake_fd, strerror(errno));
+    }
+    if (dev->use_reader && dev->wake_fd >= 0) {
+        // a kick only makes the reader thread look at data__snapshot
+        struct epoll_event ev = {
+            .events = EPOLLIN | EPOLLET, .data = { .u32 = SHARED_FD_INDEX } };
+        epoll_ctl(dev->reader.epoll_fd, EPOLL_CTL_ADD, dev->wake_fd, &ev);
+    }
+
+    dev->pendingSensors = 0;
+    dev->batchedSensors = 0;
+    dev->batchFull = 0;
+    dev->batchFlushes = 0;
+    dev->batchedSamples = 0;
+    if (dev->shared) {
+        // flushes and wakes asked for before we were open aren't for us
+        for (i = 0; i < MAX_NUM_SENSORS; i++)
+            dev->flushesSeen[i] = dev->shared->flushes[i];
+        dev->wakesSeen = dev->shared->wakes;
+        for (i = 0; i < MAX_NUM_SENSORS; i++)
+            dev->enablesSeen[i] = dev->shared->enables[i];
+        // the step count goes on from where the last data device left it
+        sensors_data_t latest;
+        if (!shared_read_latest(dev->shared, ID_SC, &latest))
+            dev->stepCount = (uint32_t)latest.vector.v[0];
+    }
+    dev->openTime = data__now();
+    dev->firstSamples = 0;
+    data__scale_open(dev);
+    data__snapshot_open(dev);
+
+    if (dev->use_reader) {
+        if (pthread_create(&dev->reader.thread, NULL,
+                           data__reader_thread, dev)) {
+            LOGE("Couldn't start the reader thread");
+            return -1;
+        }
+        dev->reader.running = 1;
+    }
+
+    return 0;
+}
+
+static int data__data_close(struct sensors_data_context_t *dev)
+{
+    int i;
+    if (dev->use_reader)
+        data__reader_release(dev);
+    for (i = 0; i < MAX_NUM_SENSORS; i++)
+        sensor_queue_release(&dev->queues[i]);
+    for (i = 0; i < NUM_BACKENDS; i++) {
+        if (dev->events_fd[i] >= 0) {
+            close(dev->events_fd[i]);
+            dev->events_fd[i] = -1;
+        }
+    }
+    if (dev->wake_fd >= 0) {
+        close(dev->wake_fd);
+        dev->wake_fd = -1;
+    }
+    if (dev->epoll_fd >= 0) {
+        close(dev->epoll_fd);
+        dev->epoll_fd = -1;
+    }
+    if (dev->replay) {
+        sensors_replay_close(dev->replay);
+        dev->replay = NULL;
+    }
+    if (dev->recorder) {
+        sensors_record_close(dev->recorder);
+        dev->recorder = NULL;
+    }
+    shared_unmap(dev->shared);
+    dev->shared = NULL;
+    dev->trusted = 0;
+    if (dev->channelWriter)
+        sensors_channel_release(dev->channel);
+    dev->channelWriter = 0;
+    sensors_channel_unmap(dev->channel);
+    dev->channel = NULL;
+    for (i = 0; i < NUM_BACKENDS; i++) {
+        struct input_frame_t *frame = &dev->frames[i];
+        LOGI_IF(frame->frames, "%s: %u frames, %u split across reads, "
+                "%u with nothing to report", sBackends[i].input_name,
+                frame->frames, frame->split, frame->silent);
+    }
+    LOGI_IF(dev->batchFlushes, "batching: %u samples held back, returned "
+            "in %u bursts", dev->batchedSamples, dev->batchFlushes);
+    if (dev->fusionCpuNs) {
+        LOGI("fusion: %u updates, %lld ns of cpu each", dev->fusionUpdates,
+             (long long)(dev->fusionCpuNs / dev->fusionUpdates));
+    }
+    if (dev->fusionError.count) {
+        struct sensors_fusion_error_t *e = &dev->fusionError;
+        LOGI("fusion vs akmd over %u frames: azimuth/pitch/roll error "
+             "mean %.1f/%.1f/%.1f max %.1f/%.1f/%.1f degrees", e->count,
+             e->sum[0] / e->count, e->sum[1] / e->count, e->sum[2] / e->count,
+             e->max[0], e->max[1], e->max[2]);
+    }
+    return 0;
+}
+
+/*
+ * Return the oldest queued sample across all the sensors, so samples come
+ * out in the order they were taken whatever device they were read from.
+ * Ties are broken round-robin, starting after the last sensor returned.
+ *
+ * With sane timestamps a sample can only be passed over by older samples
+ * already queued for the other sensors, so at most dev->maxSkips times.
+ * A sensor passed over more than that is returned next regardless of its
+ * timestamp: a stream with bogus timestamps can't starve the others.
+ */
+static int pick_sensor(struct sensors_data_context_t *dev,
+        sensors_data_t* values)
+{
+    uint32_t mask = dev->pendingSensors;
+    int64_t oldest = 0;
+    int picked = -1;
+    int n;
+
+    for (n = 1; n <= MAX_NUM_SENSORS; n++) {
+        int i = (dev->lastPicked + n) % MAX_NUM_SENSORS;
+        if (!(mask & (1<<i)))
+            continue;
+        struct sensor_queue_t *q = &dev->queues[i];
+        if (q->skips >= dev->maxSkips) {
+            picked = i;
+            break;
+        }
+        int64_t t = q->items[q->head].time;
+        if (picked < 0 || t < oldest) {
+            picked = i;
+            oldest = t;
+        }
+    }
+
+    if (picked < 0) {
+        // none of these has a queue, don't look at them again
+        LOGE("no sensor to return: pendingSensors = %08x", mask);
+        dev->pendingSensors &= ~mask;
+        return -1;
+    }
+
+    mask &= ~(1<<picked);
+    while (mask) {
+        uint32_t i = 31 - __builtin_clz(mask);
+        mask &= ~(1<<i);
+        dev->queues[i].skips++;
+    }
+
+    struct sensor_queue_t *q = &dev->queues[picked];
+    q->skips = 0;
+    sensor_queue_pop(q, values);
+    if (!q->count)
+        dev->pendingSensors &= ~(1<<picked);
+    dev->lastPicked = picked;
+    values->sensor = id_to_sensor[picked];
+    LOGV_IF(0, "%d [%f, %f, %f]",
+            values->sensor,
+            values->vector.x,
+            values->vector.y,
+            values->vector.z);
+    return picked;
+}
+
+/*
+ * What each ABS code of the compass device means: the sensor it belongs
+ * to and which value of that sensor it is. Built at compile time from the
+ * EVENT_TYPE_* mapping of this board, so decoding an event is just an
+ * indexed load and a store of the raw value. The values are converted
+ * once per frame by data__akm_convert().
+ */
+struct akm_axis_t {
+    uint8_t id;
+    uint8_t index;
+};
+
+#define AKM_AXIS(_id, _index)   { .id = (_id), .index = (_index) }
+
+// ids start at 0, this one means "nothing to decode"
+#define AKM_AXIS_NONE   0xff
+
+static const struct akm_axis_t sAkmAxes[ABS_MAX + 1] = {
+    [0 ... ABS_MAX]             = AKM_AXIS(AKM_AXIS_NONE, 0),
+    [EVENT_TYPE_ACCEL_X]        = AKM_AXIS(ID_A, 0),
+    [EVENT_TYPE_ACCEL_Y]        = AKM_AXIS(ID_A, 1),
+    [EVENT_TYPE_ACCEL_Z]        = AKM_AXIS(ID_A, 2),
+    [EVENT_TYPE_MAGV_X]         = AKM_AXIS(ID_M, 0),
+    [EVENT_TYPE_MAGV_Y]         = AKM_AXIS(ID_M, 1),
+    [EVENT_TYPE_MAGV_Z]         = AKM_AXIS(ID_M, 2),
+    [EVENT_TYPE_YAW]            = AKM_AXIS(ID_O, 0),
+    [EVENT_TYPE_PITCH]          = AKM_AXIS(ID_O, 1),
+    [EVENT_TYPE_ROLL]           = AKM_AXIS(ID_O, 2),
+    [EVENT_TYPE_TEMPERATURE]    = AKM_AXIS(ID_T, 0),
+};
+
+/* factors converting the raw values of each compass sensor, padded to 4 */
+static const float sAkmScales[NUM_AKM_SENSORS][4] __attribute__((aligned(16))) = {
+    [ID_A] = { CONVERT_A_X, CONVERT_A_Y, CONVERT_A_Z, 0.0f },
+    [ID_M] = { CONVERT_M_X, CONVERT_M_Y, CONVERT_M_Z, 0.0f },
+    [ID_O] = { 1.0f, 1.0f, -1.0f, 0.0f },
+    [ID_T] = { 1.0f, 0.0f, 0.0f, 0.0f },
+};
+
+/* convert the raw values of the compass sensors in mask */
+static void data__akm_convert(struct sensors_data_context_t *dev,
+                              uint32_t mask)
+{
+    while (mask) {
+        uint32_t i = 31 - __builtin_clz(mask);
+        mask &= ~(1<<i);
+        // the temperature shares its storage with v[0]
+        float *v = dev->akmVectors[i]->v;
+        v[0] = dev->akmRaw[i][0] * sAkmScales[i][0];
+        v[1] = dev->akmRaw[i][1] * sAkmScales[i][1];
+        v[2] = dev->akmRaw[i][2] * sAkmScales[i][2];
+    }
+}
+
+static uint32_t data__poll_process_akm_abs(struct sensors_data_context_t *dev,
+                                           int fd __attribute__((unused)),
+                                           struct input_event *event)
+{
+    if (event->type != EV_ABS || event->code > ABS_MAX)
+        return 0;
+
+    LOGV("compass type: %d code: %d value: %-5d time: %ds",
+         event->type, event->code, event->value,
+         (int)event->time.tv_sec);
+
+    const struct akm_axis_t *axis = &sAkmAxes[event->code];
+    if (axis->id != AKM_AXIS_NONE) {
+        dev->akmRaw[axis->id][axis->index] = event->value;
+        return 1 << axis->id;
+    }
+
+    switch (event->code) {
+    case EVENT_TYPE_STEP_COUNT:
+        // step count (only reported in MODE_FFD), see data__steps()
+        dev->stepFirmware = event->value;
+        return SENSORS_STEP_COUNTER;
+    case EVENT_TYPE_ACCEL_STATUS:
+        // accuracy of the calibration (never returned!)
+        //LOGV("G-Sensor status %d", event->value);
+        break;
+    case EVENT_TYPE_ORIENT_STATUS: {
+        // accuracy of the calibration
+        uint32_t v = (uint32_t)(event->value & SENSOR_STATE_MASK);
+        LOGV_IF(dev->sensors[ID_O].orientation.status != (uint8_t)v,
+                "M-Sensor status %d", v);
+        dev->sensors[ID_O].orientation.status = (uint8_t)v;
+    }
+        break;
+    }
+    return 0;
+}
+
+/* scale a proximity value, see data__scale_open() */
+static uint32_t data__decode_proximity(struct sensors_data_context_t *dev,
+                                       int value)
+{
+    /* the sensor is binary, scale its range to the threshold */
+    dev->sensors[ID_P].distance =
+            (value - dev->proximityMin) * dev->proximityScale;
+    return SENSORS_CM_PROXIMITY;
+}
+
+/* translate a light level to lux, see data__scale_open() */
+static uint32_t data__decode_light(struct sensors_data_context_t *dev,
+                                   int value)
+{
+    int index = value - dev->lightMin;
+    if (index < 0)
+        return 0;
+    if (index >= dev->lightLevels)
+        index = dev->lightLevels - 1;
+    dev->sensors[ID_L].light = dev->luxTable[index];
+    return SENSORS_LIGHT;
+}
+
+static uint32_t data__poll_process_cm_abs(struct sensors_data_context_t *dev,
+                                           int fd __attribute__((unused)),
+                                          struct input_event *event)
+{
+    uint32_t new_sensors = 0;
+    if (event->type == EV_ABS) {
+        LOGV("proximity type: %d code: %d value: %-5d time: %ds",
+             event->type, event->code, event->value,
+             (int)event->time.tv_sec);
+        if (event->code == EVENT_TYPE_PROXIMITY)
+            new_sensors |= data__decode_proximity(dev, event->value);
+    }
+    return new_sensors;
+}
+
+static uint32_t data__poll_process_ls_abs(struct sensors_data_context_t *dev,
+                                          int fd __attribute__((unused)),
+                                          struct input_event *event)
+{
+    uint32_t new_sensors = 0;
+    if (event->type == EV_ABS) {
+        LOGV("light-level type: %d code: %d value: %-5d time: %ds",
+             event->type, event->code, event->value,
+             (int)event->time.tv_sec);
+        if (event->code == EVENT_TYPE_LIGHT)
+            new_sensors |= data__decode_light(dev, event->value);
+    }
+    return new_sensors;
+}
 
-    return 0;
+// weight of a new interval in the running estimates, as a shift
+#define RATE_SHIFT          3
+
+static void rate_update(struct rate_estimator_t *r, int64_t t)
+{
+    int64_t interval = t - r->last;
+    if (r->count++ && interval > 0) {
+        if (!r->period || interval < r->period / 2 ||
+                interval > r->period * 2) {
+            r->period = interval;
+            r->jitter = 0;
+        } else {
+            int64_t error = interval - r->period;
+            r->period += error >> RATE_SHIFT;
+            r->jitter += ((error < 0 ? -error : error) - r->jitter)
+                    >> RATE_SHIFT;
+        }
+    }
+    r->last = t;
 }
 
-static int control__set_delay(struct sensors_control_context_t *dev, int32_t ms)
+/* publish the sensors in mask, reported at 'now' */
+static void data__report(struct sensors_data_context_t *dev, uint32_t sensors,
+                         int64_t now)
 {
-#ifdef ECS_IOCTL_APP_SET_DELAY
-    if (dev->akmd_fd <= 0) {
-        return -1;
+    uint32_t mask = sensors;
+    while (mask) {
+        uint32_t i = 31 - __builtin_clz(mask);
+        mask &= ~(1<<i);
+        dev->lastReported[i] = now;
+        rate_update(&dev->stats[i].rate, dev->sensors[i].time);
     }
-    short delay = ms;
-    if (!ioctl(dev->akmd_fd, ECS_IOCTL_APP_SET_DELAY, &delay)) {
-        return -errno;
+    data__publish(dev, sensors);
+}
+
+/*
+ * Leave out the sensors in mask whose last report is more recent than
+ * the delay they were set to, give or take an eighth for jitter. The
+ * value of an on-change sensor can't just be dropped: it is held back
+ * and reported when its delay is over, see data__release_held().
+ */
+static uint32_t data__decimate(struct sensors_data_context_t *dev,
+                               uint32_t sensors, int64_t t)
+{
+    uint32_t mask = sensors & ~SENSORS_EVENTS;
+    if (!dev->shared)
+        return sensors;
+    while (mask) {
+        uint32_t i = 31 - __builtin_clz(mask);
+        mask &= ~(1<<i);
+        int64_t delay = android_atomic_acquire_load(&dev->shared->delays[i]) *
+                1000000LL;
+        if (t - dev->lastReported[i] >= delay - delay / 8) {
+            dev->heldSensors &= ~(1<<i);
+            continue;
+        }
+        sensors &= ~(1<<i);
+        if ((SENSORS_ON_CHANGE & (1<<i)) && !(dev->heldSensors & (1<<i))) {
+            dev->heldSensors |= 1<<i;
+            dev->heldUntil[i] = dev->lastReported[i] + delay;
+        }
     }
-    return 0;
-#else
-    return -1;
-#endif
+    return sensors;
 }
 
-static int control__wake(struct sensors_control_context_t *dev)
+/* report the held sensors whose delay is over, returns them */
+static uint32_t data__release_held(struct sensors_data_context_t *dev)
 {
-    int err = 0;
-    int akm_fd, p_fd, l_fd;
-    if (open_inputs(O_RDWR, &akm_fd, &p_fd, &l_fd) < 0 ||
-            akm_fd < 0 || p_fd < 0 || l_fd < 0) {
-        return -1;
+    int64_t now = data__now();
+    uint32_t mask = dev->heldSensors;
+    uint32_t released = 0;
+    while (mask) {
+        uint32_t i = 31 - __builtin_clz(mask);
+        mask &= ~(1<<i);
+        if (dev->heldUntil[i] <= now)
+            released |= 1<<i;
     }
+    dev->heldSensors &= ~released;
+    if (released)
+        data__report(dev, released, now);
+    return released;
+}
 
-    struct input_event event[1];
-    event[0].type = EV_SYN;
-    event[0].code = SYN_CONFIG;
-    event[0].value = 0;
+/* how long epoll_wait can wait before a held sensor is due, in ms */
+static int data__held_timeout(struct sensors_data_context_t *dev)
+{
+    uint32_t mask = dev->heldSensors;
+    int64_t due = 0;
+    if (!mask)
+        return -1;
+    while (mask) {
+        uint32_t i = 31 - __builtin_clz(mask);
+        mask &= ~(1<<i);
+        if (!due || dev->heldUntil[i] < due)
+            due = dev->heldUntil[i];
+    }
+    due -= data__now();
+    return due > 0 ? (int)((due + 999999) / 1000000) : 0;
+}
 
-    err = write(akm_fd, event, sizeof(event));
-    LOGV_IF(err<0, "control__wake(compass), fd=%d (%s)",
-            akm_fd, strerror(errno));
-    close(akm_fd);
+/* sensors enabled through control__activate */
+static uint32_t data__active(struct sensors_data_context_t *dev)
+{
+    if (!dev->shared)
+        return SUPPORTED_SENSORS;
+    return android_atomic_acquire_load(&dev->shared->active);
+}
 
-    err = write(p_fd, event, sizeof(event));
-    LOGV_IF(err<0, "control__wake(proximity), fd=%d (%s)",
-            p_fd, strerror(errno));
-    close(p_fd);
+/*
+ * Compute the enabled fusion sensors from a frame that updated the
+ * acceleration or the magnetic field. Returns new_sensors with the ones
+ * that were computed added.
+ */
+static uint32_t data__fuse(struct sensors_data_context_t *dev,
+                           uint32_t new_sensors, int64_t t)
+{
+    uint32_t wanted = data__active(dev) & dev->fusionSensors;
+    int reference = 0;
+    int64_t cpu = 0;
+
+    if (dev->fusionSensors & SENSORS_AKM_ORIENTATION) {
+        // akmd's orientation, if any, is only compared against ours
+        reference = new_sensors & SENSORS_AKM_ORIENTATION;
+        new_sensors &= ~SENSORS_AKM_ORIENTATION;
+    }
 
-    err = write(l_fd, event, sizeof(event));
-    LOGV_IF(err<0, "control__wake(light), fd=%d (%s)",
-            l_fd, strerror(errno));
-    close(l_fd);
+    dev->fusionInputs |= new_sensors & SENSORS_FUSION_INPUTS;
+    if (!wanted || !(new_sensors & SENSORS_FUSION_INPUTS) ||
+            dev->fusionInputs != SENSORS_FUSION_INPUTS)
+        return new_sensors;
+
+    if (dev->replay)
+        cpu = clock_ns(CLOCK_THREAD_CPUTIME_ID);
+    if (sensors_fusion_update(&dev->fusion,
+                              dev->sensors[ID_A].acceleration.v,
+                              dev->sensors[ID_M].magnetic.v, t) < 0)
+        return new_sensors;
+
+    if (wanted & SENSORS_AKM_ORIENTATION) {
+        sensors_vec_t *o = &dev->sensors[ID_O].orientation;
+        sensors_fusion_get_orientation(&dev->fusion, o->v);
+        if (reference)
+            sensors_fusion_compare(&dev->fusionError, o->v,
+                                   dev->akmReference.v);
+    }
+    if (wanted & SENSORS_ROTATION_VECTOR) {
+        sensors_vec_t *rv = &dev->sensors[ID_RV].vector;
+        sensors_fusion_get_rotation_vector(&dev->fusion, rv->v);
+        rv->status = dev->sensors[ID_O].orientation.status;
+    }
+    if (dev->replay)
+        dev->fusionCpuNs += clock_ns(CLOCK_THREAD_CPUTIME_ID) - cpu;
+    dev->fusionUpdates++;
 
-    return err;
+    return new_sensors | wanted;
 }
 
-/*****************************************************************************/
-
-static int data__data_open(struct sensors_data_context_t *dev, native_handle_t* handle)
+/*
+ * Compute the enabled gravity and linear acceleration from a frame that
+ * updated the acceleration. Returns new_sensors with the ones that were
+ * computed added.
+ */
+static uint32_t data__gravity(struct sensors_data_context_t *dev,
+                              uint32_t new_sensors, int64_t t)
 {
+    uint32_t wanted = data__active(dev) & SENSORS_GRAVITY_GROUP;
+    const float *a = dev->sensors[ID_A].acceleration.v;
+    const float *g = dev->gravity.g;
     int i;
-    struct input_absinfo absinfo;
-    memset(&dev->sensors, 0, sizeof(dev->sensors));
-
-    for (i = 0; i < MAX_NUM_SENSORS; i++) {
-        // by default all sensors have high accuracy
-        // (we do this because we don't get an update if the value doesn't
-        // change).
-        dev->sensors[i].vector.status = SENSOR_STATUS_ACCURACY_HIGH;
-    }
-
-    dev->sensors[ID_A].sensor = SENSOR_TYPE_ACCELEROMETER;
-    dev->sensors[ID_M].sensor = SENSOR_TYPE_MAGNETIC_FIELD;
-    dev->sensors[ID_O].sensor = SENSOR_TYPE_ORIENTATION;
-    dev->sensors[ID_T].sensor = SENSOR_TYPE_TEMPERATURE;
-    dev->sensors[ID_P].sensor = SENSOR_TYPE_PROXIMITY;
-    dev->sensors[ID_L].sensor = SENSOR_TYPE_LIGHT;
 
-    dev->events_fd[0] = dup(handle->data[0]);
-    dev->events_fd[1] = dup(handle->data[1]);
-    dev->events_fd[2] = dup(handle->data[2]);
-    LOGV("data__data_open: compass fd = %d", handle->data[0]);
-    LOGV("data__data_open: proximity fd = %d", handle->data[1]);
-    LOGV("data__data_open: light fd = %d", handle->data[2]);
-    // Framework will close the handle
-    native_handle_delete(handle);
+    if (!wanted)
+        return new_sensors;
 
-    dev->pendingSensors = 0;
-    if (!ioctl(dev->events_fd[1], EVIOCGABS(ABS_DISTANCE), &absinfo)) {
-        LOGV("proximity sensor initial value %d\n", absinfo.value);
-        dev->pendingSensors |= SENSORS_CM_PROXIMITY;
-        // FIXME: we should save here absinfo.{minimum, maximum, etc}
-        //        and use them to scale the return value according to
-        //        the sensor description.
-        dev->sensors[ID_P].distance = (float)absinfo.value;
+    sensors_gravity_update(&dev->gravity, a, t);
+    for (i = 0; i < 3; i++) {
+        dev->sensors[ID_G].acceleration.v[i] = g[i];
+        dev->sensors[ID_LA].acceleration.v[i] = a[i] - g[i];
     }
-    else LOGE("Cannot get proximity sensor initial value: %s\n",
-              strerror(errno));
+    return new_sensors | wanted;
+}
 
-    return 0;
+/*
+ * Count the steps in a frame, from the firmware's count when the frame
+ * has one (SENSORS_STEP_COUNTER, from data__poll_process_akm_abs) or
+ * from the acceleration otherwise. Once the firmware sent a count, it is
+ * the only one trusted, by every data device. Returns new_sensors with
+ * the step sensors added when there were steps. The steps found at once,
+ * when a run starts or the firmware count moved by more than one, each
+ * get a detector event, all stamped with the frame.
+ */
+static uint32_t data__steps(struct sensors_data_context_t *dev,
+                            uint32_t new_sensors, int64_t t)
+{
+    uint32_t wanted = data__active(dev) & SENSORS_STEP_GROUP;
+    int firmware = new_sensors & SENSORS_STEP_COUNTER;
+    int steps = 0;
+
+    new_sensors &= ~SENSORS_STEP_GROUP;
+    if (firmware) {
+        // a count going down is the firmware starting over
+        if (dev->stepFromFirmware)
+            steps = dev->stepFirmware >= dev->stepFirmwareLast ?
+                    dev->stepFirmware - dev->stepFirmwareLast :
+                    dev->stepFirmware;
+        if (!dev->stepFromFirmware && dev->trusted)
+            shared_firmware_steps(dev->shared);
+        dev->stepFromFirmware = 1;
+        dev->stepFirmwareLast = dev->stepFirmware;
+    } else if (wanted && !dev->stepFromFirmware &&
+               !(dev->shared &&
+                 android_atomic_acquire_load(&dev->shared->firmware_steps))) {
+        steps = sensors_step_update(&dev->step,
+                                    dev->sensors[ID_A].acceleration.v, t);
+    }
+    if (!wanted || !steps)
+        return new_sensors;
+
+    if (wanted & SENSORS_STEP_COUNTER)
+        dev->stepCount += steps;
+    dev->sensors[ID_SC].vector.v[0] = (float)dev->stepCount;
+    dev->sensors[ID_SD].vector.v[0] = 1.0f;
+    if (wanted & SENSORS_STEP_DETECTOR)
+        dev->stepEvents = steps < STEP_MAX_EVENTS ? steps : STEP_MAX_EVENTS;
+    return new_sensors | wanted;
 }
 
-static int data__data_close(struct sensors_data_context_t *dev)
+/*
+ * Watch a frame that updated the acceleration for significant motion, at
+ * SIGNIFICANT_MOTION_DELAY_MS whatever rate the acceleration comes in at.
+ * Returns new_sensors with the significant motion added when it fired.
+ */
+static uint32_t data__significant_motion(struct sensors_data_context_t *dev,
+                                         uint32_t new_sensors, int64_t t)
 {
-    if (dev->events_fd[0] >= 0) {
-        //LOGV("(data close) about to close compass fd=%d", dev->events_fd[0]);
-        close(dev->events_fd[0]);
-        dev->events_fd[0] = -1;
+    uint32_t wanted = data__active(dev) & SENSORS_SIGNIFICANT_MOTION;
+    int64_t delay = SIGNIFICANT_MOTION_DELAY_MS * 1000000LL;
+
+    if (dev->shared)
+        wanted &= ~android_atomic_acquire_load(&dev->shared->fired);
+    if (!wanted) {
+        dev->motionArmed = 0;
+        dev->motionFired = 0;
+        return new_sensors;
     }
-    if (dev->events_fd[1] >= 0) {
-        //LOGV("(data close) about to close proximity fd=%d", dev->events_fd[1]);
-        close(dev->events_fd[1]);
-        dev->events_fd[1] = -1;
+    if (dev->motionFired) {
+        if (android_atomic_acquire_load(&dev->shared->enables[ID_SM]) ==
+                dev->motionEnables)
+            return new_sensors;
+        dev->motionFired = 0;
     }
-    if (dev->events_fd[2] >= 0) {
-        //LOGV("(data close) about to close light fd=%d", dev->events_fd[1]);
-        close(dev->events_fd[2]);
-        dev->events_fd[2] = -1;
+    if (!dev->motionArmed) {
+        sensors_motion_init(&dev->motion);
+        dev->motionArmed = 1;
+    } else if (t - dev->motion.time < delay - delay / 8) {
+        return new_sensors;
     }
-    return 0;
+    if (!sensors_motion_update(&dev->motion,
+                               dev->sensors[ID_A].acceleration.v, t))
+        return new_sensors;
+
+    // without a shared block, we can't tell when it is enabled again: it is
+    // armed again right away, from where the device is now
+    if (dev->trusted && !shared_fire_oneshot(dev->shared, wanted))
+        return new_sensors;
+    // in another process than the control device we can't have it turned
+    // off: it stays fired for us until it is enabled again
+    if (dev->shared && !dev->trusted) {
+        dev->motionFired = 1;
+        dev->motionEnables =
+                android_atomic_acquire_load(&dev->shared->enables[ID_SM]);
+    }
+    dev->motionArmed = 0;
+    dev->sensors[ID_SM].vector.v[0] = 1.0f;
+    return new_sensors | wanted;
 }
 
-static int pick_sensor(struct sensors_data_context_t *dev,
-        sensors_data_t* values)
+/*
+ * Smooth the timestamp of a frame of a device that reports at a steady
+ * rate: a frame close to where the period says it should be is pulled
+ * towards that point, so the scheduling noise of whatever stamped it is
+ * mostly filtered out. Frames that are off by more than a quarter period
+ * are taken as they are.
+ */
+static int64_t data__frame_time(struct sensors_data_context_t *dev, int input,
+                                int64_t t)
 {
-    uint32_t mask = SUPPORTED_SENSORS;
-    while (mask) {
-        uint32_t i = 31 - __builtin_clz(mask);
-        mask &= ~(1<<i);
-        if (dev->pendingSensors & (1<<i)) {
-            dev->pendingSensors &= ~(1<<i);
-            *values = dev->sensors[i];
-            values->sensor = id_to_sensor[i];
-            LOGV_IF(0, "%d [%f, %f, %f]",
-                    values->sensor,
-                    values->vector.x,
-                    values->vector.y,
-                    values->vector.z);
-            return i;
-        }
+    struct frame_clock_t *clock = &dev->frameClocks[input];
+    int64_t period = clock->rate.period;
+    int64_t smoothed = t;
+
+    if (period) {
+        int64_t predicted = clock->smoothed + period;
+        int64_t error = t - predicted;
+        if (error > -period / 4 && error < period / 4)
+            smoothed = predicted + error / 4;
+        if (smoothed <= clock->smoothed)
+            smoothed = clock->smoothed + 1;
     }
-
-    LOGE("no sensor to return: pendingSensors = %08x", dev->pendingSensors);
-    return -1;
+    rate_update(&clock->rate, t);
+    clock->smoothed = smoothed;
+    return smoothed;
 }
 
-static uint32_t data__poll_process_akm_abs(struct sensors_data_context_t *dev,
-                                           int fd __attribute__((unused)),
-                                           struct input_event *event)
+/* commit a frame, returns the sensors it reported */
+static uint32_t data__poll_process_syn(struct sensors_data_context_t *dev,
+                                       int input, struct input_event *event,
+                                       int64_t offset, uint32_t new_sensors)
 {
-    uint32_t new_sensors = 0;
-    if (event->type == EV_ABS) {
-        LOGV("compass type: %d code: %d value: %-5d time: %ds",
-             event->type, event->code, event->value,
-             (int)event->time.tv_sec);
-        switch (event->code) {
-        case EVENT_TYPE_ACCEL_X:
-            new_sensors |= SENSORS_AKM_ACCELERATION;
-            dev->sensors[ID_A].acceleration.x = event->value * CONVERT_A_X;
-            break;
-        case EVENT_TYPE_ACCEL_Y:
-            new_sensors |= SENSORS_AKM_ACCELERATION;
-            dev->sensors[ID_A].acceleration.y = event->value * CONVERT_A_Y;
-            break;
-        case EVENT_TYPE_ACCEL_Z:
-            new_sensors |= SENSORS_AKM_ACCELERATION;
-            dev->sensors[ID_A].acceleration.z = event->value * CONVERT_A_Z;
-            break;
-        case EVENT_TYPE_MAGV_X:
-            new_sensors |= SENSORS_AKM_MAGNETIC_FIELD;
-            dev->sensors[ID_M].magnetic.x = event->value * CONVERT_M_X;
-            break;
-        case EVENT_TYPE_MAGV_Y:
-            new_sensors |= SENSORS_AKM_MAGNETIC_FIELD;
-            dev->sensors[ID_M].magnetic.y = event->value * CONVERT_M_Y;
-            break;
-        case EVENT_TYPE_MAGV_Z:
-            new_sensors |= SENSORS_AKM_MAGNETIC_FIELD;
-            dev->sensors[ID_M].magnetic.z = event->value * CONVERT_M_Z;
-            break;
-        case EVENT_TYPE_YAW:
-            new_sensors |= SENSORS_AKM_ORIENTATION;
-            dev->sensors[ID_O].orientation.azimuth =  event->value;
-            break;
-        case EVENT_TYPE_PITCH:
-            new_sensors |= SENSORS_AKM_ORIENTATION;
-            dev->sensors[ID_O].orientation.pitch = event->value;
-            break;
-        case EVENT_TYPE_ROLL:
-            new_sensors |= SENSORS_AKM_ORIENTATION;
-            dev->sensors[ID_O].orientation.roll = -event->value;
-            break;
-        case EVENT_TYPE_TEMPERATURE:
-            new_sensors |= SENSORS_AKM_TEMPERATURE;
-            dev->sensors[ID_T].temperature = event->value;
-            break;
-        case EVENT_TYPE_STEP_COUNT:
-            // step count (only reported in MODE_FFD)
-            // we do nothing with it for now.
-            break;
-        case EVENT_TYPE_ACCEL_STATUS:
-            // accuracy of the calibration (never returned!)
-            //LOGV("G-Sensor status %d", event->value);
-            break;
-        case EVENT_TYPE_ORIENT_STATUS: {
-            // accuracy of the calibration
-            uint32_t v = (uint32_t)(event->value & SENSOR_STATE_MASK);
-            LOGV_IF(dev->sensors[ID_O].orientation.status != (uint8_t)v,
-                    "M-Sensor status %d", v);
-            dev->sensors[ID_O].orientation.status = (uint8_t)v;
-        }
-            break;
+    // evdev stamps events with the wall clock, which can jump
+    int64_t t = event->time.tv_sec*1000000000LL +
+        event->time.tv_usec*1000 + offset;
+    if (new_sensors && input == BACKEND_AKM)
+        t = data__frame_time(dev, input, t);
+    if (new_sensors & SENSORS_AKM_GROUP)
+        data__akm_convert(dev, new_sensors & SENSORS_AKM_GROUP);
+    if (new_sensors & (SENSORS_FUSION_INPUTS | SENSORS_AKM_ORIENTATION))
+        new_sensors = data__fuse(dev, new_sensors, t);
+    if (new_sensors & SENSORS_GRAVITY_INPUTS)
+        new_sensors = data__gravity(dev, new_sensors, t);
+    if (new_sensors & (SENSORS_STEP_INPUTS | SENSORS_STEP_COUNTER))
+        new_sensors = data__steps(dev, new_sensors, t);
+    if (new_sensors & SENSORS_MOTION_INPUTS)
+        new_sensors = data__significant_motion(dev, new_sensors, t);
+    if (new_sensors) {
+        uint32_t mask = new_sensors;
+        while (mask) {
+            uint32_t i = 31 - __builtin_clz(mask);
+            mask &= ~(1<<i);
+            dev->sensors[i].time = t;
         }
+        // whether or not they get reported, these are the latest values
+        data__update_latest(dev, new_sensors);
+        // the hardware can be on for sensors nobody asked for (any more).
+        // A one-shot that fired may already be off, it was checked then.
+        new_sensors &= data__active(dev) | SENSORS_ONE_SHOT;
+        new_sensors = data__decimate(dev, new_sensors, t);
+        data__report(dev, new_sensors, t);
     }
-
     return new_sensors;
 }
 
-static uint32_t data__poll_process_cm_abs(struct sensors_data_context_t *dev,
-                                           int fd __attribute__((unused)),
-                                          struct input_event *event)
+/*
+ * evdev only reports the axes that changed, seed the raw values of the
+ * compass with what the driver holds so that the first frame converts
+ * right. Nothing is published: these values can be minutes old.
+ */
+static void data__snapshot_open(struct sensors_data_context_t *dev)
 {
-    uint32_t new_sensors = 0;
-    if (event->type == EV_ABS) {
-        LOGV("proximity type: %d code: %d value: %-5d time: %ds",
-             event->type, event->code, event->value,
-             (int)event->time.tv_sec);
-        if (event->code == EVENT_TYPE_PROXIMITY) {
-            new_sensors |= SENSORS_CM_PROXIMITY;
-            /* event->value seems to be 0 or 1, scale it to the threshold */
-            dev->sensors[ID_P].distance = event->value * PROXIMITY_THRESHOLD_CM;
-        }
+    struct input_absinfo absinfo;
+    int code;
+
+    for (code = 0; code <= ABS_MAX; code++) {
+        const struct akm_axis_t *axis = &sAkmAxes[code];
+        if (axis->id == AKM_AXIS_NONE ||
+                data__get_absinfo(dev, BACKEND_AKM, code, &absinfo))
+            continue;
+        dev->akmRaw[axis->id][axis->index] = absinfo.value;
     }
-    return new_sensors;
+    // the on-change sensors already enabled have had no value yet
+    dev->snapshotSensors = data__active(dev) & SENSORS_ON_CHANGE;
 }
 
-static uint32_t data__poll_process_ls_abs(struct sensors_data_context_t *dev,
-                                          int fd __attribute__((unused)),
-                                          struct input_event *event)
+/*
+ * Publish the current value of the on-change sensors that were enabled
+ * since we last looked, or they wouldn't report anything until the light
+ * level or the proximity changes, which can be forever. control__activate
+ * kicks us when it enables one. Returns the sensors published.
+ */
+static uint32_t data__snapshot(struct sensors_data_context_t *dev)
 {
-    uint32_t new_sensors = 0;
-    if (event->type == EV_ABS) {
-        LOGV("light-level type: %d code: %d value: %-5d time: %ds",
-             event->type, event->code, event->value,
-             (int)event->time.tv_sec);
-        if (event->code == EVENT_TYPE_LIGHT) {
-            struct input_absinfo absinfo;
-            int index;
-            if (!ioctl(fd, EVIOCGABS(ABS_DISTANCE), &absinfo)) {
-                index = event->value;
-                if (index >= 0) {
-                    new_sensors |= SENSORS_LIGHT;
-                    if (index >= ARRAY_SIZE(sLuxValues)) {
-                        index = ARRAY_SIZE(sLuxValues) - 1;
-                    }
-                    dev->sensors[ID_L].light = sLuxValues[index];
-                }
+    struct input_absinfo absinfo;
+    uint32_t enabled = dev->snapshotSensors;
+    uint32_t sensors = 0;
+    uint32_t mask;
+    int64_t now;
+
+    if (dev->shared) {
+        // enabled and disabled again in between, it may be on once more
+        mask = SENSORS_ON_CHANGE;
+        while (mask) {
+            uint32_t i = 31 - __builtin_clz(mask);
+            mask &= ~(1<<i);
+            int32_t gen =
+                    android_atomic_acquire_load(&dev->shared->enables[i]);
+            if (gen != dev->enablesSeen[i]) {
+                dev->enablesSeen[i] = gen;
+                enabled |= 1<<i;
             }
         }
+        if (enabled)
+            enabled &= data__active(dev);
     }
-    return new_sensors;
+    dev->snapshotSensors = 0;
+    if (!enabled)
+        return 0;
+
+    if ((enabled & SENSORS_CM_PROXIMITY) &&
+            !data__get_absinfo(dev, BACKEND_CM, EVENT_TYPE_PROXIMITY,
+                               &absinfo))
+        sensors |= data__decode_proximity(dev, absinfo.value);
+    if ((enabled & SENSORS_LIGHT) &&
+            !data__get_absinfo(dev, BACKEND_LIGHT, EVENT_TYPE_LIGHT, &absinfo))
+        sensors |= data__decode_light(dev, absinfo.value);
+    LOGV_IF(sensors != enabled, "no current value for sensors %x",
+            enabled & ~sensors);
+
+    now = data__now();
+    if (sensors & SENSORS_CM_PROXIMITY)
+        dev->sensors[ID_P].time = now;
+    if (sensors & SENSORS_LIGHT)
+        dev->sensors[ID_L].time = now;
+    LOGV("current values of sensors %x", sensors);
+    data__update_latest(dev, sensors);
+    data__publish(dev, sensors);
+    return sensors;
 }
 
-static void data__poll_process_syn(struct sensors_data_context_t *dev,
-                                   struct input_event *event,
-                                   uint32_t new_sensors)
+// some samples were published, there is something for data__poll
+#define POLL_GOT_SYN    0x1
+#define POLL_WAKE       0x2
+
+/*
+ * Drain all the events queued on an input device, INPUT_EVENT_BATCH at a
+ * time, and decode them. evdev only returns whole events and stops at the
+ * end of its queue, so a short read means the device is empty and we can
+ * go back to waiting without an extra read() to see EAGAIN. What follows
+ * the last EV_SYN waits in the frame of the device for the next drain.
+ */
+static int data__poll_drain(struct sensors_data_context_t *dev, int input)
 {
-    if (new_sensors) {
-        dev->pendingSensors |= new_sensors;
-        int64_t t = event->time.tv_sec*1000000000LL +
-            event->time.tv_usec*1000;
-        while (new_sensors) {
-            uint32_t i = 31 - __builtin_clz(new_sensors);
-            new_sensors &= ~(1<<i);
-            dev->sensors[i].time = t;
+    struct input_event events[INPUT_EVENT_BATCH];
+    struct input_frame_t *frame = &dev->frames[input];
+    process_abs_t process = sBackends[input].process;
+    const char *what = sBackends[input].name;
+    int fd = dev->events_fd[input];
+    int flags = 0;
+    // what rebases the event timestamps to CLOCK_MONOTONIC
+    int64_t offset = clock_ns(CLOCK_MONOTONIC) - clock_ns(CLOCK_REALTIME);
+
+    while (1) {
+        int nread = read(fd, events, sizeof(events));
+        if (nread < 0) {
+            LOGE_IF(errno != EAGAIN, "%s read error (%s)", what, strerror(errno));
+            break;
+        }
+        if (nread % sizeof(events[0])) {
+            LOGE("%s read too small %d", what, nread);
+            break;
+        }
+
+        int count = nread / sizeof(events[0]);
+        int i;
+        if (dev->recorder)
+            sensors_record_events(dev->recorder, input, events, count);
+        for (i = 0; i < count; i++) {
+            struct input_event *event = &events[i];
+            frame->sensors |= process(dev, fd, event);
+            if (event->type == EV_SYN) {
+                LOGV("%s syn %08x", what, frame->sensors);
+                frame->frames++;
+                if (data__poll_process_syn(dev, input, event, offset,
+                                           frame->sensors))
+                    flags |= POLL_GOT_SYN;
+                else
+                    frame->silent++;
+                frame->sensors = 0;
+            }
         }
+
+        if (count < INPUT_EVENT_BATCH)
+            break;
     }
+    if (frame->sensors)
+        frame->split++;
+    return flags;
 }
 
-static int data__poll(struct sensors_data_context_t *dev, sensors_data_t* values)
+/*
+ * Wait for one of the input devices in epoll_fd to have something for us
+ * and decode everything it has queued. The eventfd at WAKE_FD_INDEX (the
+ * wake fd for data__poll, the stop fd for the reader thread) makes us
+ * return POLL_WAKE instead. Returns 0 if nothing came in timeout_ms.
+ * On-change sensors just enabled are published first, without waiting.
+ */
+static int data__poll_inputs(struct sensors_data_context_t *dev, int epoll_fd,
+                             int timeout_ms)
 {
-    int akm_fd = dev->events_fd[0];
-    int cm_fd = dev->events_fd[1];
-    int ls_fd = dev->events_fd[2];
-
-    if (akm_fd < 0) {
-        LOGE("invalid compass file descriptor, fd=%d", akm_fd);
+    struct epoll_event events[SHARED_FD_INDEX + 1];
+    uint32_t ready = 0;
+    int flags = 0;
+    int i, n;
+
+    if (data__snapshot(dev))
+        return POLL_GOT_SYN;
+
+    n = epoll_wait(epoll_fd, events, ARRAY_SIZE(events), timeout_ms);
+    LOGV("return from epoll_wait: %d\n", n);
+    if (n < 0) {
+        if (errno == EINTR)
+            return 0;
+        LOGE("%s: error from epoll_wait(%d): %s",
+             __FUNCTION__, epoll_fd, strerror(errno));
         return -1;
     }
+    for (i = 0; i < n; i++)
+        ready |= 1 << events[i].data.u32;
 
-    if (cm_fd < 0) {
-        LOGE("invalid proximity-sensor file descriptor, fd=%d", cm_fd);
-        return -1;
+    if (ready & (1 << WAKE_FD_INDEX))
+        return POLL_WAKE;
+
+    /* drain every device that has something for us, in table order */
+    for (i = 0; i < NUM_BACKENDS; i++) {
+        if (ready & (1 << i))
+            flags |= data__poll_drain(dev, i);
+    }
+    if (dev->heldSensors && data__release_held(dev))
+        flags |= POLL_GOT_SYN;
+    return flags;
+}
+
+/*****************************************************************************/
+
+static void *data__reader_thread(void *arg)
+{
+    struct sensors_data_context_t *dev = arg;
+    uint64_t one = 1;
+
+    while (1) {
+        int flags = data__poll_inputs(dev, dev->reader.epoll_fd,
+                                      data__held_timeout(dev));
+        if (flags < 0) {
+            // data__poll would otherwise wait for us forever
+            LOGE("reader thread can't read the input devices, exiting");
+            android_atomic_release_store(1, &dev->reader.dead);
+            write(dev->reader.notify_fd, &one, sizeof(one));
+            break;
+        }
+        if (flags & POLL_WAKE)
+            break;
+        if (flags & POLL_GOT_SYN)
+            write(dev->reader.notify_fd, &one, sizeof(one));
     }
+    LOGV("reader thread exiting");
+    return NULL;
+}
+
+/* move what the reader thread decoded to the sensor queues */
+static void data__ring_drain(struct sensors_data_context_t *dev)
+{
+    struct ring_item_t item;
+    while (ring_pop(&dev->reader.ring, &item))
+        data__queue(dev, item.id, &item.data);
+}
 
-    if (ls_fd < 0) {
-        LOGE("invalid light-sensor file descriptor, fd=%d", ls_fd);
+/*
+ * With a reader thread, all data__poll has to do is wait for the ring.
+ * Returns -1 once the reader thread is gone and the ring has been drained.
+ */
+static int data__wait_ring(struct sensors_data_context_t *dev, int timeout_ms)
+{
+    struct epoll_event events[2];
+    uint64_t count;
+    int i, n;
+
+    if (android_atomic_acquire_load(&dev->reader.dead))
         return -1;
+    n = epoll_wait(dev->epoll_fd, events, ARRAY_SIZE(events), timeout_ms);
+    if (n < 0) {
+        if (errno == EINTR)
+            return 0;
+        LOGE("%s: error from epoll_wait(%d): %s",
+             __FUNCTION__, dev->epoll_fd, strerror(errno));
+        return -1;
+    }
+    for (i = 0; i < n; i++) {
+        if (events[i].data.u32 == WAKE_FD_INDEX)
+            return POLL_WAKE;
     }
+    read(dev->reader.notify_fd, &count, sizeof(count));
+    return 0;
+}
+
+static int data__get_ring_stats(struct sensors_data_context_t *dev,
+                                struct sensors_ring_stats_t *stats)
+{
+    struct sensors_ring_t *ring = &dev->reader.ring;
+    if (!dev->use_reader)
+        return -ENOSYS;
+    stats->depth = ring->depth;
+    stats->used = (uint32_t)android_atomic_acquire_load(&ring->head) -
+            (uint32_t)ring->tail;
+    stats->high_water = ring->high_water;
+    stats->overruns = android_atomic_acquire_load(&ring->overruns);
+    return 0;
+}
+
+static int data__set_queue_policy(struct sensors_data_context_t *dev,
+                                  int handle, int policy)
+{
+    if ((handle < SENSORS_HANDLE_BASE) ||
+            (handle >= SENSORS_HANDLE_BASE+MAX_NUM_SENSORS))
+        return -EINVAL;
+    if (policy != SENSORS_QUEUE_DROP_OLDEST &&
+            policy != SENSORS_QUEUE_DROP_NEWEST)
+        return -EINVAL;
+    dev->queues[handle - SENSORS_HANDLE_BASE].policy = policy;
+    return 0;
+}
+
+static int data__get_queue_stats(struct sensors_data_context_t *dev,
+                                 int handle,
+                                 struct sensors_queue_stats_t *stats)
+{
+    if ((handle < SENSORS_HANDLE_BASE) ||
+            (handle >= SENSORS_HANDLE_BASE+MAX_NUM_SENSORS))
+        return -EINVAL;
+    struct sensor_queue_t *q = &dev->queues[handle - SENSORS_HANDLE_BASE];
+    stats->depth = q->depth;
+    stats->used = q->count;
+    stats->drops = q->drops;
+    stats->policy = q->policy;
+    return 0;
+}
 
-    // there are pending sensors, returns them now...
-    if (dev->pendingSensors) {
-        LOGV("pending sensors 0x%08x", dev->pendingSensors);
-        return pick_sensor(dev, values);
+/*****************************************************************************/
+
+/* how long the samples we are about to return have been in the HAL */
+static void data__account(struct sensors_data_context_t *dev,
+                          const sensors_data_t* values, int count)
+{
+    int64_t now = data__now();
+    int i;
+    for (i = 0; i < count; i++) {
+        int64_t latency = now - values[i].time;
+        int id = sensor_to_id(values[i].sensor);
+        if (id >= 0) {
+            struct sensor_stats_t *stats = &dev->stats[id];
+            stats->latency += (latency - stats->latency) >> RATE_SHIFT;
+        }
+        if (dev->replay) {
+            sensors_replay_account(dev->replay, latency);
+            if (id >= 0 && !(dev->firstSamples & (1<<id))) {
+                dev->firstSamples |= 1<<id;
+                LOGI("replay: first sample of sensor %d %lld us after open",
+                     id, (long long)((now - dev->openTime) / 1000));
+            }
+        }
     }
+}
 
-    // wait until we get a complete event for an enabled sensor
-    uint32_t new_sensors = 0;
-    while (1) {
-        /* read the next event; first, read the compass event, then the
-           proximity event */
-        struct input_event event;
-        int got_syn = 0;
-        int exit = 0;
-        int nread;
-        fd_set rfds;
-        int n;
-
-        FD_ZERO(&rfds);
-        FD_SET(akm_fd, &rfds);
-        FD_SET(cm_fd, &rfds);
-        FD_SET(ls_fd, &rfds);
-        n = select(__MAX(akm_fd, __MAX(cm_fd, ls_fd)) + 1, &rfds,
-                   NULL, NULL, NULL);
-        LOGV("return from select: %d\n", n);
-        if (n < 0) {
-            LOGE("%s: error from select(%d, %d): %s",
-                 __FUNCTION__,
-                 akm_fd, cm_fd, strerror(errno));
+static int data__get_sensor_stats(struct sensors_data_context_t *dev,
+                                  int handle,
+                                  struct sensors_sensor_stats_t *stats)
+{
+    if ((handle < SENSORS_HANDLE_BASE) ||
+            (handle >= SENSORS_HANDLE_BASE+MAX_NUM_SENSORS))
+        return -EINVAL;
+    struct sensor_stats_t *s = &dev->stats[handle - SENSORS_HANDLE_BASE];
+    stats->period_ns = s->rate.period;
+    stats->rate = s->rate.period ? 1000000000.0f / s->rate.period : 0.0f;
+    stats->jitter_ns = s->rate.jitter;
+    stats->latency_ns = s->latency;
+    stats->samples = s->rate.count;
+    return 0;
+}
+
+static int data__poll_batch(struct sensors_data_context_t *dev,
+                            sensors_data_t* values, int count)
+{
+    int i;
+    for (i = 0; i < NUM_BACKENDS; i++) {
+        if (dev->events_fd[i] < 0) {
+            LOGE("invalid %s file descriptor, fd=%d",
+                 sBackends[i].input_name, dev->events_fd[i]);
             return -1;
         }
+    }
 
-        if (FD_ISSET(akm_fd, &rfds)) {
-            nread = read(akm_fd, &event, sizeof(event));
-            if (nread == sizeof(event)) {
-                new_sensors |= data__poll_process_akm_abs(dev, akm_fd, &event);
-                LOGV("akm abs %08x", new_sensors);
-                got_syn = event.type == EV_SYN;
-                exit = got_syn && event.code == SYN_CONFIG;
-                if (got_syn) {
-                    LOGV("akm syn %08x", new_sensors);
-                    data__poll_process_syn(dev, &event, new_sensors);
-                    new_sensors = 0;
-                }
-            }
-            else LOGE("akm read too small %d", nread);
-        }
-        else LOGV("akm fd is not set");
-
-        if (FD_ISSET(cm_fd, &rfds)) {
-            nread = read(cm_fd, &event, sizeof(event));
-            if (nread == sizeof(event)) {
-                new_sensors |= data__poll_process_cm_abs(dev, cm_fd, &event);
-                LOGV("cm abs %08x", new_sensors);
-                got_syn |= event.type == EV_SYN;
-                exit |= got_syn && event.code == SYN_CONFIG;
-                if (got_syn) {
-                    LOGV("cm syn %08x", new_sensors);
-                    data__poll_process_syn(dev, &event, new_sensors);
-                    new_sensors = 0;
-                }
+    if (count <= 0)
+        return -EINVAL;
+
+    // wait until we get a complete event for an enabled sensor
+    while (1) {
+        int flags;
+
+        if (dev->use_reader)
+            data__ring_drain(dev);
+        data__check_batches(dev);
+
+        // there are pending sensors, returns them now...
+        if (dev->pendingSensors) {
+            int n = 0;
+            LOGV("pending sensors 0x%08x", dev->pendingSensors);
+            while (n < count && dev->pendingSensors) {
+                if (pick_sensor(dev, &values[n]) < 0)
+                    break;
+                n++;
             }
-            else LOGE("cm read too small %d", nread);
-        }
-        else LOGV("cm fd is not set");
-
-        if (FD_ISSET(ls_fd, &rfds)) {
-            nread = read(ls_fd, &event, sizeof(event));
-            if (nread == sizeof(event)) {
-                new_sensors |= data__poll_process_ls_abs(dev, ls_fd, &event);
-                LOGV("ls abs %08x", new_sensors);
-                got_syn |= event.type == EV_SYN;
-                exit |= got_syn && event.code == SYN_CONFIG;
-                if (got_syn) {
-                    LOGV("ls syn %08x", new_sensors);
-                    data__poll_process_syn(dev, &event, new_sensors);
-                    new_sensors = 0;
-                }
+            // 0 is for control__wake() only, keep waiting for a sample
+            if (n) {
+                data__account(dev, values, n);
+                return n;
             }
-            else LOGE("ls read too small %d", nread);
         }
-        else LOGV("ls fd is not set");
 
-        if (exit) {
-            // we use SYN_CONFIG to signal that we need to exit the
-            // main loop.
-            //LOGV("got empty message: value=%d", event->value);
-            LOGV("exit");
-            return 0x7FFFFFFF;
+        int timeout = data__batch_timeout(dev);
+        if (dev->use_reader) {
+            flags = data__wait_ring(dev, timeout);
+        } else {
+            int held = data__held_timeout(dev);
+            if (held >= 0 && (timeout < 0 || held < timeout))
+                timeout = held;
+            flags = data__poll_inputs(dev, dev->epoll_fd, timeout);
         }
+        if (flags < 0)
+            return -1;
 
-        if (got_syn && dev->pendingSensors) {
-            LOGV("got syn, picking sensor");
-            return pick_sensor(dev, values);
+        // control__flush() only wants what is held back, see above
+        if ((flags & POLL_WAKE) && data__woken(dev)) {
+            // control__wake() asked us to exit the main loop.
+            LOGV("exit");
+            return 0;
         }
     }
 }
 
+static int data__poll(struct sensors_data_context_t *dev, sensors_data_t* values)
+{
+    int n = data__poll_batch(dev, values, 1);
+    if (n < 0)
+        return -1;
+    if (n == 0)
+        return 0x7FFFFFFF;
+    return sensor_to_id(values->sensor);
+}
+
 /*****************************************************************************/
 
 static int control__close(struct hw_device_t *dev)
 {
     struct sensors_control_context_t* ctx =
         (struct sensors_control_context_t*)dev;
+    int i;
     if (ctx) {
-        close_akm(ctx);
-        close_cm(ctx);
-        close_ls(ctx);
+        pthread_mutex_lock(&ctx->lock);
+        ctx->stopping = 1;
+        pthread_cond_signal(&ctx->cond);
+        pthread_mutex_unlock(&ctx->lock);
+        if (ctx->power_thread_running)
+            pthread_join(ctx->power_thread, NULL);
+        if (ctx->oneshot_thread_running) {
+            android_atomic_inc(&ctx->shared->oneshots);
+            futex(&ctx->shared->oneshots, FUTEX_WAKE, INT32_MAX);
+            pthread_join(ctx->oneshot_thread, NULL);
+        }
+        // what only lingered is not needed by anyone
+        if (ctx->lingering_sensors) {
+            ctx->lingering_sensors = 0;
+            control__apply_locked(ctx);
+        }
+        LOGI("%u activations, %u ioctls, %u cold starts saved",
+             ctx->activations, ctx->ioctls, ctx->cold_starts_saved);
+        pthread_mutex_lock(&sOwnerLock);
+        if (sOwner == ctx)
+            sOwner = NULL;
+        pthread_mutex_unlock(&sOwnerLock);
+        pthread_mutex_destroy(&ctx->lock);
+        pthread_cond_destroy(&ctx->cond);
+        for (i = 0; i < NUM_BACKENDS; i++)
+            backend__close(ctx, i);
+        if (ctx->wake_fd >= 0)
+            close(ctx->wake_fd);
+        shared_unmap(ctx->shared);
+        if (ctx->shared_fd >= 0)
+            close(ctx->shared_fd);
+        sensors_channel_unmap(ctx->channel);
+        if (ctx->channel_fd >= 0)
+            close(ctx->channel_fd);
         free(ctx);
     }
     return 0;
@@ -987,35 +3295,73 @@ static int open_sensors(const struct hw_module_t* module, const char* name,
     int status = -EINVAL;
     if (!strcmp(name, SENSORS_HARDWARE_CONTROL)) {
         struct sensors_control_context_t *dev;
+        int i;
         dev = malloc(sizeof(*dev));
         memset(dev, 0, sizeof(*dev));
-        dev->akmd_fd = -1;
-        dev->cmd_fd = -1;
-        dev->lsd_fd = -1;
-        dev->device.common.tag = HARDWARE_DEVICE_TAG;
-        dev->device.common.version = 0;
-        dev->device.common.module = module;
-        dev->device.common.close = control__close;
-        dev->device.open_data_source = control__open_data_source;
-        dev->device.activate = control__activate;
-        dev->device.set_delay= control__set_delay;
-        dev->device.wake = control__wake;
-        *device = &dev->device.common;
+        pthread_mutex_init(&dev->lock, NULL);
+        cond_init_monotonic(&dev->cond);
+        for (i = 0; i < NUM_BACKENDS; i++) {
+            dev->fds[i] = -1;
+            dev->backend_delays[i] = -1;
+            // we don't know what state the drivers were left in
+            dev->stale_groups |= sBackends[i].mask;
+            dev->unsynced_groups |= sBackends[i].mask;
+            char key[PROPERTY_KEY_MAX];
+            char value[PROPERTY_VALUE_MAX];
+            snprintf(key, sizeof(key), "ro.sensors.grace_ms.%s",
+                     sBackends[i].name);
+            dev->grace_ms[i] = property_get(key, value, "") ?
+                    atoi(value) : sBackends[i].grace_ms;
+        }
+        char dirname[PROPERTY_VALUE_MAX];
+        if (property_get("ro.sensors.input_dir", dirname, ""))
+            input_cache_set_dir(&sInputCache, dirname);
+        dev->wake_fd = eventfd(0, 0);
+        LOGE_IF(dev->wake_fd<0, "Couldn't create wake eventfd (%s)",
+                strerror(errno));
+        control__shared_open(dev);
+        dev->fusion_sensors = fusion_sensors();
+        dev->device.base.common.tag = HARDWARE_DEVICE_TAG;
+        dev->device.base.common.version = SENSORS_DEVICE_EXT_VERSION;
+        dev->device.base.common.module = module;
+        dev->device.base.common.close = control__close;
+        dev->device.base.open_data_source = control__open_data_source;
+        dev->device.base.activate = control__activate;
+        dev->device.base.set_delay= control__set_delay;
+        dev->device.base.wake = control__wake;
+        dev->device.set_delay_handle = control__set_delay_handle;
+        dev->device.get_control_stats = control__get_control_stats;
+        dev->device.get_latest = control__get_latest;
+        dev->device.get_channel_fd = control__get_channel_fd;
+        dev->device.batch = control__batch;
+        dev->device.flush = control__flush;
+        *device = &dev->device.base.common;
     } else if (!strcmp(name, SENSORS_HARDWARE_DATA)) {
         struct sensors_data_context_t *dev;
-        dev = malloc(sizeof(*dev));
+        // the sensor queues are cache line aligned
+        int i;
+        dev = memalign(CACHE_LINE_SIZE, sizeof(*dev));
         memset(dev, 0, sizeof(*dev));
-        dev->events_fd[0] = -1;
-        dev->events_fd[1] = -1;
-        dev->events_fd[2] = -1;
-        dev->device.common.tag = HARDWARE_DEVICE_TAG;
-        dev->device.common.version = 0;
-        dev->device.common.module = module;
-        dev->device.common.close = data__close;
-        dev->device.data_open = data__data_open;
-        dev->device.data_close = data__data_close;
-        dev->device.poll = data__poll;
-        *device = &dev->device.common;
+        for (i = 0; i < NUM_BACKENDS; i++)
+            dev->events_fd[i] = -1;
+        dev->wake_fd = -1;
+        dev->epoll_fd = -1;
+        dev->reader.epoll_fd = -1;
+        dev->reader.stop_fd = -1;
+        dev->reader.notify_fd = -1;
+        dev->device.base.common.tag = HARDWARE_DEVICE_TAG;
+        dev->device.base.common.version = SENSORS_DEVICE_EXT_VERSION;
+        dev->device.base.common.module = module;
+        dev->device.base.common.close = data__close;
+        dev->device.base.data_open = data__data_open;
+        dev->device.base.data_close = data__data_close;
+        dev->device.base.poll = data__poll;
+        dev->device.get_ring_stats = data__get_ring_stats;
+        dev->device.set_queue_policy = data__set_queue_policy;
+        dev->device.get_queue_stats = data__get_queue_stats;
+        dev->device.poll_batch = data__poll_batch;
+        dev->device.get_sensor_stats = data__get_sensor_stats;
+        *device = &dev->device.base.common;
     }
     return status;
 }
@@ -0,0 +1,182 @@
+/*
+ * Copyright (C) 2010 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "Sensors"
+
+#include <errno.h>
+#include <signal.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#include <linux/futex.h>
+
+#include <cutils/ashmem.h>
+#include <cutils/atomic.h>
+#include <cutils/log.h>
+
+#include "sensors_channel.h"
+
+/*****************************************************************************/
+
+#define CHANNEL_MASK    (SENSORS_CHANNEL_DEPTH - 1)
+
+static int futex(volatile int32_t *addr, int op, int32_t value,
+                 const struct timespec *timeout)
+{
+    // not FUTEX_PRIVATE_FLAG, the readers are in other processes
+    return syscall(__NR_futex, addr, op, value, timeout, NULL, 0);
+}
+
+int sensors_channel_create(struct sensors_channel_t **channel)
+{
+    void *p = MAP_FAILED;
+    int fd = ashmem_create_region("sensors-channel",
+                                  sizeof(struct sensors_channel_t));
+    if (fd >= 0)
+        p = mmap(NULL, sizeof(struct sensors_channel_t),
+                 PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    // from now on, the readers can't write what they read
+    if (p == MAP_FAILED || ashmem_set_prot_region(fd, PROT_READ) < 0) {
+        LOGE("Couldn't create the sensors channel (%s)", strerror(errno));
+        if (p != MAP_FAILED)
+            munmap(p, sizeof(struct sensors_channel_t));
+        if (fd >= 0)
+            close(fd);
+        return -1;
+    }
+    *channel = p;
+    return fd;
+}
+
+struct sensors_channel_t *sensors_channel_map(int fd)
+{
+    void *p = mmap(NULL, sizeof(struct sensors_channel_t),
+                   PROT_READ, MAP_SHARED, fd, 0);
+    if (p == MAP_FAILED) {
+        LOGE("Couldn't map the sensors channel (%s)", strerror(errno));
+        return NULL;
+    }
+    return p;
+}
+
+void sensors_channel_unmap(struct sensors_channel_t *channel)
+{
+    if (channel)
+        munmap(channel, sizeof(*channel));
+}
+
+int sensors_channel_claim(struct sensors_channel_t *channel)
+{
+    int32_t pid = getpid();
+    int32_t writer = android_atomic_acquire_load(&channel->writer);
+    // a writer that died without releasing the channel doesn't count
+    if (writer && (writer == pid || kill(writer, 0) == 0 || errno != ESRCH))
+        return -EBUSY;
+    if (android_atomic_acquire_cas(writer, pid, &channel->writer))
+        return -EBUSY;
+    return 0;
+}
+
+void sensors_channel_release(struct sensors_channel_t *channel)
+{
+    android_atomic_release_cas(getpid(), 0, &channel->writer);
+}
+
+void sensors_channel_write(struct sensors_channel_t *channel,
+        const sensors_data_t *data, int count)
+{
+    uint32_t head = channel->head;
+    int i;
+    for (i = 0; i < count; i++, head++) {
+        struct sensors_channel_entry_t *entry =
+                &channel->entries[head & CHANNEL_MASK];
+        // readers that get here first see the entry is being rewritten
+        android_atomic_acquire_store(head * 2 + 1, &entry->seq);
+        entry->data = data[i];
+        android_atomic_release_store(head * 2 + 2, &entry->seq);
+    }
+    android_atomic_release_store(head, &channel->head);
+    // the readers can't write the channel to say whether they sleep
+    futex(&channel->head, FUTEX_WAKE, INT32_MAX, NULL);
+}
+
+void sensors_channel_reader_init(struct sensors_channel_reader_t *reader,
+        struct sensors_channel_t *channel)
+{
+    reader->channel = channel;
+    reader->cursor = android_atomic_acquire_load(&channel->head);
+    reader->overruns = 0;
+}
+
+/* wait for head to move past the cursor, returns 0 on timeout */
+static int channel_wait(struct sensors_channel_reader_t *reader,
+                        int timeout_ms)
+{
+    struct sensors_channel_t *channel = reader->channel;
+    struct timespec ts, *timeout = NULL;
+    int ret = 1;
+    if (timeout_ms >= 0) {
+        ts.tv_sec = timeout_ms / 1000;
+        ts.tv_nsec = (timeout_ms % 1000) * 1000000L;
+        timeout = &ts;
+    }
+    // the futex only sleeps if head is still where we saw it
+    if (futex(&channel->head, FUTEX_WAIT, (int32_t)reader->cursor,
+              timeout) < 0 && errno == ETIMEDOUT)
+        ret = 0;
+    return ret;
+}
+
+int sensors_channel_read(struct sensors_channel_reader_t *reader,
+        sensors_data_t *data, int count, int timeout_ms)
+{
+    struct sensors_channel_t *channel = reader->channel;
+    int n = 0;
+
+    while (!n) {
+        uint32_t head = android_atomic_acquire_load(&channel->head);
+        if (head == reader->cursor) {
+            if (!timeout_ms || !channel_wait(reader, timeout_ms))
+                return 0;
+            continue;
+        }
+        if (head - reader->cursor > SENSORS_CHANNEL_DEPTH) {
+            reader->overruns += head - reader->cursor - SENSORS_CHANNEL_DEPTH;
+            reader->cursor = head - SENSORS_CHANNEL_DEPTH;
+        }
+        while (n < count && reader->cursor != head) {
+            const struct sensors_channel_entry_t *entry =
+                    &channel->entries[reader->cursor & CHANNEL_MASK];
+            int32_t seq = reader->cursor * 2 + 2;
+            reader->cursor++;
+            if (android_atomic_acquire_load(&entry->seq) != seq) {
+                reader->overruns++;
+                continue;
+            }
+            data[n] = entry->data;
+            // the writer lapped us while we were copying
+            if (android_atomic_release_load(&entry->seq) != seq) {
+                reader->overruns++;
+                continue;
+            }
+            n++;
+        }
+    }
+    return n;
+}
@@ -0,0 +1,93 @@
+/*
+ * Copyright (C) 2010 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_SENSORS_CHANNEL_H
+#define ANDROID_SENSORS_CHANNEL_H
+
+#include <stdint.h>
+#include <sys/cdefs.h>
+
+#include <hardware/sensors.h>
+
+__BEGIN_DECLS
+
+/*
+ * A channel is a ring of the samples the sensors HAL returns from poll(),
+ * in an ashmem region any number of processes can map. Only the process
+ * that created it can write it, every other mapping is read-only: one
+ * data device of that process writes it; readers each keep their own
+ * cursor, never hold the writer back and find out when it lapped them.
+ * Readers block on a futex on the head of the ring, so attaching to it
+ * takes nothing but the fd, which the control device hands out through
+ * get_channel_fd().
+ */
+
+#define SENSORS_CHANNEL_DEPTH   256
+
+struct sensors_channel_entry_t {
+    /* 2 * index + 2 once the entry holds sample 'index', odd while written */
+    volatile int32_t seq;
+    sensors_data_t data;
+} __attribute__((aligned(64)));
+
+struct sensors_channel_t {
+    /* index of the next sample, free running */
+    volatile int32_t head;
+    /* pid of the process writing the channel, 0 if none */
+    volatile int32_t writer;
+    struct sensors_channel_entry_t entries[SENSORS_CHANNEL_DEPTH]
+            __attribute__((aligned(64)));
+};
+
+/*
+ * Create a channel and map it writable into *channel, the only mapping of
+ * it that ever will be. Returns its ashmem fd or -1.
+ */
+int sensors_channel_create(struct sensors_channel_t **channel);
+/* map the channel 'fd' read-only, for reading */
+struct sensors_channel_t *sensors_channel_map(int fd);
+void sensors_channel_unmap(struct sensors_channel_t *channel);
+
+/*
+ * Become the writer of the channel mapped by sensors_channel_create(),
+ * unless another live process is. Returns 0 on success or -EBUSY.
+ */
+int sensors_channel_claim(struct sensors_channel_t *channel);
+void sensors_channel_release(struct sensors_channel_t *channel);
+/* append samples and wake the readers up, only for the writer */
+void sensors_channel_write(struct sensors_channel_t *channel,
+        const sensors_data_t *data, int count);
+
+struct sensors_channel_reader_t {
+    struct sensors_channel_t *channel;
+    uint32_t cursor;
+    /* samples the writer overwrote before we could read them */
+    uint32_t overruns;
+};
+
+/* start reading from the samples written after this call */
+void sensors_channel_reader_init(struct sensors_channel_reader_t *reader,
+        struct sensors_channel_t *channel);
+/*
+ * Read up to 'count' samples, waiting up to 'timeout_ms' for the first one
+ * (forever if negative). Returns the number of samples read, 0 on timeout.
+ */
+int sensors_channel_read(struct sensors_channel_reader_t *reader,
+        sensors_data_t *data, int count, int timeout_ms);
+
+__END_DECLS
+
+#endif  // ANDROID_SENSORS_CHANNEL_H
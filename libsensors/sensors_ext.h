@@ -0,0 +1,212 @@
+/*
+ * Copyright (C) 2010 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_SENSORS_EXT_H
+#define ANDROID_SENSORS_EXT_H
+
+#include <stdint.h>
+#include <sys/cdefs.h>
+
+#include <hardware/sensors.h>
+
+__BEGIN_DECLS
+
+/*
+ * Extensions implemented by the bravo sensors module on top of the
+ * standard sensors HAL.
+ *
+ * When common.version of a device opened from this module is at least
+ * SENSORS_DEVICE_EXT_VERSION, it can be cast to the matching *_ext_device_t
+ * below. New entry points are only ever appended.
+ */
+#define SENSORS_DEVICE_EXT_VERSION  1
+
+/*****************************************************************************/
+
+struct sensors_control_stats_t {
+    /* calls to activate() */
+    uint32_t activations;
+    /* ioctls made to the sensor drivers */
+    uint32_t ioctls;
+    /* activations of a device still on because of its grace period */
+    uint32_t cold_starts_saved;
+};
+
+struct sensors_control_ext_device_t {
+    struct sensors_control_device_t base;
+
+    /**
+     * Set the delay between two samples of the sensor 'handle' only. The
+     * hardware runs at the fastest rate any enabled sensor asked for and
+     * the samples of the slower ones are decimated. set_delay() sets the
+     * delay of all the sensors.
+     * Returns 0 on success or a negative error code.
+     */
+    int (*set_delay_handle)(struct sensors_control_ext_device_t *dev,
+            int handle, int32_t ms);
+
+    /**
+     * Get the number of activations and of driver ioctls so far.
+     * Returns 0.
+     */
+    int (*get_control_stats)(struct sensors_control_ext_device_t *dev,
+            struct sensors_control_stats_t *stats);
+
+    /**
+     * Get the latest value decoded for the sensor 'handle' by the data
+     * devices opened from this control device in its process, whether or
+     * not poll() returned it: those of other processes can't publish it.
+     * Never blocks nor wakes up the data devices. Other processes read
+     * the same values, see sensors_latest.h.
+     * Returns 0 on success, -ENODATA if there is no value yet, -EAGAIN if
+     * the value kept changing while it was read, -ENOSYS if the value
+     * can't be shared, or -EINVAL.
+     */
+    int (*get_latest)(struct sensors_control_ext_device_t *dev,
+            int handle, sensors_data_t *data);
+
+    /**
+     * Get a new fd of the channel the data devices opened from this
+     * control device, in its process, publish their samples to, see
+     * sensors_channel.h. The caller owns the fd and can pass it to other
+     * processes, which can only read it.
+     * Returns the fd, -ENOSYS if there is no channel, or a negative error
+     * code.
+     */
+    int (*get_channel_fd)(struct sensors_control_ext_device_t *dev);
+
+    /**
+     * Let the data devices hold the samples of the sensor 'handle' back
+     * for up to 'max_latency_ms' and return them in one burst, so the
+     * samples of a slow sensor don't wake the system up one by one. The
+     * burst comes when the oldest sample held back is due, when its queue
+     * (see sensors_queue_stats_t) is full, or along with any sample that
+     * isn't held back. 0, the default, returns every sample right away.
+     * Returns 0 on success, -ENOSYS if the data devices can't be told, or
+     * -EINVAL.
+     */
+    int (*batch)(struct sensors_control_ext_device_t *dev,
+            int handle, int32_t max_latency_ms);
+
+    /**
+     * Make the data devices return what they hold back for the sensor
+     * 'handle' now. Unlike wake(), poll() doesn't return 0 for it.
+     * Returns 0 on success, -ENOSYS, or a negative error code.
+     */
+    int (*flush)(struct sensors_control_ext_device_t *dev, int handle);
+};
+
+/*****************************************************************************/
+
+/*
+ * Reader thread mode: when "ro.sensors.reader_thread" is "1", a thread
+ * owned by the data device reads the input devices and hands decoded
+ * samples to poll() through a ring of "ro.sensors.ring_depth" entries.
+ */
+struct sensors_ring_stats_t {
+    /* number of samples the ring can hold */
+    uint32_t depth;
+    /* samples currently waiting to be picked by poll() */
+    uint32_t used;
+    /* largest value 'used' reached since data_open() */
+    uint32_t high_water;
+    /* samples dropped because the ring was full */
+    uint32_t overruns;
+};
+
+/*
+ * Every sensor has its own queue of samples waiting to be returned by
+ * poll(), "ro.sensors.queue_depth" entries deep. When a queue is full,
+ * its overflow policy decides which sample is dropped.
+ */
+enum {
+    SENSORS_QUEUE_DROP_OLDEST   = 0,
+    SENSORS_QUEUE_DROP_NEWEST   = 1,
+};
+
+struct sensors_queue_stats_t {
+    /* number of samples the queue can hold */
+    uint32_t depth;
+    /* samples currently waiting to be returned by poll() */
+    uint32_t used;
+    /* samples dropped because the queue was full */
+    uint32_t drops;
+    /* one of SENSORS_QUEUE_DROP_* */
+    int policy;
+};
+
+/*
+ * Sample timestamps are in the CLOCK_MONOTONIC time base. The data device
+ * keeps running estimates of how the samples of every sensor come in.
+ */
+struct sensors_sensor_stats_t {
+    /* average interval between two samples, in ns */
+    int64_t period_ns;
+    /* average deviation of the intervals from period_ns, in ns */
+    int64_t jitter_ns;
+    /* average time from a sample being taken to poll() returning it, in ns */
+    int64_t latency_ns;
+    /* samples per second */
+    float rate;
+    /* samples decoded since data_open() */
+    uint32_t samples;
+};
+
+struct sensors_data_ext_device_t {
+    struct sensors_data_device_t base;
+
+    /**
+     * Get the reader thread ring statistics.
+     * Returns -ENOSYS when the reader thread is not in use.
+     */
+    int (*get_ring_stats)(struct sensors_data_ext_device_t *dev,
+            struct sensors_ring_stats_t *stats);
+
+    /**
+     * Set the overflow policy (one of SENSORS_QUEUE_DROP_*) of the queue
+     * of the sensor 'handle'.
+     * Returns 0 on success or -EINVAL.
+     */
+    int (*set_queue_policy)(struct sensors_data_ext_device_t *dev,
+            int handle, int policy);
+
+    /**
+     * Get the statistics of the queue of the sensor 'handle'.
+     * Returns 0 on success or -EINVAL.
+     */
+    int (*get_queue_stats)(struct sensors_data_ext_device_t *dev,
+            int handle, struct sensors_queue_stats_t *stats);
+
+    /**
+     * Like poll(), but return every sample that is ready, up to 'count',
+     * in one call. Blocks until at least one sample is available.
+     * Returns the number of samples written to 'data', 0 if woken up by
+     * wake(), or a negative error code.
+     */
+    int (*poll_batch)(struct sensors_data_ext_device_t *dev,
+            sensors_data_t* data, int count);
+
+    /**
+     * Get the rate, jitter and latency estimates of the sensor 'handle'.
+     * Returns 0 on success or -EINVAL.
+     */
+    int (*get_sensor_stats)(struct sensors_data_ext_device_t *dev,
+            int handle, struct sensors_sensor_stats_t *stats);
+};
+
+__END_DECLS
+
+#endif  // ANDROID_SENSORS_EXT_H
@@ -0,0 +1,331 @@
+/*
+ * Copyright (C) 2010 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <math.h>
+#include <string.h>
+
+#include "sensors_fusion.h"
+
+/*****************************************************************************/
+
+#define RAD2DEG                 (180.0f / (float)M_PI)
+
+// time constant of the low-pass filter
+#define FUSION_TAU_NS           100000000LL
+
+// after a gap longer than this, start over from the new measurement
+#define FUSION_MAX_GAP_NS       1000000000LL
+
+// time constant of the gravity filter
+#define GRAVITY_TAU_NS          200000000LL
+
+// time constants of the step detector's average and of its low-pass filter
+#define STEP_MEAN_TAU_NS        1000000000LL
+#define STEP_SMOOTH_TAU_NS      40000000LL
+
+// a peak above the average and the trough after it (m/s^2)
+#define STEP_PEAK               1.0f
+#define STEP_TROUGH             (-0.5f)
+
+// walking pace: steps closer than the first or further apart than the
+// second don't make a run
+#define STEP_MIN_INTERVAL_NS    250000000LL
+#define STEP_MAX_INTERVAL_NS    2000000000LL
+
+// steps in a row before they are counted
+#define STEP_MIN_RUN            4
+
+// time constant of the resting acceleration of the motion detector
+#define MOTION_REST_TAU_NS      2000000000LL
+
+// how far from rest a sample has to be to count (m/s^2), squared
+#define MOTION_THRESHOLD2       (1.5f * 1.5f)
+
+// samples away from rest within the window that make a significant motion
+#define MOTION_MIN_HITS         3
+#define MOTION_WINDOW_NS        2000000000LL
+
+// |m x a| below this (uT * m/s^2) means the field is too close to vertical
+#define FUSION_MIN_H            0.1f
+
+// |a| below this (m/s^2) means free fall
+#define FUSION_MIN_A            0.1f
+
+void sensors_fusion_init(struct sensors_fusion_t *fusion)
+{
+    memset(fusion, 0, sizeof(*fusion));
+    fusion->q[0] = 1.0f;
+}
+
+static inline float inv_norm(const float *v)
+{
+    return 1.0f / sqrtf(v[0]*v[0] + v[1]*v[1] + v[2]*v[2]);
+}
+
+/* rows of r are east, north and up in device coordinates */
+static void matrix_to_quat(const float r[3][3], float *q)
+{
+    float t = r[0][0] + r[1][1] + r[2][2];
+    float s;
+    if (t > 0.0f) {
+        s = 0.5f / sqrtf(t + 1.0f);
+        q[0] = 0.25f / s;
+        q[1] = (r[2][1] - r[1][2]) * s;
+        q[2] = (r[0][2] - r[2][0]) * s;
+        q[3] = (r[1][0] - r[0][1]) * s;
+    } else if (r[0][0] > r[1][1] && r[0][0] > r[2][2]) {
+        s = 0.5f / sqrtf(1.0f + r[0][0] - r[1][1] - r[2][2]);
+        q[0] = (r[2][1] - r[1][2]) * s;
+        q[1] = 0.25f / s;
+        q[2] = (r[0][1] + r[1][0]) * s;
+        q[3] = (r[0][2] + r[2][0]) * s;
+    } else if (r[1][1] > r[2][2]) {
+        s = 0.5f / sqrtf(1.0f + r[1][1] - r[0][0] - r[2][2]);
+        q[0] = (r[0][2] - r[2][0]) * s;
+        q[1] = (r[0][1] + r[1][0]) * s;
+        q[2] = 0.25f / s;
+        q[3] = (r[1][2] + r[2][1]) * s;
+    } else {
+        s = 0.5f / sqrtf(1.0f + r[2][2] - r[0][0] - r[1][1]);
+        q[0] = (r[1][0] - r[0][1]) * s;
+        q[1] = (r[0][2] + r[2][0]) * s;
+        q[2] = (r[1][2] + r[2][1]) * s;
+        q[3] = 0.25f / s;
+    }
+}
+
+int sensors_fusion_update(struct sensors_fusion_t *fusion,
+        const float *a, const float *m, int64_t time)
+{
+    float r[3][3];
+    float q[4];
+    float n;
+    int i;
+
+    // east = m x a, north = a x east
+    r[0][0] = m[1]*a[2] - m[2]*a[1];
+    r[0][1] = m[2]*a[0] - m[0]*a[2];
+    r[0][2] = m[0]*a[1] - m[1]*a[0];
+    n = r[0][0]*r[0][0] + r[0][1]*r[0][1] + r[0][2]*r[0][2];
+    if (n < FUSION_MIN_H * FUSION_MIN_H)
+        return -1;
+    n = a[0]*a[0] + a[1]*a[1] + a[2]*a[2];
+    if (n < FUSION_MIN_A * FUSION_MIN_A)
+        return -1;
+
+    n = inv_norm(r[0]);
+    for (i = 0; i < 3; i++)
+        r[0][i] *= n;
+    n = inv_norm(a);
+    for (i = 0; i < 3; i++)
+        r[2][i] = a[i] * n;
+    r[1][0] = r[2][1]*r[0][2] - r[2][2]*r[0][1];
+    r[1][1] = r[2][2]*r[0][0] - r[2][0]*r[0][2];
+    r[1][2] = r[2][0]*r[0][1] - r[2][1]*r[0][0];
+
+    matrix_to_quat(r, q);
+
+    int64_t dt = time - fusion->time;
+    if (fusion->valid && dt > 0 && dt < FUSION_MAX_GAP_NS) {
+        /*
+         * The weight of the new attitude costs a float division, the
+         * normalization below a square root; sensors_fusion_bench has
+         * what a whole update costs. q and -q are the same attitude,
+         * blend towards the closest one.
+         */
+        float alpha = (float)dt / (float)(dt + FUSION_TAU_NS);
+        float dot = 0.0f;
+        for (i = 0; i < 4; i++)
+            dot += fusion->q[i] * q[i];
+        if (dot < 0.0f)
+            alpha = -alpha;
+        n = 0.0f;
+        for (i = 0; i < 4; i++) {
+            q[i] = fusion->q[i] + (q[i] * alpha - fusion->q[i] * fabsf(alpha));
+            n += q[i] * q[i];
+        }
+        n = 1.0f / sqrtf(n);
+        for (i = 0; i < 4; i++)
+            q[i] *= n;
+    }
+
+    memcpy(fusion->q, q, sizeof(q));
+    fusion->time = time;
+    fusion->valid = 1;
+    return 0;
+}
+
+void sensors_fusion_get_orientation(const struct sensors_fusion_t *fusion,
+        float *orientation)
+{
+    const float w = fusion->q[0], x = fusion->q[1];
+    const float y = fusion->q[2], z = fusion->q[3];
+
+    // the rotation matrix elements we need, see matrix_to_quat()
+    float r01 = 2.0f * (x*y - w*z);
+    float r11 = 1.0f - 2.0f * (x*x + z*z);
+    float r20 = 2.0f * (x*z - w*y);
+    float r21 = 2.0f * (y*z + w*x);
+    float r22 = 1.0f - 2.0f * (x*x + y*y);
+
+    if (r20 > 1.0f)
+        r20 = 1.0f;
+    else if (r20 < -1.0f)
+        r20 = -1.0f;
+
+    orientation[0] = atan2f(r01, r11) * RAD2DEG;
+    if (orientation[0] < 0.0f)
+        orientation[0] += 360.0f;
+    orientation[1] = atan2f(-r21, r22) * RAD2DEG;
+    orientation[2] = asinf(r20) * RAD2DEG;
+}
+
+void sensors_fusion_get_rotation_vector(const struct sensors_fusion_t *fusion,
+        float *v)
+{
+    // the fourth component is implied and must be positive
+    float sign = fusion->q[0] < 0.0f ? -1.0f : 1.0f;
+    v[0] = fusion->q[1] * sign;
+    v[1] = fusion->q[2] * sign;
+    v[2] = fusion->q[3] * sign;
+}
+
+void sensors_gravity_init(struct sensors_gravity_t *gravity)
+{
+    memset(gravity, 0, sizeof(*gravity));
+}
+
+void sensors_gravity_update(struct sensors_gravity_t *gravity,
+        const float *a, int64_t time)
+{
+    int64_t dt = time - gravity->time;
+    int i;
+    if (gravity->valid && dt > 0 && dt < FUSION_MAX_GAP_NS) {
+        float alpha = (float)dt / (float)(dt + GRAVITY_TAU_NS);
+        for (i = 0; i < 3; i++)
+            gravity->g[i] += (a[i] - gravity->g[i]) * alpha;
+    } else {
+        for (i = 0; i < 3; i++)
+            gravity->g[i] = a[i];
+    }
+    gravity->time = time;
+    gravity->valid = 1;
+}
+
+void sensors_step_init(struct sensors_step_t *step)
+{
+    memset(step, 0, sizeof(*step));
+}
+
+int sensors_step_update(struct sensors_step_t *step,
+        const float *a, int64_t time)
+{
+    float m = sqrtf(a[0]*a[0] + a[1]*a[1] + a[2]*a[2]);
+    int64_t dt = time - step->time;
+    int steps = 0;
+
+    step->time = time;
+    if (!step->valid || dt <= 0 || dt >= FUSION_MAX_GAP_NS) {
+        step->mean = m;
+        step->smooth = 0.0f;
+        step->rising = 0;
+        step->run = 0;
+        step->valid = 1;
+        return 0;
+    }
+    step->mean += (m - step->mean) * (float)dt / (float)(dt + STEP_MEAN_TAU_NS);
+    step->smooth += (m - step->mean - step->smooth) *
+            (float)dt / (float)(dt + STEP_SMOOTH_TAU_NS);
+
+    if (!step->rising) {
+        if (step->smooth > STEP_PEAK)
+            step->rising = 1;
+        return 0;
+    }
+    if (step->smooth > STEP_TROUGH)
+        return 0;
+    step->rising = 0;
+
+    int64_t interval = time - step->last_step;
+    if (interval < STEP_MIN_INTERVAL_NS)
+        return 0;
+    // a run keeps to its rhythm, give or take half an interval
+    if (interval > STEP_MAX_INTERVAL_NS || (step->run > 1 &&
+            (interval > step->interval * 3 / 2 ||
+             interval < step->interval / 2)))
+        step->run = 0;
+    step->interval = interval;
+    step->last_step = time;
+    step->run++;
+    if (step->run == STEP_MIN_RUN)
+        steps = STEP_MIN_RUN;
+    else if (step->run > STEP_MIN_RUN)
+        steps = 1;
+    return steps;
+}
+
+void sensors_motion_init(struct sensors_motion_t *motion)
+{
+    memset(motion, 0, sizeof(*motion));
+}
+
+int sensors_motion_update(struct sensors_motion_t *motion,
+        const float *a, int64_t time)
+{
+    int64_t dt = time - motion->time;
+    float d[3];
+    int i;
+
+    motion->time = time;
+    if (!motion->valid || dt <= 0) {
+        for (i = 0; i < 3; i++)
+            motion->rest[i] = a[i];
+        motion->hits = 0;
+        motion->valid = 1;
+        return 0;
+    }
+    for (i = 0; i < 3; i++)
+        d[i] = a[i] - motion->rest[i];
+    // a new resting position is taken over slowly, so a motion stands out
+    float alpha = dt < MOTION_REST_TAU_NS ?
+            (float)dt / (float)(dt + MOTION_REST_TAU_NS) : 1.0f;
+    for (i = 0; i < 3; i++)
+        motion->rest[i] += d[i] * alpha;
+
+    if (d[0]*d[0] + d[1]*d[1] + d[2]*d[2] < MOTION_THRESHOLD2)
+        return 0;
+    if (!motion->hits || time - motion->first_hit > MOTION_WINDOW_NS) {
+        motion->hits = 0;
+        motion->first_hit = time;
+    }
+    return ++motion->hits >= MOTION_MIN_HITS;
+}
+
+void sensors_fusion_compare(struct sensors_fusion_error_t *error,
+        const float *orientation, const float *reference)
+{
+    int i;
+    for (i = 0; i < 3; i++) {
+        float e = fabsf(orientation[i] - reference[i]);
+        // azimuth and pitch wrap around
+        if (e > 180.0f)
+            e = 360.0f - e;
+        error->sum[i] += e;
+        if (e > error->max[i])
+            error->max[i] = e;
+    }
+    error->count++;
+}
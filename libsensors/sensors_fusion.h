@@ -0,0 +1,144 @@
+/*
+ * Copyright (C) 2010 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_SENSORS_FUSION_H
+#define ANDROID_SENSORS_FUSION_H
+
+#include <stdint.h>
+#include <sys/cdefs.h>
+
+__BEGIN_DECLS
+
+/*
+ * Attitude of the device computed from the accelerometer and the
+ * magnetometer, the way SensorManager.getRotationMatrix() does, and
+ * smoothed in quaternion space by a first order low-pass filter.
+ *
+ * The attitude rotates device coordinates to world coordinates: x points
+ * east, y points to the magnetic north and z points up.
+ */
+struct sensors_fusion_t {
+    /* w, x, y, z */
+    float q[4];
+    int64_t time;
+    int valid;
+};
+
+void sensors_fusion_init(struct sensors_fusion_t *fusion);
+
+/*
+ * Update the attitude with an acceleration (m/s^2) and a magnetic field
+ * (uT) measured at 'time' (ns). Returns -1 and leaves the attitude alone
+ * when they can't give one, e.g. in free fall or close to a magnet.
+ */
+int sensors_fusion_update(struct sensors_fusion_t *fusion,
+        const float *accel, const float *mag, int64_t time);
+
+/* azimuth, pitch and roll in degrees, like SENSOR_TYPE_ORIENTATION */
+void sensors_fusion_get_orientation(const struct sensors_fusion_t *fusion,
+        float *orientation);
+
+/* x, y and z of the attitude quaternion, like SENSOR_TYPE_ROTATION_VECTOR */
+void sensors_fusion_get_rotation_vector(const struct sensors_fusion_t *fusion,
+        float *v);
+
+/*
+ * Gravity separated from the rest of the acceleration by a first order
+ * low-pass filter.
+ */
+struct sensors_gravity_t {
+    float g[3];
+    int64_t time;
+    int valid;
+};
+
+void sensors_gravity_init(struct sensors_gravity_t *gravity);
+
+/* update the gravity with an acceleration (m/s^2) measured at 'time' (ns) */
+void sensors_gravity_update(struct sensors_gravity_t *gravity,
+        const float *accel, int64_t time);
+
+/*
+ * Steps found in the magnitude of the acceleration: a step is a peak
+ * above its running average followed by a trough below it. A few steps
+ * in a row, at a walking pace and in rhythm, are needed before any is
+ * counted, so handling the device isn't taken for walking.
+ */
+struct sensors_step_t {
+    /* running average of |a| and |a| minus it, low-passed (m/s^2) */
+    float mean;
+    float smooth;
+    int64_t time;
+    int valid;
+    /* the last peak hasn't been followed by its trough yet */
+    int rising;
+    int64_t last_step;
+    int64_t interval;
+    /* steps found in a row, not counted yet while below the minimum */
+    int run;
+};
+
+void sensors_step_init(struct sensors_step_t *step);
+
+/*
+ * Update the step detector with an acceleration (m/s^2) measured at
+ * 'time' (ns). Returns the number of steps to count now: 0, 1, or more
+ * when a run of steps just got long enough to be believed.
+ */
+int sensors_step_update(struct sensors_step_t *step,
+        const float *accel, int64_t time);
+
+/*
+ * Significant motion: the acceleration straying from where it has been
+ * resting, by a tilt or a push, on enough samples close together that a
+ * single knock on the table doesn't count. It only needs a few samples a
+ * second.
+ */
+struct sensors_motion_t {
+    /* where the acceleration has been resting (m/s^2) */
+    float rest[3];
+    int64_t time;
+    int valid;
+    /* samples away from rest, and when the first of them was taken */
+    int hits;
+    int64_t first_hit;
+};
+
+void sensors_motion_init(struct sensors_motion_t *motion);
+
+/*
+ * Update the motion detector with an acceleration (m/s^2) measured at
+ * 'time' (ns). Returns 1 when the motion is significant.
+ */
+int sensors_motion_update(struct sensors_motion_t *motion,
+        const float *accel, int64_t time);
+
+/*
+ * How far the fused orientation is from a reference one (akmd's), for
+ * azimuth, pitch and roll, in degrees.
+ */
+struct sensors_fusion_error_t {
+    uint32_t count;
+    float sum[3];
+    float max[3];
+};
+
+void sensors_fusion_compare(struct sensors_fusion_error_t *error,
+        const float *orientation, const float *reference);
+
+__END_DECLS
+
+#endif  // ANDROID_SENSORS_FUSION_H
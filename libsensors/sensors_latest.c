@@ -0,0 +1,75 @@
+/*
+ * Copyright (C) 2010 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "Sensors"
+
+#include <errno.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#include <cutils/atomic.h>
+#include <cutils/log.h>
+
+#include "sensors_latest.h"
+
+/*****************************************************************************/
+
+// a reader gives up after that many writes got in its way
+#define LATEST_MAX_RETRIES  16
+
+#define LATEST_SIZE     (SENSORS_LATEST_MAX * sizeof(struct sensors_latest_t))
+
+struct sensors_latest_t *sensors_latest_map(const native_handle_t *handle)
+{
+    if (handle->numFds <= SENSORS_LATEST_FD_INDEX) {
+        LOGE("No shared state in the data source");
+        return NULL;
+    }
+    void *p = mmap(NULL, LATEST_SIZE, PROT_READ, MAP_SHARED,
+                   handle->data[SENSORS_LATEST_FD_INDEX], 0);
+    if (p == MAP_FAILED) {
+        LOGE("Couldn't map the latest values (%s)", strerror(errno));
+        return NULL;
+    }
+    return p;
+}
+
+void sensors_latest_unmap(struct sensors_latest_t *latest)
+{
+    if (latest)
+        munmap(latest, LATEST_SIZE);
+}
+
+int sensors_latest_read(const struct sensors_latest_t *latest, int handle,
+        sensors_data_t *data)
+{
+    int i;
+    if ((handle < SENSORS_HANDLE_BASE) ||
+            (handle >= SENSORS_HANDLE_BASE+SENSORS_LATEST_MAX))
+        return -EINVAL;
+    latest += handle - SENSORS_HANDLE_BASE;
+    for (i = 0; i < LATEST_MAX_RETRIES; i++) {
+        int32_t seq = android_atomic_acquire_load(&latest->seq);
+        if (!seq)
+            return -ENODATA;
+        if (seq & 1)
+            continue;
+        *data = latest->data;
+        if (android_atomic_release_load(&latest->seq) == seq)
+            return 0;
+    }
+    return -EAGAIN;
+}
@@ -0,0 +1,72 @@
+/*
+ * Copyright (C) 2010 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_SENSORS_LATEST_H
+#define ANDROID_SENSORS_LATEST_H
+
+#include <stdint.h>
+#include <sys/cdefs.h>
+
+#include <cutils/native_handle.h>
+#include <hardware/sensors.h>
+
+__BEGIN_DECLS
+
+/*
+ * The latest value of every sensor, as decoded by the data devices of the
+ * process of the control device whether or not poll() returned it: they
+ * are the only ones that can write them, so the values only move while
+ * one of them polls. They head the state the control device shares with
+ * its data devices, so any process holding a data source handle can map
+ * them read-only and read them without waking anybody up. In the process
+ * of the control device, get_latest() reads the same values.
+ */
+
+/* index of the shared state in the data source handle */
+#define SENSORS_LATEST_FD_INDEX 4
+
+/* values for the handles SENSORS_HANDLE_BASE and up */
+#define SENSORS_LATEST_MAX      16
+
+/*
+ * The latest value of a sensor, under a seqlock: seq is odd while a data
+ * device writes it and is bumped again when it is done, so a reader that
+ * sees the same even seq before and after copying the value knows it
+ * isn't torn. 0 means there has been no value yet.
+ */
+struct sensors_latest_t {
+    volatile int32_t seq;
+    sensors_data_t data;
+} __attribute__((aligned(64)));
+
+/*
+ * Map the values of the data source 'handle', which stays the caller's.
+ * Returns NULL if the handle has no shared state or it can't be mapped.
+ */
+struct sensors_latest_t *sensors_latest_map(const native_handle_t *handle);
+void sensors_latest_unmap(struct sensors_latest_t *latest);
+
+/*
+ * Read the value of the sensor 'handle'. Returns 0 on success, -ENODATA
+ * if there is no value yet, -EAGAIN if the value kept changing while it
+ * was read, or -EINVAL.
+ */
+int sensors_latest_read(const struct sensors_latest_t *latest, int handle,
+        sensors_data_t *data);
+
+__END_DECLS
+
+#endif  // ANDROID_SENSORS_LATEST_H
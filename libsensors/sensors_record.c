@@ -0,0 +1,431 @@
+/*
+ * Copyright (C) 2010 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "Sensors"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <sys/ioctl.h>
+#include <sys/time.h>
+#include <sys/uio.h>
+
+#include <cutils/log.h>
+
+#include "sensors_record.h"
+
+/*****************************************************************************/
+
+#define ARRAY_SIZE(a) (sizeof(a) / sizeof(a[0]))
+
+#define BITS_PER_LONG           (sizeof(long) * 8)
+#define test_bit(bit, array) \
+        ((array)[(bit) / BITS_PER_LONG] & (1UL << ((bit) % BITS_PER_LONG)))
+
+#define REPLAY_MAX_DEVICES      8
+
+// largest chunk we replay, keeps every write to the pipes atomic
+#define REPLAY_MAX_EVENTS       64
+
+// latency histogram, the last bucket catches everything above
+#define LATENCY_BUCKET_NS       50000LL
+#define LATENCY_BUCKETS         1000
+
+struct sensors_recorder_t {
+    int fd;
+};
+
+struct sensors_replay_t {
+    int file_fd;
+    int realtime;
+    int count;
+    int fds[REPLAY_MAX_DEVICES];
+    uint32_t num_axes[REPLAY_MAX_DEVICES];
+    struct sensors_record_axis_t axes[REPLAY_MAX_DEVICES][ABS_MAX + 1];
+    int stop_fd;
+    pthread_t thread;
+    int64_t thread_cpu_ns;
+    int64_t start_ns;
+    int64_t start_cpu_ns;
+    uint64_t samples;
+    int64_t max_latency_ns;
+    uint32_t histogram[LATENCY_BUCKETS];
+};
+
+static int64_t now_ns(clockid_t clock)
+{
+    struct timespec t;
+    clock_gettime(clock, &t);
+    return t.tv_sec*1000000000LL + t.tv_nsec;
+}
+
+static int write_all(int fd, const void *buf, size_t size)
+{
+    const char *p = buf;
+    while (size) {
+        ssize_t n = write(fd, p, size);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            return -errno;
+        }
+        p += n;
+        size -= n;
+    }
+    return 0;
+}
+
+static int read_all(int fd, void *buf, size_t size)
+{
+    char *p = buf;
+    while (size) {
+        ssize_t n = read(fd, p, size);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return -1;
+        p += n;
+        size -= n;
+    }
+    return 0;
+}
+
+/*****************************************************************************/
+
+static int record_device(int fd, int input_fd, const char *name)
+{
+    unsigned long bits[(ABS_MAX + BITS_PER_LONG) / BITS_PER_LONG];
+    struct sensors_record_axis_t axes[ABS_MAX + 1];
+    struct sensors_record_device_t device;
+    int code;
+
+    memset(&device, 0, sizeof(device));
+    strncpy(device.name, name, sizeof(device.name) - 1);
+
+    memset(bits, 0, sizeof(bits));
+    if (input_fd >= 0)
+        ioctl(input_fd, EVIOCGBIT(EV_ABS, sizeof(bits)), bits);
+    for (code = 0; code <= ABS_MAX; code++) {
+        struct sensors_record_axis_t *axis = &axes[device.num_axes];
+        if (!test_bit(code, bits))
+            continue;
+        if (ioctl(input_fd, EVIOCGABS(code), &axis->absinfo))
+            continue;
+        axis->code = code;
+        device.num_axes++;
+    }
+
+    if (write_all(fd, &device, sizeof(device)) < 0)
+        return -1;
+    return write_all(fd, axes, device.num_axes * sizeof(axes[0]));
+}
+
+struct sensors_recorder_t *sensors_record_open(const char *path,
+        const int *fds, const char * const *names, int count)
+{
+    struct sensors_record_header_t header = {
+        .magic = SENSORS_RECORD_MAGIC,
+        .version = SENSORS_RECORD_VERSION,
+        .num_devices = count,
+    };
+    struct sensors_recorder_t *rec;
+    int i;
+
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+    if (fd < 0) {
+        LOGE("Couldn't create recording %s (%s)", path, strerror(errno));
+        return NULL;
+    }
+    if (write_all(fd, &header, sizeof(header)) < 0)
+        goto error;
+    for (i = 0; i < count; i++) {
+        if (record_device(fd, fds[i], names[i]) < 0)
+            goto error;
+    }
+
+    rec = malloc(sizeof(*rec));
+    if (!rec)
+        goto error;
+    rec->fd = fd;
+    LOGI("recording sensor events to %s", path);
+    return rec;
+
+error:
+    LOGE("Couldn't write recording %s (%s)", path, strerror(errno));
+    close(fd);
+    return NULL;
+}
+
+void sensors_record_events(struct sensors_recorder_t *rec, int device,
+        const struct input_event *events, int count)
+{
+    struct sensors_record_chunk_t chunk = {
+        .device = device,
+        .count = count,
+    };
+    struct iovec iov[2] = {
+        { .iov_base = &chunk, .iov_len = sizeof(chunk) },
+        { .iov_base = (void *)events, .iov_len = count * sizeof(*events) },
+    };
+    if (writev(rec->fd, iov, 2) < 0)
+        LOGE("Couldn't record events (%s)", strerror(errno));
+}
+
+void sensors_record_close(struct sensors_recorder_t *rec)
+{
+    close(rec->fd);
+    free(rec);
+}
+
+/*****************************************************************************/
+
+static void *replay_thread(void *arg)
+{
+    struct sensors_replay_t *replay = arg;
+    struct sensors_record_chunk_t chunk;
+    struct input_event events[REPLAY_MAX_EVENTS];
+    int64_t start = now_ns(CLOCK_MONOTONIC);
+    int64_t first = -1;
+    sigset_t sigs;
+
+    // a closed data source must fail our writes, not kill the process
+    sigemptyset(&sigs);
+    sigaddset(&sigs, SIGPIPE);
+    pthread_sigmask(SIG_BLOCK, &sigs, NULL);
+
+    while (!read_all(replay->file_fd, &chunk, sizeof(chunk))) {
+        size_t size = chunk.count * sizeof(events[0]);
+        uint32_t i;
+
+        if (chunk.count > ARRAY_SIZE(events)) {
+            LOGE("replay: corrupted recording (chunk of %u events)",
+                 chunk.count);
+            break;
+        }
+        if (read_all(replay->file_fd, events, size))
+            break;
+        if (chunk.device >= (uint32_t)replay->count || !chunk.count)
+            continue;
+
+        struct pollfd pfd[2] = {
+            { .fd = replay->stop_fd, .events = POLLIN },
+            { .fd = replay->fds[chunk.device], .events = POLLOUT },
+        };
+        int timeout = 0;
+        if (replay->realtime) {
+            int64_t t = events[0].time.tv_sec*1000000000LL +
+                events[0].time.tv_usec*1000;
+            if (first < 0)
+                first = t;
+            int64_t delay = start + (t - first) - now_ns(CLOCK_MONOTONIC);
+            if (delay > 0)
+                timeout = (delay + 999999) / 1000000;
+        }
+        if (poll(pfd, 1, timeout) > 0)
+            break;
+        // wait for room in the pipe here rather than in write(), so that
+        // sensors_replay_close() can stop us when nobody reads anymore
+        int ready;
+        do {
+            ready = poll(pfd, 2, -1);
+        } while (ready < 0 && errno == EINTR);
+        if (ready < 0 || pfd[0].revents)
+            break;
+
+        // stamp the events like the input device would have
+        struct timeval now;
+        gettimeofday(&now, NULL);
+        for (i = 0; i < chunk.count; i++)
+            events[i].time = now;
+        if (write_all(replay->fds[chunk.device], events, size) < 0)
+            break;
+    }
+
+    LOGI("replay: end of recording");
+    replay->thread_cpu_ns = now_ns(CLOCK_THREAD_CPUTIME_ID);
+    return NULL;
+}
+
+struct sensors_replay_t *sensors_replay_open(const char *path, int realtime,
+        int *fds, int count)
+{
+    struct sensors_record_header_t header;
+    struct sensors_replay_t *replay;
+    uint32_t i;
+
+    if (count > REPLAY_MAX_DEVICES)
+        return NULL;
+
+    replay = calloc(1, sizeof(*replay));
+    if (!replay)
+        return NULL;
+    replay->realtime = realtime;
+    replay->count = count;
+    replay->stop_fd = -1;
+    for (i = 0; i < (uint32_t)count; i++)
+        fds[i] = replay->fds[i] = -1;
+
+    replay->file_fd = open(path, O_RDONLY);
+    if (replay->file_fd < 0) {
+        LOGE("Couldn't open recording %s (%s)", path, strerror(errno));
+        goto error;
+    }
+    if (read_all(replay->file_fd, &header, sizeof(header)) ||
+            header.magic != SENSORS_RECORD_MAGIC ||
+            header.version != SENSORS_RECORD_VERSION) {
+        LOGE("%s is not a sensors recording", path);
+        goto error;
+    }
+    for (i = 0; i < header.num_devices; i++) {
+        struct sensors_record_device_t device;
+        if (read_all(replay->file_fd, &device, sizeof(device)))
+            goto error;
+        LOGV("replay: device %u is '%s'", i, device.name);
+        if (device.num_axes > ABS_MAX + 1)
+            goto error;
+        // keep the axes of the devices we replay, skip the others
+        if (i < (uint32_t)count) {
+            if (read_all(replay->file_fd, replay->axes[i],
+                         device.num_axes * sizeof(replay->axes[i][0])))
+                goto error;
+            replay->num_axes[i] = device.num_axes;
+        } else {
+            lseek(replay->file_fd,
+                  device.num_axes * sizeof(struct sensors_record_axis_t),
+                  SEEK_CUR);
+        }
+    }
+
+    for (i = 0; i < (uint32_t)count; i++) {
+        int p[2];
+        if (pipe(p) < 0)
+            goto error;
+        fds[i] = p[0];
+        replay->fds[i] = p[1];
+    }
+    replay->stop_fd = eventfd(0, 0);
+    if (replay->stop_fd < 0)
+        goto error;
+
+    replay->start_ns = now_ns(CLOCK_MONOTONIC);
+    replay->start_cpu_ns = now_ns(CLOCK_PROCESS_CPUTIME_ID);
+    if (pthread_create(&replay->thread, NULL, replay_thread, replay))
+        goto error;
+
+    LOGI("replaying sensor events from %s", path);
+    return replay;
+
+error:
+    for (i = 0; i < (uint32_t)count; i++) {
+        if (fds[i] >= 0)
+            close(fds[i]);
+        if (replay->fds[i] >= 0)
+            close(replay->fds[i]);
+        fds[i] = -1;
+    }
+    if (replay->stop_fd >= 0)
+        close(replay->stop_fd);
+    if (replay->file_fd >= 0)
+        close(replay->file_fd);
+    free(replay);
+    return NULL;
+}
+
+int sensors_replay_get_absinfo(struct sensors_replay_t *replay, int device,
+        int code, struct input_absinfo *absinfo)
+{
+    uint32_t i;
+    if (device < 0 || device >= replay->count)
+        return -1;
+    for (i = 0; i < replay->num_axes[device]; i++) {
+        if (replay->axes[device][i].code == (uint32_t)code) {
+            *absinfo = replay->axes[device][i].absinfo;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+void sensors_replay_account(struct sensors_replay_t *replay,
+        int64_t latency_ns)
+{
+    int64_t bucket;
+    if (latency_ns < 0)
+        latency_ns = 0;
+    bucket = latency_ns / LATENCY_BUCKET_NS;
+    if (bucket >= LATENCY_BUCKETS)
+        bucket = LATENCY_BUCKETS - 1;
+    replay->histogram[bucket]++;
+    replay->samples++;
+    if (latency_ns > replay->max_latency_ns)
+        replay->max_latency_ns = latency_ns;
+}
+
+/* upper bound of the bucket holding the given percentile, in us */
+static int64_t replay_percentile(struct sensors_replay_t *replay, int percent)
+{
+    uint64_t wanted = (replay->samples * percent + 99) / 100;
+    uint64_t seen = 0;
+    int i;
+    for (i = 0; i < LATENCY_BUCKETS; i++) {
+        seen += replay->histogram[i];
+        if (seen >= wanted)
+            break;
+    }
+    if (i >= LATENCY_BUCKETS - 1 ||
+            (i + 1) * LATENCY_BUCKET_NS > replay->max_latency_ns)
+        return replay->max_latency_ns / 1000;
+    return (i + 1) * LATENCY_BUCKET_NS / 1000;
+}
+
+void sensors_replay_close(struct sensors_replay_t *replay)
+{
+    uint64_t one = 1;
+    int i;
+
+    // the thread writes to the pipes until it is joined
+    write(replay->stop_fd, &one, sizeof(one));
+    pthread_join(replay->thread, NULL);
+    for (i = 0; i < replay->count; i++)
+        close(replay->fds[i]);
+
+    int64_t elapsed = now_ns(CLOCK_MONOTONIC) - replay->start_ns;
+    int64_t cpu = now_ns(CLOCK_PROCESS_CPUTIME_ID) - replay->start_cpu_ns -
+            replay->thread_cpu_ns;
+    uint64_t samples = replay->samples ? replay->samples : 1;
+
+    LOGI("replay: %llu samples in %lld ms, %lld samples/s, "
+         "%lld ns of cpu per sample",
+         (unsigned long long)replay->samples, (long long)(elapsed / 1000000),
+         (long long)(replay->samples * 1000000000LL / (elapsed ? elapsed : 1)),
+         (long long)(cpu / (int64_t)samples));
+    LOGI("replay: latency p50 %lld us, p90 %lld us, p99 %lld us, max %lld us",
+         (long long)replay_percentile(replay, 50),
+         (long long)replay_percentile(replay, 90),
+         (long long)replay_percentile(replay, 99),
+         (long long)(replay->max_latency_ns / 1000));
+
+    close(replay->stop_fd);
+    close(replay->file_fd);
+    free(replay);
+}
@@ -0,0 +1,110 @@
+/*
+ * Copyright (C) 2010 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_SENSORS_RECORD_H
+#define ANDROID_SENSORS_RECORD_H
+
+#include <stdint.h>
+#include <sys/cdefs.h>
+
+#include <linux/input.h>
+
+__BEGIN_DECLS
+
+/*
+ * Recordings of the raw input device streams the sensors HAL reads.
+ *
+ * On debuggable builds ("ro.debuggable" is "1") only: when
+ * "debug.sensors.record" names a file, every data device writes everything
+ * it reads from the input devices to "<file>.<pid>". When
+ * "debug.sensors.replay" names a recording, the data device reads from it
+ * instead of the input devices, so the whole HAL can be exercised without
+ * the sensors.
+ *
+ * A recording is made of:
+ *
+ *   struct sensors_record_header_t
+ *   num_devices times:
+ *       struct sensors_record_device_t
+ *       num_axes times struct sensors_record_axis_t
+ *   any number of:
+ *       struct sensors_record_chunk_t
+ *       count times struct input_event
+ *
+ * A chunk is what one read() returned. Everything is in the native byte
+ * order and layout of the device that made the recording.
+ */
+
+#define SENSORS_RECORD_MAGIC        0x43455253  /* "SREC" */
+#define SENSORS_RECORD_VERSION      1
+
+struct sensors_record_header_t {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t num_devices;
+};
+
+struct sensors_record_device_t {
+    /* EVIOCGNAME of the input device */
+    char name[80];
+    uint32_t num_axes;
+};
+
+/* the absinfo of every ABS axis of a device when the recording started */
+struct sensors_record_axis_t {
+    uint32_t code;
+    struct input_absinfo absinfo;
+};
+
+struct sensors_record_chunk_t {
+    uint32_t device;
+    uint32_t count;
+};
+
+/*****************************************************************************/
+
+struct sensors_recorder_t;
+struct sensors_replay_t;
+
+struct sensors_recorder_t *sensors_record_open(const char *path,
+        const int *fds, const char * const *names, int count);
+void sensors_record_events(struct sensors_recorder_t *rec, int device,
+        const struct input_event *events, int count);
+void sensors_record_close(struct sensors_recorder_t *rec);
+
+/*
+ * Start replaying a recording. fds[] receives one fd per recorded device
+ * that reads like the input device did. With 'realtime' the events are
+ * paced like they were recorded, otherwise they are sent as fast as they
+ * are read. Events are stamped with the time they are replayed at.
+ */
+struct sensors_replay_t *sensors_replay_open(const char *path, int realtime,
+        int *fds, int count);
+/*
+ * Get the absinfo the recorded device had for the ABS axis 'code', like
+ * EVIOCGABS. Returns 0 or -1 if the axis wasn't recorded.
+ */
+int sensors_replay_get_absinfo(struct sensors_replay_t *replay, int device,
+        int code, struct input_absinfo *absinfo);
+/* account for a sample returned by poll() 'latency_ns' after it was taken */
+void sensors_replay_account(struct sensors_replay_t *replay,
+        int64_t latency_ns);
+/* stop the replay and log throughput, latency and CPU use */
+void sensors_replay_close(struct sensors_replay_t *replay);
+
+__END_DECLS
+
+#endif  // ANDROID_SENSORS_RECORD_H
@@ -0,0 +1,65 @@
+# Copyright (C) 2010 The Android Open Source Project
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#      http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+
+# Host builds of the sensors HAL, no Bravo needed: each test includes
+# sensors.c through sensors_host.h and builds against the stand-in headers
+# in include/, see sensors_host.h.
+
+LOCAL_PATH := $(call my-dir)
+
+ifeq ($(HOST_OS),linux)
+
+sensors_host_tests := \
+    sensors_backend_test \
+    sensors_batch_test \
+    sensors_channel_test \
+    sensors_convert_bench \
+    sensors_decode_bench \
+    sensors_delay_test \
+    sensors_driver_test \
+    sensors_frame_test \
+    sensors_fusion_bench \
+    sensors_grace_test \
+    sensors_gravity_test \
+    sensors_input_cache_test \
+    sensors_latest_bench \
+    sensors_light_test \
+    sensors_merge_bench \
+    sensors_motion_bench \
+    sensors_motion_test \
+    sensors_poll_bench \
+    sensors_poll_test \
+    sensors_reader_test \
+    sensors_replay_bench \
+    sensors_shared_test \
+    sensors_snapshot_test \
+    sensors_step_rate_test \
+    sensors_timestamp_test
+
+define sensors-host-test
+include $(CLEAR_VARS)
+LOCAL_MODULE := $(1)
+LOCAL_MODULE_TAGS := tests
+LOCAL_SRC_FILES := $(1).c \
+                   ../sensors_channel.c ../sensors_fusion.c \
+                   ../sensors_latest.c ../sensors_record.c
+LOCAL_C_INCLUDES := $(LOCAL_PATH)/include
+LOCAL_CFLAGS := -D_GNU_SOURCE
+LOCAL_LDLIBS := -lm -lpthread -lrt
+include $(BUILD_HOST_EXECUTABLE)
+endef
+
+$(foreach test,$(sensors_host_tests),$(eval $(call sensors-host-test,$(test))))
+
+endif # HOST_OS == linux
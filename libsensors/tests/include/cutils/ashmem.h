@@ -0,0 +1,62 @@
+/*
+ * Copyright (C) 2010 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+/*
+ * Host stand-in: a region is an unlinked temporary file, which maps and
+ * passes between processes the same way.
+ */
+
+#ifndef _CUTILS_ASHMEM_H
+#define _CUTILS_ASHMEM_H
+
+#include <limits.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+static inline int ashmem_create_region(const char *name, size_t size)
+{
+    char path[PATH_MAX];
+    const char *dir = getenv("TMPDIR");
+    int fd;
+
+    snprintf(path, sizeof(path), "%s/ashmem-XXXXXX", dir ? dir : "/tmp");
+    fd = mkstemp(path);
+    if (fd < 0)
+        return -1;
+    unlink(path);
+    if (ftruncate(fd, size) < 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+/*
+ * A file can't be made read-only for the mappings still to come, so this
+ * only checks the protection: the tests check which mappings the HAL asks
+ * for instead.
+ */
+static inline int ashmem_set_prot_region(int fd, int prot)
+{
+    (void)fd;
+    return prot & ~(PROT_READ | PROT_WRITE | PROT_EXEC) ? -1 : 0;
+}
+
+#endif // _CUTILS_ASHMEM_H
@@ -0,0 +1,90 @@
+/*
+ * Copyright (C) 2010 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+/* Host stand-in built on the GCC __sync builtins, all full barriers. */
+
+#ifndef ANDROID_CUTILS_ATOMIC_H
+#define ANDROID_CUTILS_ATOMIC_H
+
+#include <stdint.h>
+
+static inline int32_t android_atomic_acquire_load(volatile const int32_t* addr)
+{
+    int32_t value = *addr;
+    __sync_synchronize();
+    return value;
+}
+
+static inline int32_t android_atomic_release_load(volatile const int32_t* addr)
+{
+    __sync_synchronize();
+    return *addr;
+}
+
+static inline void android_atomic_acquire_store(int32_t value,
+                                                volatile int32_t* addr)
+{
+    *addr = value;
+    __sync_synchronize();
+}
+
+static inline void android_atomic_release_store(int32_t value,
+                                                volatile int32_t* addr)
+{
+    __sync_synchronize();
+    *addr = value;
+}
+
+static inline int32_t android_atomic_add(int32_t value, volatile int32_t* addr)
+{
+    return __sync_fetch_and_add(addr, value);
+}
+
+static inline int32_t android_atomic_inc(volatile int32_t* addr)
+{
+    return __sync_fetch_and_add(addr, 1);
+}
+
+static inline int32_t android_atomic_dec(volatile int32_t* addr)
+{
+    return __sync_fetch_and_sub(addr, 1);
+}
+
+static inline int32_t android_atomic_and(int32_t value, volatile int32_t* addr)
+{
+    return __sync_fetch_and_and(addr, value);
+}
+
+static inline int32_t android_atomic_or(int32_t value, volatile int32_t* addr)
+{
+    return __sync_fetch_and_or(addr, value);
+}
+
+/* 0 if *addr was oldvalue and is now newvalue, like the real ones */
+static inline int android_atomic_acquire_cas(int32_t oldvalue, int32_t newvalue,
+                                             volatile int32_t* addr)
+{
+    return !__sync_bool_compare_and_swap(addr, oldvalue, newvalue);
+}
+
+static inline int android_atomic_release_cas(int32_t oldvalue, int32_t newvalue,
+                                             volatile int32_t* addr)
+{
+    return !__sync_bool_compare_and_swap(addr, oldvalue, newvalue);
+}
+
+#endif // ANDROID_CUTILS_ATOMIC_H
@@ -0,0 +1,74 @@
+/*
+ * Copyright (C) 2010 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+/*
+ * Host stand-in: everything goes to stderr, LOGV only with LOG_NDEBUG 0.
+ * Like bionic's, these headers pull in what the HAL sources use without
+ * including it themselves.
+ */
+
+#ifndef _CUTILS_LOG_H
+#define _CUTILS_LOG_H
+
+#include <limits.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+
+#ifndef LOG_TAG
+#define LOG_TAG NULL
+#endif
+
+#ifndef LOG_NDEBUG
+#define LOG_NDEBUG 1
+#endif
+
+static inline void host_log(char priority, const char *tag,
+                            const char *fmt, ...)
+{
+    va_list args;
+    va_start(args, fmt);
+    fprintf(stderr, "%c/%s: ", priority, tag ? tag : "");
+    vfprintf(stderr, fmt, args);
+    fputc('\n', stderr);
+    va_end(args);
+}
+
+#define LOG_IF(priority, cond, ...) \
+    ((cond) ? host_log(priority, LOG_TAG, __VA_ARGS__) : (void)0)
+
+#if LOG_NDEBUG
+#define LOGV(...)           ((void)0)
+#define LOGV_IF(cond, ...)  ((void)0)
+#else
+#define LOGV(...)           LOG_IF('V', 1, __VA_ARGS__)
+#define LOGV_IF(cond, ...)  LOG_IF('V', cond, __VA_ARGS__)
+#endif
+#define LOGD(...)           LOG_IF('D', 1, __VA_ARGS__)
+#define LOGI(...)           LOG_IF('I', 1, __VA_ARGS__)
+#define LOGW(...)           LOG_IF('W', 1, __VA_ARGS__)
+#define LOGE(...)           LOG_IF('E', 1, __VA_ARGS__)
+#define LOGD_IF(cond, ...)  LOG_IF('D', cond, __VA_ARGS__)
+#define LOGI_IF(cond, ...)  LOG_IF('I', cond, __VA_ARGS__)
+#define LOGW_IF(cond, ...)  LOG_IF('W', cond, __VA_ARGS__)
+#define LOGE_IF(cond, ...)  LOG_IF('E', cond, __VA_ARGS__)
+
+#endif // _CUTILS_LOG_H
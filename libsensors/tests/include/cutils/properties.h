@@ -0,0 +1,51 @@
+/*
+ * Copyright (C) 2010 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+/*
+ * Host stand-in: the property "a.b.c" is read from the environment
+ * variable "a_b_c", so a test can set ro.debuggable and friends.
+ */
+
+#ifndef __CUTILS_PROPERTIES_H
+#define __CUTILS_PROPERTIES_H
+
+#include <stdlib.h>
+#include <string.h>
+
+#define PROPERTY_KEY_MAX   32
+#define PROPERTY_VALUE_MAX  92
+
+static inline int property_get(const char *key, char *value,
+                               const char *default_value)
+{
+    char name[PROPERTY_KEY_MAX];
+    const char *found;
+    size_t i;
+
+    for (i = 0; key[i] && i < sizeof(name) - 1; i++)
+        name[i] = key[i] == '.' ? '_' : key[i];
+    name[i] = 0;
+
+    found = getenv(name);
+    if (!found)
+        found = default_value ? default_value : "";
+    strncpy(value, found, PROPERTY_VALUE_MAX - 1);
+    value[PROPERTY_VALUE_MAX - 1] = 0;
+    return strlen(value);
+}
+
+#endif // __CUTILS_PROPERTIES_H
@@ -0,0 +1,109 @@
+/*
+ * Copyright (C) 2010 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Checks the exact ioctls an activation storm sends to the drivers, as
+ * the per-device enable functions the backend table replaced sent them:
+ * the flags read back once when a group is stale, then only the flags
+ * that change, in the order of the table, and the compass delay when the
+ * compass is (re)opened.
+ */
+
+#include "sensors_host.h"
+
+struct storm_step_t {
+    int id;
+    int enabled;
+};
+
+static const struct storm_step_t sStorm[] = {
+    { ID_A, 1 }, { ID_P, 1 }, { ID_L, 1 }, { ID_M, 1 },
+    { ID_A, 0 }, { ID_P, 0 }, { ID_L, 0 }, { ID_M, 0 },
+    { ID_O, 1 }, { ID_A, 1 }, { ID_A, 0 }, { ID_O, 0 },
+};
+
+#define IOCTL(_backend, _request, _value) \
+    { .backend = (_backend), .request = (_request), .value = (_value) }
+
+static const struct host_ioctl_t sExpected[] = {
+    // A on, the first activation: every group is read back
+    IOCTL(BACKEND_AKM, ECS_IOCTL_APP_GET_MFLAG, 0),
+    IOCTL(BACKEND_AKM, ECS_IOCTL_APP_GET_AFLAG, 0),
+    IOCTL(BACKEND_AKM, ECS_IOCTL_APP_GET_TFLAG, 0),
+    IOCTL(BACKEND_AKM, ECS_IOCTL_APP_GET_MVFLAG, 0),
+    IOCTL(BACKEND_AKM, ECS_IOCTL_APP_SET_AFLAG, 1),
+    IOCTL(BACKEND_CM, CAPELLA_CM3602_IOCTL_GET_ENABLED, 0),
+    IOCTL(BACKEND_LIGHT, LIGHTSENSOR_IOCTL_GET_ENABLED, 0),
+    IOCTL(BACKEND_AKM, ECS_IOCTL_APP_SET_DELAY, 0),
+    // P, L and M on
+    IOCTL(BACKEND_CM, CAPELLA_CM3602_IOCTL_ENABLE, 1),
+    IOCTL(BACKEND_LIGHT, LIGHTSENSOR_IOCTL_ENABLE, 1),
+    IOCTL(BACKEND_AKM, ECS_IOCTL_APP_SET_MVFLAG, 1),
+    // and off again, the compass is closed with its last flag
+    IOCTL(BACKEND_AKM, ECS_IOCTL_APP_SET_AFLAG, 0),
+    IOCTL(BACKEND_CM, CAPELLA_CM3602_IOCTL_ENABLE, 0),
+    IOCTL(BACKEND_LIGHT, LIGHTSENSOR_IOCTL_ENABLE, 0),
+    IOCTL(BACKEND_AKM, ECS_IOCTL_APP_SET_MVFLAG, 0),
+    // O on opens the compass again, its state still known
+    IOCTL(BACKEND_AKM, ECS_IOCTL_APP_SET_MFLAG, 1),
+    IOCTL(BACKEND_AKM, ECS_IOCTL_APP_SET_DELAY, 0),
+    IOCTL(BACKEND_AKM, ECS_IOCTL_APP_SET_AFLAG, 1),
+    IOCTL(BACKEND_AKM, ECS_IOCTL_APP_SET_AFLAG, 0),
+    IOCTL(BACKEND_AKM, ECS_IOCTL_APP_SET_MFLAG, 0),
+};
+
+int main(void)
+{
+    struct sensors_control_context_t *dev;
+    struct hw_device_t *device = NULL;
+    char key[PROPERTY_KEY_MAX];
+    int i;
+
+    // no grace period, so everything goes off right away
+    for (i = 0; i < NUM_BACKENDS; i++) {
+        snprintf(key, sizeof(key), "ro_sensors_grace_ms_%s", sBackends[i].name);
+        setenv(key, "0", 1);
+    }
+
+    open_sensors(&HAL_MODULE_INFO_SYM.common, SENSORS_HARDWARE_CONTROL,
+                 &device);
+    CHECK(device);
+    if (!device)
+        return host_result();
+    dev = (struct sensors_control_context_t *)device;
+
+    for (i = 0; i < (int)ARRAY_SIZE(sStorm); i++)
+        control__activate(dev, SENSORS_HANDLE_BASE + sStorm[i].id,
+                          sStorm[i].enabled);
+
+    CHECK(sHostLogCount == (int)ARRAY_SIZE(sExpected));
+    for (i = 0; i < sHostLogCount && i < (int)ARRAY_SIZE(sExpected); i++) {
+        const struct host_ioctl_t *got = &sHostLog[i];
+        const struct host_ioctl_t *expected = &sExpected[i];
+        if (got->backend != expected->backend ||
+                got->request != expected->request ||
+                got->value != expected->value) {
+            fprintf(stderr, "ioctl %d: %s %08x %d, expected %s %08x %d\n", i,
+                    sBackends[got->backend].name, got->request, got->value,
+                    sBackends[expected->backend].name, expected->request,
+                    expected->value);
+            CHECK(!"the ioctl expected");
+        }
+    }
+
+    control__close(device);
+    return host_result();
+}
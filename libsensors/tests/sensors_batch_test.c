@@ -0,0 +1,205 @@
+/*
+ * Copyright (C) 2010 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Checks batching through control__batch() and control__flush(): the
+ * accelerometer is fed at 50 Hz with no report latency, as before batching,
+ * then with one that flushes on its deadline and one long enough for the
+ * queue to fill up. Every sample must be delivered, and the wakeups of the
+ * caller of poll_batch() go down with the latency. A flush returns what is
+ * held back right away, and one with nothing held back returns nothing.
+ *
+ *   sensors_batch_test [seconds]
+ */
+
+#include <pthread.h>
+
+#include "sensors_host.h"
+
+#define PERIOD_MS       20
+#define DEADLINE_MS     200
+// longer than a run: only a full queue or a flush returns the samples
+#define FOREVER_MS      600000
+// how late a burst due at its deadline can come
+#define SLACK_MS        50
+
+struct run_t {
+    int samples;
+    int returns;
+    int maxBurst;
+    int64_t maxAge;
+    int64_t lastReturn;
+};
+
+static struct host_sensors_t sHost;
+static struct run_t sRun;
+static pthread_mutex_t sLock = PTHREAD_MUTEX_INITIALIZER;
+
+/* what the framework does, until control__wake() */
+static void *poll_thread(void *arg)
+{
+    sensors_data_t data[32];
+    int i, n;
+
+    (void)arg;
+    while ((n = data__poll_batch(sHost.data, data, ARRAY_SIZE(data))) > 0) {
+        int64_t now = clock_ns(CLOCK_MONOTONIC);
+        pthread_mutex_lock(&sLock);
+        sRun.returns++;
+        sRun.samples += n;
+        if (n > sRun.maxBurst)
+            sRun.maxBurst = n;
+        for (i = 0; i < n; i++) {
+            if (now - data[i].time > sRun.maxAge)
+                sRun.maxAge = now - data[i].time;
+        }
+        sRun.lastReturn = now;
+        pthread_mutex_unlock(&sLock);
+    }
+    return NULL;
+}
+
+static void start(pthread_t *poller, int latency)
+{
+    memset(&sRun, 0, sizeof(sRun));
+    CHECK(!control__batch(sHost.control, SENSORS_HANDLE_BASE + ID_A,
+                          latency));
+    pthread_create(poller, NULL, poll_thread, NULL);
+}
+
+static struct run_t stop(pthread_t *poller)
+{
+    control__wake(sHost.control);
+    pthread_join(*poller, NULL);
+    return sRun;
+}
+
+static struct run_t snapshot(void)
+{
+    struct run_t run;
+    pthread_mutex_lock(&sLock);
+    run = sRun;
+    pthread_mutex_unlock(&sLock);
+    return run;
+}
+
+static void feed(int frames)
+{
+    int64_t start = clock_ns(CLOCK_MONOTONIC);
+    int frame;
+
+    for (frame = 0; frame < frames; frame++) {
+        int64_t due = start + frame * PERIOD_MS * 1000000LL, now;
+        while ((now = clock_ns(CLOCK_MONOTONIC)) < due) {
+            struct timespec ts = { 0, due - now };
+            nanosleep(&ts, NULL);
+        }
+        host_event(&sHost, BACKEND_AKM, EV_ABS, EVENT_TYPE_ACCEL_X,
+                   frame & 63);
+        host_event(&sHost, BACKEND_AKM, EV_SYN, SYN_REPORT, 0);
+    }
+}
+
+static void report(const char *name, const struct run_t *run, int seconds)
+{
+    printf("%-22s %5d samples, %5d wakeups/min, max burst %2d, "
+           "max age %3lld ms\n", name, run->samples,
+           run->returns * 60 / seconds, run->maxBurst,
+           (long long)(run->maxAge / 1000000));
+}
+
+int main(int argc, char **argv)
+{
+    int seconds = argc > 1 ? atoi(argv[1]) : 2;
+    int frames = seconds * 1000 / PERIOD_MS;
+    struct run_t now, deadline, full, run;
+    pthread_t poller;
+    int depth;
+
+    if (seconds <= 0)
+        seconds = 2;
+    setenv("ro_sensors_reader_thread", "0", 1);
+    if (host_sensors_open(&sHost, SENSORS_AKM_ACCELERATION) < 0) {
+        CHECK(!"host_sensors_open");
+        return host_result();
+    }
+    depth = sHost.data->queues[ID_A].depth;
+
+    // every sample as soon as it comes, like before batching
+    start(&poller, 0);
+    feed(frames);
+    usleep(SLACK_MS * 1000);
+    now = stop(&poller);
+    report("no latency", &now, seconds);
+    CHECK(now.samples == frames);
+
+    // held back until the oldest one is due
+    start(&poller, DEADLINE_MS);
+    feed(frames);
+    usleep((DEADLINE_MS + SLACK_MS) * 1000);
+    deadline = stop(&poller);
+    report("deadline flush", &deadline, seconds);
+    CHECK(deadline.samples == frames);
+    CHECK(deadline.maxBurst <= DEADLINE_MS / PERIOD_MS + 1);
+    CHECK(deadline.maxAge <= (DEADLINE_MS + SLACK_MS) * 1000000LL);
+    CHECK(deadline.returns * (DEADLINE_MS / PERIOD_MS) <= frames * 2);
+
+    // held back until the queue is full, the rest until flush()
+    start(&poller, FOREVER_MS);
+    feed(frames);
+    usleep(SLACK_MS * 1000);
+    run = snapshot();
+    CHECK(run.samples == frames / depth * depth);
+    CHECK(run.maxBurst == depth);
+    CHECK(!control__flush(sHost.control, SENSORS_HANDLE_BASE + ID_A));
+    usleep(SLACK_MS * 1000);
+    full = stop(&poller);
+    report("queue-full flush", &full, seconds);
+    CHECK(full.samples == frames);
+    CHECK(full.returns == (frames + depth - 1) / depth);
+
+    // a flush returns what is held back at once, and nothing else
+    start(&poller, FOREVER_MS);
+    feed(3);
+    usleep(SLACK_MS * 1000);
+    CHECK(!snapshot().returns);
+    int64_t flushed = clock_ns(CLOCK_MONOTONIC);
+    CHECK(!control__flush(sHost.control, SENSORS_HANDLE_BASE + ID_A));
+    usleep(SLACK_MS * 1000);
+    run = snapshot();
+    CHECK(run.returns == 1 && run.samples == 3);
+    printf("flush: burst returned %lld us after flush()\n",
+           (long long)((run.lastReturn - flushed) / 1000));
+
+    // with nothing held back, poll keeps waiting
+    CHECK(!control__flush(sHost.control, SENSORS_HANDLE_BASE + ID_A));
+    usleep(SLACK_MS * 1000);
+    CHECK(snapshot().returns == 1);
+    // and it was no more than that: the next sample is held back again
+    feed(1);
+    usleep(SLACK_MS * 1000);
+    CHECK(snapshot().returns == 1);
+    CHECK(!control__flush(sHost.control, SENSORS_HANDLE_BASE + ID_A));
+    usleep(SLACK_MS * 1000);
+    run = stop(&poller);
+    CHECK(run.returns == 2 && run.samples == 4);
+
+    CHECK(deadline.returns < now.returns);
+    CHECK(full.returns < deadline.returns);
+
+    host_sensors_close(&sHost);
+    return host_result();
+}
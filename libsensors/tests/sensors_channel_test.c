@@ -0,0 +1,286 @@
+/*
+ * Copyright (C) 2010 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Checks the sample channel across processes: four reader processes read
+ * it while the data device writing it is closed mid-stream. Another data
+ * device of the process of the control device must take the channel over
+ * right away, and the readers must go on reading without doing anything.
+ * A data device in a process of its own decodes the same frames all along
+ * and must never get to write them. Every frame carries its index in the
+ * raw acceleration, so the readers can tell what they missed.
+ *
+ *   sensors_channel_test
+ */
+
+#include <pthread.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <sys/wait.h>
+
+#include "sensors_host.h"
+
+#define READERS         4
+#define RATE_HZ         1000
+#define FRAMES          3000
+#define CLOSE_FRAME     1000
+// the frames a reader can miss while the channel changes hands
+#define MAX_GAP         50
+
+struct result_t {
+    uint32_t samples;
+    uint32_t duplicates;
+    uint32_t overruns;
+    int32_t last;
+    // the most frames missed in a row, and the frame that ended it
+    int32_t gap;
+    int32_t gapEnd;
+    int64_t p50;
+    int64_t p99;
+    int64_t max;
+};
+
+static int64_t sStart;
+
+static int frame_index(const sensors_data_t *data)
+{
+    return (int)lrintf(data->vector.v[0] / sAkmScales[ID_A][0]);
+}
+
+struct feeder_t {
+    struct host_sensors_t *host;
+    int last;
+    pthread_t thread;
+};
+
+/* frame 1 to last at RATE_HZ from sStart, the same in every process */
+static void *feed_thread(void *arg)
+{
+    struct feeder_t *feeder = arg;
+    struct host_sensors_t *host = feeder->host;
+    int frame;
+
+    for (frame = 1; frame <= feeder->last; frame++) {
+        int64_t due = sStart + frame * (1000000000LL / RATE_HZ), now;
+        while ((now = clock_ns(CLOCK_MONOTONIC)) < due) {
+            struct timespec ts = { 0, due - now };
+            nanosleep(&ts, NULL);
+        }
+        host_event(host, BACKEND_AKM, EV_ABS, EVENT_TYPE_ACCEL_X, frame);
+        host_event(host, BACKEND_AKM, EV_SYN, SYN_REPORT, 0);
+    }
+    return NULL;
+}
+
+struct poller_t {
+    struct host_sensors_t *host;
+    volatile int stop;
+    pthread_t thread;
+};
+
+/* decode until stopped and woken up by control__wake() */
+static void *poll_thread(void *arg)
+{
+    struct poller_t *poller = arg;
+    sensors_data_t data[16];
+
+    while (!poller->stop &&
+           data__poll_batch(poller->host->data, data, ARRAY_SIZE(data)) >= 0)
+        ;
+    return NULL;
+}
+
+static void start(struct host_sensors_t *host, int last,
+                  struct feeder_t *feeder, struct poller_t *poller)
+{
+    feeder->host = host;
+    feeder->last = last;
+    pthread_create(&feeder->thread, NULL, feed_thread, feeder);
+    poller->host = host;
+    poller->stop = 0;
+    pthread_create(&poller->thread, NULL, poll_thread, poller);
+}
+
+/* stop the poller of a data device, the others go on */
+static void stop(struct host_sensors_t *control, struct feeder_t *feeder,
+                 struct poller_t *poller)
+{
+    pthread_join(feeder->thread, NULL);
+    // the time to decode the last frame
+    usleep(10000);
+    poller->stop = 1;
+    control__wake(control->control);
+    pthread_join(poller->thread, NULL);
+}
+
+/*
+ * A data device in a process of its own: it decodes every frame, and
+ * can't write them to the channel. Exits with the number of failures.
+ */
+static void outsider_main(struct host_sensors_t *host)
+{
+    struct host_sensors_t outsider = *host;
+    struct feeder_t feeder;
+    struct poller_t poller;
+
+    if (host_data_open(&outsider) < 0)
+        _exit(1);
+    CHECK(!outsider.data->trusted);
+    CHECK(!outsider.data->channel);
+    start(&outsider, FRAMES, &feeder, &poller);
+    pthread_join(feeder.thread, NULL);
+    CHECK(!outsider.data->channelWriter);
+    CHECK(outsider.data->sensors[ID_A].vector.v[0] ==
+          FRAMES * sAkmScales[ID_A][0]);
+    _exit(sFailures);
+}
+
+static int compare_ns(const void *a, const void *b)
+{
+    int64_t x = *(const int64_t *)a, y = *(const int64_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+static void reader_main(struct sensors_channel_t *channel, int ready,
+                        int results)
+{
+    static int64_t latencies[FRAMES];
+    struct sensors_channel_reader_t reader;
+    struct result_t result;
+    sensors_data_t data[16];
+    int count = 0;
+    int i, n;
+
+    memset(&result, 0, sizeof(result));
+    sensors_channel_reader_init(&reader, channel);
+    write(ready, "", 1);
+    // longer than the channel can go without a writer: that is the end
+    while ((n = sensors_channel_read(&reader, data, ARRAY_SIZE(data),
+                                     CHANNEL_CLAIM_INTERVAL_MS * 3)) > 0) {
+        int64_t now = clock_ns(CLOCK_MONOTONIC);
+        for (i = 0; i < n; i++) {
+            int index = frame_index(&data[i]);
+            if (index <= result.last) {
+                result.duplicates++;
+                continue;
+            }
+            if (index - result.last - 1 > result.gap) {
+                result.gap = index - result.last - 1;
+                result.gapEnd = index;
+            }
+            result.last = index;
+            if (count < FRAMES)
+                latencies[count++] = now - data[i].time;
+            result.samples++;
+        }
+    }
+    result.overruns = reader.overruns;
+    if (count) {
+        qsort(latencies, count, sizeof(latencies[0]), compare_ns);
+        result.p50 = latencies[count / 2];
+        result.p99 = latencies[count * 99 / 100];
+        result.max = latencies[count - 1];
+    }
+    write(results, &result, sizeof(result));
+}
+
+int main(void)
+{
+    struct host_sensors_t host, writer, survivor;
+    struct sensors_channel_t *channel;
+    struct feeder_t writerFeeder, survivorFeeder;
+    struct poller_t writerPoller, survivorPoller;
+    pid_t readers[READERS], outsider;
+    int ready[2], results[2];
+    int i, fd, status;
+    char c;
+
+    if (host_control_open(&host, SENSORS_AKM_ACCELERATION) < 0) {
+        fprintf(stderr, "Couldn't open the control device\n");
+        return 1;
+    }
+    fd = control__get_channel_fd(host.control);
+    channel = fd >= 0 ? sensors_channel_map(fd) : NULL;
+    if (!channel) {
+        fprintf(stderr, "Couldn't map the channel\n");
+        return 1;
+    }
+    close(fd);
+
+    pipe(ready);
+    pipe(results);
+    for (i = 0; i < READERS; i++) {
+        readers[i] = fork();
+        if (!readers[i]) {
+            reader_main(channel, ready[1], results[1]);
+            _exit(0);
+        }
+    }
+    for (i = 0; i < READERS; i++)
+        read(ready[0], &c, 1);
+
+    // every data device decodes the same frames from its pipes
+    sStart = clock_ns(CLOCK_MONOTONIC) + 500000000LL;
+    writer = host;
+    CHECK(!host_data_open(&writer));
+    CHECK(writer.data->trusted);
+    CHECK(writer.data->channelWriter);
+    CHECK(channel->writer == getpid());
+    survivor = host;
+    CHECK(!host_data_open(&survivor));
+    CHECK(!survivor.data->channelWriter);
+    outsider = fork();
+    if (!outsider)
+        outsider_main(&host);
+    start(&writer, CLOSE_FRAME, &writerFeeder, &writerPoller);
+    start(&survivor, FRAMES, &survivorFeeder, &survivorPoller);
+
+    stop(&host, &writerFeeder, &writerPoller);
+    host_data_close(&writer);
+    stop(&host, &survivorFeeder, &survivorPoller);
+    CHECK(survivor.data->channelWriter);
+    CHECK(channel->writer == getpid());
+
+    CHECK(waitpid(outsider, &status, 0) == outsider);
+    CHECK(WIFEXITED(status) && !WEXITSTATUS(status));
+
+    for (i = 0; i < READERS; i++) {
+        struct result_t r;
+        if (read(results[0], &r, sizeof(r)) != sizeof(r)) {
+            CHECK(!"reader result");
+            continue;
+        }
+        printf("reader: %u samples, %u duplicates, %u overruns, last %d, "
+               "%d missed up to frame %d, latency p50 %lld us, "
+               "p99 %lld us, max %lld us\n",
+               r.samples, r.duplicates, r.overruns, r.last, r.gap, r.gapEnd,
+               (long long)(r.p50 / 1000), (long long)(r.p99 / 1000),
+               (long long)(r.max / 1000));
+        CHECK(r.last == FRAMES);
+        CHECK(!r.duplicates);
+        CHECK(!r.overruns);
+        CHECK(r.gap <= MAX_GAP);
+        CHECK(r.samples + r.gap >= FRAMES - 10);
+    }
+    for (i = 0; i < READERS; i++)
+        waitpid(readers[i], NULL, 0);
+
+    host_data_close(&survivor);
+    control__close(&host.control->device.base.common);
+    sensors_channel_unmap(channel);
+
+    return host_result();
+}
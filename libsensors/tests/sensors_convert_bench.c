@@ -0,0 +1,136 @@
+/*
+ * Copyright (C) 2010 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * What converting the raw compass values costs, one lane at a time as
+ * data__akm_convert() does, and four lanes at a time the way a NEON
+ * vcvtq_f32_s32/vmulq_f32 kernel would, here with the matching SSE2
+ * instructions. Frames are staged in batches of 1 to 64 before being
+ * converted, each frame holding the four compass sensors.
+ *
+ *   sensors_convert_bench
+ */
+
+#include <emmintrin.h>
+
+#include "sensors_host.h"
+
+#define MAX_BATCH       64
+#define FRAMES          (1 << 20)
+#define ROUNDS          5
+
+static int32_t sRaw[MAX_BATCH][NUM_AKM_SENSORS][4] __attribute__((aligned(16)));
+static sensors_vec_t sOut[MAX_BATCH][NUM_AKM_SENSORS];
+
+static void __attribute__((noinline)) convert_scalar(int frames)
+{
+    int f, i;
+    for (f = 0; f < frames; f++) {
+        for (i = 0; i < NUM_AKM_SENSORS; i++) {
+            float *v = sOut[f][i].v;
+            v[0] = sRaw[f][i][0] * sAkmScales[i][0];
+            v[1] = sRaw[f][i][1] * sAkmScales[i][1];
+            v[2] = sRaw[f][i][2] * sAkmScales[i][2];
+        }
+    }
+}
+
+static void __attribute__((noinline)) convert_vector(int frames)
+{
+    int f, i;
+    for (f = 0; f < frames; f++) {
+        for (i = 0; i < NUM_AKM_SENSORS; i++) {
+            float *v = sOut[f][i].v;
+            __m128 x = _mm_mul_ps(
+                    _mm_cvtepi32_ps(_mm_load_si128((__m128i *)sRaw[f][i])),
+                    _mm_load_ps(sAkmScales[i]));
+            // v[3] would be the status
+            _mm_storel_pi((__m64 *)v, x);
+            _mm_store_ss(v + 2, _mm_movehl_ps(x, x));
+        }
+    }
+}
+
+static double measure(void (*convert)(int), int batch)
+{
+    int64_t best = INT64_MAX;
+    int round, n;
+    for (round = 0; round < ROUNDS; round++) {
+        int64_t t = clock_ns(CLOCK_THREAD_CPUTIME_ID);
+        for (n = 0; n < FRAMES; n += batch)
+            convert(batch);
+        t = clock_ns(CLOCK_THREAD_CPUTIME_ID) - t;
+        if (t < best)
+            best = t;
+    }
+    return best / (double)FRAMES;
+}
+
+int main(void)
+{
+    static const int batches[] = { 1, 4, 16, 64 };
+    struct host_sensors_t host;
+    uint32_t i;
+    int f, j;
+
+    for (f = 0; f < MAX_BATCH; f++) {
+        for (j = 0; j < NUM_AKM_SENSORS; j++) {
+            sRaw[f][j][0] = f * 7 - 200;
+            sRaw[f][j][1] = 300 - f * 3;
+            sRaw[f][j][2] = -720 + f;
+        }
+    }
+
+    // both kernels must give the same values
+    sensors_vec_t scalar[MAX_BATCH][NUM_AKM_SENSORS];
+    convert_scalar(MAX_BATCH);
+    memcpy(scalar, sOut, sizeof(sOut));
+    convert_vector(MAX_BATCH);
+    for (f = 0; f < MAX_BATCH; f++) {
+        for (j = 0; j < NUM_AKM_SENSORS; j++) {
+            if (memcmp(scalar[f][j].v, sOut[f][j].v, 3 * sizeof(float))) {
+                printf("MISMATCH at frame %d sensor %d\n", f, j);
+                return 1;
+            }
+        }
+    }
+
+    printf("ns per frame of %d sensors, best of %d rounds:\n",
+           NUM_AKM_SENSORS, ROUNDS);
+    for (i = 0; i < ARRAY_SIZE(batches); i++) {
+        printf("  batch %2d: scalar %5.2f, 4 lanes %5.2f\n", batches[i],
+               measure(convert_scalar, batches[i]),
+               measure(convert_vector, batches[i]));
+    }
+
+    // and what the HAL does now, one frame at a time
+    if (host_sensors_open(&host, 0) < 0) {
+        fprintf(stderr, "Couldn't open the sensors\n");
+        return 1;
+    }
+    int64_t best = INT64_MAX;
+    for (j = 0; j < ROUNDS; j++) {
+        int64_t t = clock_ns(CLOCK_THREAD_CPUTIME_ID);
+        for (f = 0; f < FRAMES; f++)
+            data__akm_convert(host.data, SENSORS_AKM_GROUP);
+        t = clock_ns(CLOCK_THREAD_CPUTIME_ID) - t;
+        if (t < best)
+            best = t;
+    }
+    printf("  data__akm_convert(): %5.2f\n", best / (double)FRAMES);
+    host_sensors_close(&host);
+    return 0;
+}
@@ -0,0 +1,120 @@
+/*
+ * Copyright (C) 2010 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Checks the delays set per handle: the compass runs at the fastest one
+ * an enabled sensor asked for, the samples of the slower sensors are
+ * decimated, and a light level coming too soon is held back until the
+ * delay of the light sensor is over rather than lost.
+ */
+
+#include "sensors_host.h"
+
+#define FRAMES          50
+#define PERIOD_MS       20
+
+#define ACCEL_MS        20
+#define MAG_MS          100
+#define LIGHT_MS        200
+
+static int compass_delay(void)
+{
+    return sHostDrivers[BACKEND_AKM].delay;
+}
+
+static void set_delay(struct host_sensors_t *host, int id, int ms)
+{
+    CHECK(!control__set_delay_handle(host->control, SENSORS_HANDLE_BASE + id,
+                                     ms));
+}
+
+/* decode what was written, and count the samples returned per sensor */
+static void drain(struct host_sensors_t *host, int *counts)
+{
+    struct sensors_data_context_t *dev = host->data;
+    sensors_data_t values[16];
+    int i, n;
+
+    while (data__poll_inputs(dev, dev->epoll_fd, 0) > 0)
+        ;
+    while (dev->pendingSensors) {
+        n = data__poll_batch(dev, values, ARRAY_SIZE(values));
+        for (i = 0; i < n; i++)
+            counts[sensor_to_id(values[i].sensor)]++;
+    }
+}
+
+int main(void)
+{
+    struct host_sensors_t host;
+    sensors_data_t data;
+    int counts[MAX_NUM_SENSORS];
+    int64_t start, held;
+    int i;
+
+    setenv("ro_sensors_reader_thread", "0", 1);
+    host_set_abs(BACKEND_LIGHT, EVENT_TYPE_LIGHT, 3, 0, 9);
+    if (host_sensors_open(&host, SENSORS_AKM_ACCELERATION |
+                          SENSORS_AKM_MAGNETIC_FIELD | SENSORS_LIGHT) < 0) {
+        CHECK(!"host_sensors_open");
+        return host_result();
+    }
+
+    // the compass runs at the fastest delay, whichever sensor set it
+    set_delay(&host, ID_A, ACCEL_MS);
+    set_delay(&host, ID_M, MAG_MS);
+    CHECK(compass_delay() == ACCEL_MS);
+    set_delay(&host, ID_A, 2 * MAG_MS);
+    CHECK(compass_delay() == MAG_MS);
+    control__activate(host.control, SENSORS_HANDLE_BASE + ID_M, 0);
+    CHECK(compass_delay() == 2 * MAG_MS);
+    control__activate(host.control, SENSORS_HANDLE_BASE + ID_M, 1);
+    CHECK(compass_delay() == MAG_MS);
+    set_delay(&host, ID_A, ACCEL_MS);
+    CHECK(compass_delay() == ACCEL_MS);
+
+    // the light level there was at open
+    CHECK(data__poll(host.data, &data) == ID_L);
+
+    // every accelerometer sample, one in five of the magnetic field
+    memset(counts, 0, sizeof(counts));
+    start = clock_ns(CLOCK_REALTIME) - FRAMES * PERIOD_MS * 1000000LL;
+    for (i = 0; i < FRAMES; i++) {
+        int64_t t = start + i * PERIOD_MS * 1000000LL;
+        host_event_at(&host, BACKEND_AKM, EV_ABS, EVENT_TYPE_ACCEL_X, i, t);
+        host_event_at(&host, BACKEND_AKM, EV_ABS, EVENT_TYPE_MAGV_X, i, t);
+        host_event_at(&host, BACKEND_AKM, EV_SYN, SYN_REPORT, 0, t);
+        drain(&host, counts);
+    }
+    CHECK(counts[ID_A] == FRAMES);
+    CHECK(counts[ID_M] == FRAMES * PERIOD_MS / MAG_MS);
+
+    // a new light level right after the last one is held back, not lost
+    set_delay(&host, ID_L, LIGHT_MS);
+    host_event(&host, BACKEND_LIGHT, EV_ABS, EVENT_TYPE_LIGHT, 5);
+    host_event(&host, BACKEND_LIGHT, EV_SYN, SYN_REPORT, 0);
+    CHECK(data__poll(host.data, &data) == ID_L);
+    CHECK(data.light == sLuxValues[5]);
+    held = data__now();
+    host_event(&host, BACKEND_LIGHT, EV_ABS, EVENT_TYPE_LIGHT, 7);
+    host_event(&host, BACKEND_LIGHT, EV_SYN, SYN_REPORT, 0);
+    CHECK(data__poll(host.data, &data) == ID_L);
+    CHECK(data.light == sLuxValues[7]);
+    CHECK(data__now() - held >= (LIGHT_MS - LIGHT_MS / 8) * 1000000LL);
+
+    host_sensors_close(&host);
+    return host_result();
+}
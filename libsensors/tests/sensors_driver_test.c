@@ -0,0 +1,102 @@
+/*
+ * Copyright (C) 2010 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Checks what the control device tells the drivers: a driver left on by
+ * a process that died holding the control device is turned off by the
+ * first activation, whatever sensor it is for, and afterwards only what
+ * changes is written: turning 7 sensors on and then off takes
+ * ROUND_IOCTLS ioctls, where setting every flag of every group and reading
+ * them all back took 143.
+ */
+
+#include "sensors_host.h"
+
+#define ROUNDS          3
+
+// the flags that change, both ways, and the compass delay
+#define ROUND_IOCTLS    11
+
+static uint32_t driver_ioctls(void)
+{
+    uint32_t ioctls = 0;
+    int i;
+    for (i = 0; i < NUM_BACKENDS; i++)
+        ioctls += sHostDrivers[i].ioctls;
+    return ioctls;
+}
+
+static int driver_on(int backend)
+{
+    const struct sensors_backend_t *b = &sBackends[backend];
+    int j;
+    for (j = 0; j < b->num_flags; j++) {
+        if (sHostDrivers[backend].flags[j])
+            return 1;
+    }
+    return 0;
+}
+
+int main(void)
+{
+    static const int ids[] = { ID_A, ID_M, ID_O, ID_P, ID_L, ID_G, ID_RV };
+    struct sensors_control_context_t *dev;
+    struct hw_device_t *device = NULL;
+    char key[PROPERTY_KEY_MAX];
+    uint32_t before;
+    int i, j, round;
+
+    // no grace period, so everything goes off right away
+    for (i = 0; i < NUM_BACKENDS; i++) {
+        snprintf(key, sizeof(key), "ro_sensors_grace_ms_%s", sBackends[i].name);
+        setenv(key, "0", 1);
+    }
+
+    // left on by the last owner of the control device
+    sHostDrivers[BACKEND_CM].flags[0] = 1;
+    sHostDrivers[BACKEND_LIGHT].flags[0] = 1;
+
+    open_sensors(&HAL_MODULE_INFO_SYM.common, SENSORS_HARDWARE_CONTROL,
+                 &device);
+    CHECK(device);
+    if (!device)
+        return host_result();
+    dev = (struct sensors_control_context_t *)device;
+
+    control__activate(dev, SENSORS_HANDLE_BASE + ID_A, 1);
+    CHECK(driver_on(BACKEND_AKM));
+    CHECK(!driver_on(BACKEND_CM));
+    CHECK(!driver_on(BACKEND_LIGHT));
+    control__activate(dev, SENSORS_HANDLE_BASE + ID_A, 0);
+    CHECK(!driver_on(BACKEND_AKM));
+
+    for (round = 0; round < ROUNDS; round++) {
+        before = driver_ioctls();
+        for (j = 0; j < (int)ARRAY_SIZE(ids); j++)
+            control__activate(dev, SENSORS_HANDLE_BASE + ids[j], 1);
+        for (i = 0; i < NUM_BACKENDS; i++)
+            CHECK(driver_on(i));
+        for (j = 0; j < (int)ARRAY_SIZE(ids); j++)
+            control__activate(dev, SENSORS_HANDLE_BASE + ids[j], 0);
+        for (i = 0; i < NUM_BACKENDS; i++)
+            CHECK(!driver_on(i));
+        printf("round %d: %u ioctls\n", round, driver_ioctls() - before);
+        CHECK(driver_ioctls() - before == ROUND_IOCTLS);
+    }
+
+    control__close(device);
+    return host_result();
+}
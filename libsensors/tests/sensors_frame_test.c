@@ -0,0 +1,104 @@
+/*
+ * Copyright (C) 2010 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Checks that frames are assembled per input device: a compass frame
+ * split across reads, with a proximity frame in between, is reported
+ * once and complete, and compass frames for sensors nobody enabled wake
+ * nobody up.
+ */
+
+#include "sensors_host.h"
+
+#define FRAMES          50
+
+/* decode what has been written so far, returns the wakeups it caused */
+static int decode(struct host_sensors_t *host)
+{
+    struct sensors_data_context_t *dev = host->data;
+    int flags, wakeups = 0;
+
+    while ((flags = data__poll_inputs(dev, dev->epoll_fd, 0)) > 0) {
+        if (flags & POLL_GOT_SYN)
+            wakeups++;
+    }
+    return wakeups;
+}
+
+int main(void)
+{
+    struct host_sensors_t host;
+    sensors_data_t values[8];
+    const float *v;
+    int i, n, wakeups;
+
+    setenv("ro_sensors_reader_thread", "0", 1);
+    host_set_abs(BACKEND_CM, EVENT_TYPE_PROXIMITY, 1, 0, 1);
+    if (host_sensors_open(&host, SENSORS_AKM_ACCELERATION |
+                          SENSORS_CM_PROXIMITY) < 0) {
+        CHECK(!"host_sensors_open");
+        return host_result();
+    }
+    // the proximity there was at open
+    CHECK(data__poll(host.data, values) == ID_P);
+
+    // half a compass frame, a whole proximity frame, the rest of it
+    host_event(&host, BACKEND_AKM, EV_ABS, EVENT_TYPE_ACCEL_X, 10);
+    decode(&host);
+    host_event(&host, BACKEND_CM, EV_ABS, EVENT_TYPE_PROXIMITY, 0);
+    host_event(&host, BACKEND_CM, EV_SYN, SYN_REPORT, 0);
+    decode(&host);
+    host_event(&host, BACKEND_AKM, EV_ABS, EVENT_TYPE_ACCEL_Y, 20);
+    host_event(&host, BACKEND_AKM, EV_ABS, EVENT_TYPE_ACCEL_Z, 30);
+    host_event(&host, BACKEND_AKM, EV_SYN, SYN_REPORT, 0);
+    decode(&host);
+
+    n = data__poll_batch(host.data, values, ARRAY_SIZE(values));
+    CHECK(n == 2);
+    for (i = 0; i < n; i++) {
+        if (values[i].sensor == id_to_sensor[ID_P]) {
+            CHECK(values[i].distance == 0.0f);
+            continue;
+        }
+        CHECK(values[i].sensor == id_to_sensor[ID_A]);
+        v = values[i].acceleration.v;
+        CHECK(v[0] == 10 * sAkmScales[ID_A][0]);
+        CHECK(v[1] == 20 * sAkmScales[ID_A][1]);
+        CHECK(v[2] == 30 * sAkmScales[ID_A][2]);
+    }
+    CHECK(host.data->frames[BACKEND_AKM].split == 1);
+
+    // with only the light left, the compass frames wake nobody up
+    control__activate(host.control, SENSORS_HANDLE_BASE + ID_A, 0);
+    control__activate(host.control, SENSORS_HANDLE_BASE + ID_P, 0);
+    control__activate(host.control, SENSORS_HANDLE_BASE + ID_L, 1);
+    decode(&host);
+    while (host.data->pendingSensors)
+        data__poll_batch(host.data, values, ARRAY_SIZE(values));
+    wakeups = 0;
+    for (i = 0; i < FRAMES; i++) {
+        host_event(&host, BACKEND_AKM, EV_ABS, EVENT_TYPE_ACCEL_X, i);
+        host_event(&host, BACKEND_AKM, EV_SYN, SYN_REPORT, 0);
+        wakeups += decode(&host);
+    }
+    printf("%d wakeups for %d compass frames nobody asked for\n",
+           wakeups, FRAMES);
+    CHECK(!wakeups);
+    CHECK(!host.data->pendingSensors);
+
+    host_sensors_close(&host);
+    return host_result();
+}
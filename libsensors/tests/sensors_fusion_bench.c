@@ -0,0 +1,278 @@
+/*
+ * Copyright (C) 2010 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Replays the compass frames of a recording through
+ * sensors_fusion_update() and reports how far the fused orientation is
+ * from akmd's in the same frames, and the CPU time of each update. Record
+ * with akmd's orientation enabled, see sensors_record.h.
+ *
+ * Without a recording, makes up a minute of the compass at 50 Hz turning
+ * round and tilting, with some noise; akmd's orientation is then the
+ * exact one, in whole degrees like akmd reports it.
+ *
+ *   sensors_fusion_bench [recording]
+ */
+
+#include "sensors_host.h"
+
+#define SYNTHETIC_FRAMES        3000
+#define SYNTHETIC_PERIOD_NS     20000000LL
+
+// the field in the world frame (uT), the one of a mid latitude
+#define FIELD_NORTH             20.0f
+#define FIELD_DOWN              45.0f
+
+// amplitude of the noise added to the acceleration and the field
+#define NOISE_A                 0.2f
+#define NOISE_M                 1.0f
+
+#define DEG2RAD                 ((float)M_PI / 180.0f)
+
+// a frame updating the acceleration or the magnetic field
+struct fusion_frame_t {
+    int64_t time;
+    float accel[3];
+    float mag[3];
+    float reference[3];
+    int has_reference;
+};
+
+static struct fusion_frame_t *sFrames;
+static int sNumFrames;
+static int sMaxFrames;
+
+static int add_frame(const struct fusion_frame_t *frame)
+{
+    if (sNumFrames == sMaxFrames) {
+        int max = sMaxFrames ? sMaxFrames * 2 : 4096;
+        void *frames = realloc(sFrames, max * sizeof(*sFrames));
+        if (!frames)
+            return -1;
+        sFrames = frames;
+        sMaxFrames = max;
+    }
+    sFrames[sNumFrames++] = *frame;
+    return 0;
+}
+
+static int read_all(int fd, void *buf, size_t size)
+{
+    return read(fd, buf, size) == (ssize_t)size ? 0 : -1;
+}
+
+/* the compass frames of a recording, decoded like data__poll does */
+static int load_recording(const char *path)
+{
+    struct sensors_record_header_t header;
+    struct sensors_record_chunk_t chunk;
+    struct input_event events[64];
+    struct fusion_frame_t frame;
+    int32_t raw[NUM_AKM_SENSORS][3];
+    uint32_t seen = 0, updated = 0;
+    int akm = -1;
+    uint32_t i, j;
+    int fd;
+
+    fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return -1;
+    if (read_all(fd, &header, sizeof(header)) ||
+            header.magic != SENSORS_RECORD_MAGIC ||
+            header.version != SENSORS_RECORD_VERSION)
+        goto error;
+    for (i = 0; i < header.num_devices; i++) {
+        struct sensors_record_device_t device;
+        struct sensors_record_axis_t axis;
+        if (read_all(fd, &device, sizeof(device)))
+            goto error;
+        if (!strcmp(device.name, sBackends[BACKEND_AKM].input_name))
+            akm = i;
+        for (j = 0; j < device.num_axes; j++) {
+            if (read_all(fd, &axis, sizeof(axis)))
+                goto error;
+        }
+    }
+    if (akm < 0)
+        goto error;
+
+    memset(raw, 0, sizeof(raw));
+    while (!read_all(fd, &chunk, sizeof(chunk))) {
+        if (chunk.count > ARRAY_SIZE(events) ||
+                read_all(fd, events, chunk.count * sizeof(events[0])))
+            goto error;
+        if ((int)chunk.device != akm)
+            continue;
+        for (i = 0; i < chunk.count; i++) {
+            const struct input_event *event = &events[i];
+            if (event->type == EV_ABS && event->code <= ABS_MAX) {
+                const struct akm_axis_t *axis = &sAkmAxes[event->code];
+                if (axis->id != AKM_AXIS_NONE) {
+                    raw[axis->id][axis->index] = event->value;
+                    updated |= 1 << axis->id;
+                }
+                continue;
+            }
+            if (event->type != EV_SYN)
+                continue;
+            seen |= updated;
+            if ((updated & SENSORS_FUSION_INPUTS) &&
+                    (seen & SENSORS_FUSION_INPUTS) == SENSORS_FUSION_INPUTS) {
+                frame.time = event->time.tv_sec * 1000000000LL +
+                        event->time.tv_usec * 1000LL;
+                for (j = 0; j < 3; j++) {
+                    frame.accel[j] = raw[ID_A][j] * sAkmScales[ID_A][j];
+                    frame.mag[j] = raw[ID_M][j] * sAkmScales[ID_M][j];
+                    frame.reference[j] = raw[ID_O][j] * sAkmScales[ID_O][j];
+                }
+                frame.has_reference = !!(updated & SENSORS_AKM_ORIENTATION);
+                if (add_frame(&frame) < 0)
+                    goto error;
+            }
+            updated = 0;
+        }
+    }
+    close(fd);
+    return 0;
+
+error:
+    close(fd);
+    return -1;
+}
+
+static void quat_mul(const float *a, const float *b, float *q)
+{
+    q[0] = a[0]*b[0] - a[1]*b[1] - a[2]*b[2] - a[3]*b[3];
+    q[1] = a[0]*b[1] + a[1]*b[0] + a[2]*b[3] - a[3]*b[2];
+    q[2] = a[0]*b[2] - a[1]*b[3] + a[2]*b[0] + a[3]*b[1];
+    q[3] = a[0]*b[3] + a[1]*b[2] - a[2]*b[1] + a[3]*b[0];
+}
+
+static float noise(float amplitude)
+{
+    return amplitude * (2.0f * rand() / RAND_MAX - 1.0f);
+}
+
+/* what the compass would measure, turning round and tilting */
+static int make_frames(void)
+{
+    struct sensors_fusion_t exact;
+    struct fusion_frame_t frame;
+    int i, j;
+
+    srand(1);
+    sensors_fusion_init(&exact);
+    for (i = 0; i < SYNTHETIC_FRAMES; i++) {
+        float t = i * (SYNTHETIC_PERIOD_NS / 1e9f);
+        float azimuth = 6.0f * t * DEG2RAD;
+        float pitch = 30.0f * sinf(0.5f * t) * DEG2RAD;
+        float roll = 20.0f * sinf(0.3f * t) * DEG2RAD;
+        float qz[4] = { cosf(azimuth / 2), 0, 0, -sinf(azimuth / 2) };
+        float qx[4] = { cosf(pitch / 2), -sinf(pitch / 2), 0, 0 };
+        float qy[4] = { cosf(roll / 2), 0, sinf(roll / 2), 0 };
+        float qzx[4];
+        quat_mul(qz, qx, qzx);
+        quat_mul(qzx, qy, exact.q);
+
+        // rows 1 and 2 of the rotation: north and up in device coordinates
+        const float w = exact.q[0], x = exact.q[1];
+        const float y = exact.q[2], z = exact.q[3];
+        float north[3] = { 2 * (x*y + w*z), 1 - 2 * (x*x + z*z),
+                           2 * (y*z - w*x) };
+        float up[3] = { 2 * (x*z - w*y), 2 * (y*z + w*x),
+                        1 - 2 * (x*x + y*y) };
+
+        frame.time = i * SYNTHETIC_PERIOD_NS;
+        for (j = 0; j < 3; j++) {
+            float a = GRAVITY_EARTH * up[j] + noise(NOISE_A);
+            float m = FIELD_NORTH * north[j] - FIELD_DOWN * up[j] +
+                    noise(NOISE_M);
+            // quantized like the raw values of the driver
+            frame.accel[j] = lrintf(a / sAkmScales[ID_A][j]) *
+                    sAkmScales[ID_A][j];
+            frame.mag[j] = lrintf(m / sAkmScales[ID_M][j]) *
+                    sAkmScales[ID_M][j];
+        }
+        sensors_fusion_get_orientation(&exact, frame.reference);
+        for (j = 0; j < 3; j++)
+            frame.reference[j] = rintf(frame.reference[j]);
+        frame.has_reference = 1;
+        if (add_frame(&frame) < 0)
+            return -1;
+    }
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    struct sensors_fusion_t fusion;
+    struct sensors_fusion_error_t error;
+    float (*orientation)[3];
+    char *fused;
+    int64_t cpu;
+    int i, updates = 0;
+
+    if (argc > 1 ? load_recording(argv[1]) : make_frames()) {
+        fprintf(stderr, "Couldn't read %s\n", argc > 1 ? argv[1] : "frames");
+        return 1;
+    }
+    if (!sNumFrames) {
+        fprintf(stderr, "No compass frames in %s\n", argv[1]);
+        return 1;
+    }
+    orientation = malloc(sNumFrames * sizeof(*orientation));
+    fused = calloc(sNumFrames, 1);
+    if (!orientation || !fused)
+        return 1;
+
+    // what data__fuse does for each frame, timed on its own
+    sensors_fusion_init(&fusion);
+    cpu = clock_ns(CLOCK_THREAD_CPUTIME_ID);
+    for (i = 0; i < sNumFrames; i++) {
+        const struct fusion_frame_t *frame = &sFrames[i];
+        if (sensors_fusion_update(&fusion, frame->accel, frame->mag,
+                                  frame->time) < 0)
+            continue;
+        sensors_fusion_get_orientation(&fusion, orientation[i]);
+        fused[i] = 1;
+        updates++;
+    }
+    cpu = clock_ns(CLOCK_THREAD_CPUTIME_ID) - cpu;
+
+    memset(&error, 0, sizeof(error));
+    for (i = 0; i < sNumFrames; i++) {
+        if (fused[i] && sFrames[i].has_reference)
+            sensors_fusion_compare(&error, orientation[i],
+                                   sFrames[i].reference);
+    }
+
+    printf("%d frames, %d updates, %lld ns of cpu per update\n",
+           sNumFrames, updates, (long long)(cpu / (updates ? updates : 1)));
+    if (error.count) {
+        printf("vs akmd over %u frames: azimuth/pitch/roll error "
+               "mean %.1f/%.1f/%.1f max %.1f/%.1f/%.1f degrees\n",
+               error.count, error.sum[0] / error.count,
+               error.sum[1] / error.count, error.sum[2] / error.count,
+               error.max[0], error.max[1], error.max[2]);
+    } else {
+        printf("no akmd orientation in the frames to compare with\n");
+    }
+
+    free(fused);
+    free(orientation);
+    free(sFrames);
+    return 0;
+}
@@ -0,0 +1,83 @@
+/*
+ * Copyright (C) 2010 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Checks the grace period of a sensor group going off: the driver must
+ * stay on through it and be turned off once it is over, and the deadline
+ * must be kept on CLOCK_MONOTONIC so that setting the wall clock doesn't
+ * move it.
+ */
+
+#include "sensors_host.h"
+
+#define GRACE_MS        200
+
+static int light_on(void)
+{
+    return sHostDrivers[BACKEND_LIGHT].flags[0];
+}
+
+int main(void)
+{
+    struct hw_device_t *device = NULL;
+    struct sensors_control_context_t *dev;
+    int handle = SENSORS_HANDLE_BASE + ID_L;
+    char key[32], grace[16];
+    int64_t now, off_at;
+
+    // ro.sensors.grace_ms.<name>, see include/cutils/properties.h
+    snprintf(key, sizeof(key), "ro_sensors_grace_ms_%s",
+             sBackends[BACKEND_LIGHT].name);
+    snprintf(grace, sizeof(grace), "%d", GRACE_MS);
+    setenv(key, grace, 1);
+    open_sensors(&HAL_MODULE_INFO_SYM.common, SENSORS_HARDWARE_CONTROL,
+                 &device);
+    CHECK(device);
+    if (!device)
+        return 1;
+    dev = (struct sensors_control_context_t *)device;
+
+    control__activate(dev, handle, 1);
+    CHECK(light_on());
+
+    now = clock_ns(CLOCK_MONOTONIC);
+    control__activate(dev, handle, 0);
+    pthread_mutex_lock(&dev->lock);
+    off_at = dev->power_off_at[BACKEND_LIGHT];
+    pthread_mutex_unlock(&dev->lock);
+    CHECK(light_on());
+    CHECK(off_at >= now + GRACE_MS * 1000000LL);
+    CHECK(off_at <= clock_ns(CLOCK_MONOTONIC) + GRACE_MS * 1000000LL);
+
+    usleep(GRACE_MS * 1000 / 2);
+    CHECK(light_on());
+    usleep(GRACE_MS * 1000);
+    CHECK(!light_on());
+
+    // back on within the grace period: no cold start
+    control__activate(dev, handle, 1);
+    control__activate(dev, handle, 0);
+    usleep(GRACE_MS * 1000 / 2);
+    control__activate(dev, handle, 1);
+    CHECK(light_on());
+    CHECK(dev->cold_starts_saved == 1);
+    usleep(GRACE_MS * 1000 * 2);
+    CHECK(light_on());
+
+    control__close(device);
+
+    return host_result();
+}
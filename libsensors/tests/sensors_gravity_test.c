@@ -0,0 +1,129 @@
+/*
+ * Copyright (C) 2010 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Checks how the gravity filter splits the acceleration into gravity and
+ * linear acceleration: a constant acceleration is all gravity, and a step
+ * moves over to the gravity with the time constant of the filter, the
+ * two always adding up to the acceleration.
+ */
+
+#include "sensors_host.h"
+
+// GRAVITY_TAU_NS of sensors_fusion.c
+#define TAU_MS          200
+#define PERIOD_MS       20
+
+#define EPSILON         1e-3f
+
+static int64_t sTime;
+
+/* 'frames' accelerometer frames PERIOD_MS apart, sent to data__gravity */
+static void accel(struct sensors_data_context_t *dev, float x, float y,
+                  float z, int frames)
+{
+    while (frames--) {
+        dev->sensors[ID_A].acceleration.x = x;
+        dev->sensors[ID_A].acceleration.y = y;
+        dev->sensors[ID_A].acceleration.z = z;
+        sTime += PERIOD_MS * 1000000LL;
+        uint32_t sensors = data__gravity(dev, SENSORS_AKM_ACCELERATION, sTime);
+        CHECK(sensors & SENSORS_GRAVITY);
+        CHECK(sensors & SENSORS_LINEAR_ACCELERATION);
+    }
+}
+
+static float gravity(struct sensors_data_context_t *dev, int i)
+{
+    return dev->sensors[ID_G].acceleration.v[i];
+}
+
+static float linear(struct sensors_data_context_t *dev, int i)
+{
+    return dev->sensors[ID_LA].acceleration.v[i];
+}
+
+static int near(float value, float expected)
+{
+    return fabsf(value - expected) < EPSILON;
+}
+
+int main(void)
+{
+    struct hw_device_t *device = NULL;
+    struct sensors_data_context_t *dev;
+    native_handle_t *handle;
+    int p[NUM_BACKENDS][2];
+    float left;
+    int i, n;
+
+    // without a shared block, every sensor counts as enabled
+    open_sensors(&HAL_MODULE_INFO_SYM.common, SENSORS_HARDWARE_DATA, &device);
+    CHECK(device);
+    if (!device)
+        return 1;
+    dev = (struct sensors_data_context_t *)device;
+    handle = native_handle_create(NUM_BACKENDS, 0);
+    for (i = 0; i < NUM_BACKENDS; i++) {
+        pipe(p[i]);
+        handle->data[i] = p[i][0];
+    }
+    CHECK(!data__data_open(dev, handle));
+
+    // lying flat and still: 1 g of gravity, no linear acceleration
+    accel(dev, 0.0f, 0.0f, GRAVITY_EARTH, 100);
+    CHECK(near(gravity(dev, 0), 0.0f));
+    CHECK(near(gravity(dev, 1), 0.0f));
+    CHECK(near(gravity(dev, 2), GRAVITY_EARTH));
+    for (i = 0; i < 3; i++)
+        CHECK(near(linear(dev, i), 0.0f));
+
+    /*
+     * Pushed along x by 2 m/s^2 from then on: after one time constant,
+     * what is left as linear acceleration is what a first order filter
+     * leaves, (tau / (dt + tau))^n of the step, close to 1/e.
+     */
+    n = TAU_MS / PERIOD_MS;
+    accel(dev, 2.0f, 0.0f, GRAVITY_EARTH, n);
+    left = powf((float)TAU_MS / (TAU_MS + PERIOD_MS), n);
+    CHECK(fabsf(left - expf(-1.0f)) < 0.05f);
+    CHECK(near(linear(dev, 0), 2.0f * left));
+    CHECK(near(gravity(dev, 0), 2.0f * (1.0f - left)));
+    CHECK(near(gravity(dev, 0) + linear(dev, 0), 2.0f));
+    CHECK(near(gravity(dev, 2), GRAVITY_EARTH));
+    CHECK(near(linear(dev, 2), 0.0f));
+
+    // and after ten, it is all gravity
+    accel(dev, 2.0f, 0.0f, GRAVITY_EARTH, 9 * n);
+    CHECK(near(gravity(dev, 0), 2.0f));
+    CHECK(near(linear(dev, 0), 0.0f));
+
+    // after a gap, the filter starts over from the first sample
+    sTime += 2000000000LL;
+    accel(dev, 0.0f, GRAVITY_EARTH, 0.0f, 1);
+    CHECK(near(gravity(dev, 0), 0.0f));
+    CHECK(near(gravity(dev, 1), GRAVITY_EARTH));
+    for (i = 0; i < 3; i++)
+        CHECK(near(linear(dev, i), 0.0f));
+
+    data__close(device);
+    for (i = 0; i < NUM_BACKENDS; i++) {
+        close(p[i][0]);
+        close(p[i][1]);
+    }
+
+    return host_result();
+}
@@ -0,0 +1,359 @@
+/*
+ * Copyright (C) 2010 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_SENSORS_HOST_H
+#define ANDROID_SENSORS_HOST_H
+
+/*
+ * Host builds of the sensors HAL, see Android.mk. A test includes this
+ * header rather than linking the module, so it can reach everything that
+ * is static in sensors.c. The driver nodes the control device opens are
+ * faked here, and pipes written by the test stand in for the input
+ * devices the data device reads.
+ */
+
+#include <fcntl.h>
+#include <stdarg.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+
+static int host_open(const char *path, int flags, ...);
+static int host_ioctl(int fd, int request, void *arg);
+
+#define open(...)   host_open(__VA_ARGS__)
+#define ioctl(...)  host_ioctl(__VA_ARGS__)
+#include "../sensors.c"
+#undef open
+#undef ioctl
+
+/*****************************************************************************/
+
+/*
+ * What the fake drivers were told. Like the real ones, they keep their
+ * state when the control device closes them.
+ */
+struct host_driver_t {
+    int fd;
+    // set by the test, the node then can't be opened
+    int missing;
+    int flags[MAX_NUM_SENSORS];
+    int delay;
+    uint32_t ioctls;
+};
+
+static struct host_driver_t sHostDrivers[NUM_BACKENDS] = {
+    [0 ... NUM_BACKENDS - 1] = { .fd = -1 },
+};
+
+/* every ioctl the drivers got, in order, with the value set or returned */
+struct host_ioctl_t {
+    int backend;
+    int request;
+    int value;
+};
+
+#define HOST_LOG_MAX    256
+
+static struct host_ioctl_t sHostLog[HOST_LOG_MAX];
+static int sHostLogCount;
+
+// everything else the HAL opened, and its ioctls on anything else
+static uint32_t sHostOpens;
+static uint32_t sHostIoctls;
+
+/*
+ * What EVIOCGABS answers on the input devices, once the test set it with
+ * host_set_abs(), on the pipes of the last data device opened. They are
+ * told apart by their inode, which the data device's dups share.
+ */
+static ino_t sHostInputs[NUM_BACKENDS];
+static struct input_absinfo sHostAbs[NUM_BACKENDS][ABS_MAX + 1];
+static uint64_t sHostAbsSet[NUM_BACKENDS];
+
+static int host_open(const char *path, int flags, ...)
+{
+    mode_t mode = 0;
+    int i, j;
+
+    for (i = 0; i < NUM_BACKENDS; i++) {
+        if (!strcmp(path, sBackends[i].control_node)) {
+            if (sHostDrivers[i].missing) {
+                errno = ENOENT;
+                return -1;
+            }
+            int fd = open("/dev/null", O_RDONLY);
+            // the fd of a driver closed since then can be reused
+            for (j = 0; j < NUM_BACKENDS; j++) {
+                if (sHostDrivers[j].fd == fd)
+                    sHostDrivers[j].fd = -1;
+            }
+            sHostDrivers[i].fd = fd;
+            return fd;
+        }
+    }
+    if (flags & O_CREAT) {
+        va_list args;
+        va_start(args, flags);
+        mode = va_arg(args, int);
+        va_end(args);
+    }
+    sHostOpens++;
+    return open(path, flags, mode);
+}
+
+/*
+ * A regular file stands in for an input device whose name is the first
+ * line of the file, see sensors_input_cache_test.c.
+ */
+static int host_get_name(int fd, char *name, int size)
+{
+    ssize_t n = pread(fd, name, size - 1, 0);
+    if (n < 0)
+        return -1;
+    name[n] = '\0';
+    name[strcspn(name, "\n")] = '\0';
+    return strlen(name) + 1;
+}
+
+static int host_get_abs(int fd, int code, struct input_absinfo *absinfo)
+{
+    struct stat st;
+    int i;
+
+    if (fstat(fd, &st) || !S_ISFIFO(st.st_mode))
+        return -1;
+    for (i = 0; i < NUM_BACKENDS; i++) {
+        if (st.st_ino != sHostInputs[i])
+            continue;
+        if (!(sHostAbsSet[i] & (1ULL << code)))
+            break;
+        *absinfo = sHostAbs[i][code];
+        return 0;
+    }
+    errno = EINVAL;
+    return -1;
+}
+
+static int host_ioctl(int fd, int request, void *arg)
+{
+    int i, j;
+
+    for (i = 0; i < NUM_BACKENDS; i++) {
+        const struct sensors_backend_t *b = &sBackends[i];
+        struct host_driver_t *driver = &sHostDrivers[i];
+        if (fd != driver->fd)
+            continue;
+        for (j = 0; j < b->num_flags; j++) {
+            if (request == b->flags[j].set) {
+                driver->flags[j] = b->short_flags ?
+                        *(short *)arg : *(int *)arg;
+                break;
+            }
+            if (request == b->flags[j].get) {
+                if (b->short_flags)
+                    *(short *)arg = driver->flags[j];
+                else
+                    *(int *)arg = driver->flags[j];
+                break;
+            }
+        }
+        if (j == b->num_flags) {
+            if (!b->set_delay || request != b->set_delay)
+                break;
+            driver->delay = *(short *)arg;
+        }
+        driver->ioctls++;
+        if (sHostLogCount < HOST_LOG_MAX) {
+            struct host_ioctl_t *log = &sHostLog[sHostLogCount++];
+            log->backend = i;
+            log->request = request;
+            log->value = b->short_flags || j == b->num_flags ?
+                    *(short *)arg : *(int *)arg;
+        }
+        return 0;
+    }
+    sHostIoctls++;
+    if (_IOC_TYPE(request) == 'E' &&
+            _IOC_NR(request) == _IOC_NR(EVIOCGNAME(0))) {
+        struct stat st;
+        if (!fstat(fd, &st) && S_ISREG(st.st_mode))
+            return host_get_name(fd, arg, _IOC_SIZE(request));
+    }
+    if (_IOC_TYPE(request) == 'E' &&
+            _IOC_NR(request) >= _IOC_NR(EVIOCGABS(0)) &&
+            _IOC_NR(request) <= _IOC_NR(EVIOCGABS(ABS_MAX)))
+        return host_get_abs(fd, _IOC_NR(request) - _IOC_NR(EVIOCGABS(0)),
+                            arg);
+    return ioctl(fd, request, arg);
+}
+
+/*****************************************************************************/
+
+/* a control device and a data device reading from pipes */
+struct host_sensors_t {
+    struct sensors_control_context_t *control;
+    struct sensors_data_context_t *data;
+    // write ends of the pipes the data device reads as its input devices
+    int inputs[NUM_BACKENDS];
+};
+
+/*
+ * Open a data device on the control device of host, reading from new
+ * pipes. Another one can be opened by calling this again on a copy of
+ * host, in this process or in a child.
+ */
+static int host_data_open(struct host_sensors_t *host)
+{
+    struct hw_device_t *device;
+    native_handle_t *handle;
+    int fds[NUM_BACKENDS + 3];
+    int i, numFds;
+
+    device = NULL;
+    open_sensors(&HAL_MODULE_INFO_SYM.common, SENSORS_HARDWARE_DATA, &device);
+    if (!device)
+        return -1;
+    host->data = (struct sensors_data_context_t *)device;
+
+    for (i = 0; i < NUM_BACKENDS; i++) {
+        struct stat st;
+        int p[2];
+        if (pipe(p) < 0 || fstat(p[0], &st) < 0)
+            return -1;
+        fds[i] = p[0];
+        host->inputs[i] = p[1];
+        sHostInputs[i] = st.st_ino;
+    }
+    handle = control__make_data_source(host->control, fds);
+
+    // like the framework, close the handle once the data device has it
+    numFds = handle->numFds;
+    memcpy(fds, handle->data, numFds * sizeof(int));
+    if (data__data_open(host->data, handle) < 0)
+        return -1;
+    for (i = 0; i < numFds; i++)
+        close(fds[i]);
+    return 0;
+}
+
+/*
+ * Open the control device with the sensors in the mask active and at
+ * their fastest, so no sample written to the pipes is left out.
+ */
+static int host_control_open(struct host_sensors_t *host, uint32_t sensors)
+{
+    struct hw_device_t *device;
+    int i;
+
+    // open_sensors() returns -EINVAL whatever happens, like the original
+    memset(host, 0, sizeof(*host));
+    device = NULL;
+    open_sensors(&HAL_MODULE_INFO_SYM.common, SENSORS_HARDWARE_CONTROL,
+                 &device);
+    if (!device)
+        return -1;
+    host->control = (struct sensors_control_context_t *)device;
+    control__set_delay(host->control, 0);
+    for (i = 0; i < MAX_NUM_SENSORS; i++) {
+        if (sensors & (1<<i))
+            control__activate(host->control, SENSORS_HANDLE_BASE + i, 1);
+    }
+    return 0;
+}
+
+/* both devices, see host_control_open() */
+static int host_sensors_open(struct host_sensors_t *host, uint32_t sensors)
+{
+    if (host_control_open(host, sensors) < 0)
+        return -1;
+    return host_data_open(host);
+}
+
+/* close the data device of host and its pipes */
+static void host_data_close(struct host_sensors_t *host)
+{
+    int i;
+
+    data__close(&host->data->device.base.common);
+    for (i = 0; i < NUM_BACKENDS; i++)
+        close(host->inputs[i]);
+}
+
+static void host_sensors_close(struct host_sensors_t *host)
+{
+    host_data_close(host);
+    control__close(&host->control->device.base.common);
+}
+
+/* what the driver of backend 'input' holds for axis code */
+static void host_set_abs(int input, int code, int value, int minimum,
+                         int maximum)
+{
+    struct input_absinfo *absinfo = &sHostAbs[input][code];
+
+    memset(absinfo, 0, sizeof(*absinfo));
+    absinfo->value = value;
+    absinfo->minimum = minimum;
+    absinfo->maximum = maximum;
+    sHostAbsSet[input] |= 1ULL << code;
+}
+
+/*
+ * Write an event to the input device of backend 'input', stamped 'time'
+ * (ns) of the wall clock like evdev does.
+ */
+static void host_event_at(struct host_sensors_t *host, int input,
+                          int type, int code, int value, int64_t time)
+{
+    struct input_event event;
+
+    memset(&event, 0, sizeof(event));
+    event.time.tv_sec = time / 1000000000LL;
+    event.time.tv_usec = (time % 1000000000LL) / 1000;
+    event.type = type;
+    event.code = code;
+    event.value = value;
+    write(host->inputs[input], &event, sizeof(event));
+}
+
+/* write an event to the input device of backend 'input', stamped now */
+static void host_event(struct host_sensors_t *host, int input,
+                       int type, int code, int value)
+{
+    host_event_at(host, input, type, code, value, clock_ns(CLOCK_REALTIME));
+}
+
+/*****************************************************************************/
+
+/* what every test counts its failures with */
+static int sFailures;
+
+#define CHECK(cond) do {                                            \
+        if (!(cond)) {                                              \
+            fprintf(stderr, "%s:%d: %s\n", __FILE__, __LINE__, #cond); \
+            sFailures++;                                            \
+        }                                                           \
+    } while (0)
+
+/* print the verdict of the test, and return its exit status */
+static int host_result(void)
+{
+    printf("%s\n", sFailures ? "FAILED" : "PASSED");
+    return sFailures ? 1 : 0;
+}
+
+#endif // ANDROID_SENSORS_HOST_H
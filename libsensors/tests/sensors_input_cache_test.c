@@ -0,0 +1,154 @@
+/*
+ * Copyright (C) 2010 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Checks the input device cache against a temporary directory of fake
+ * nodes, regular files holding the name of the device they stand for:
+ * nodes coming and going must be noticed through inotify, and a node that
+ * changed without inotify noticing must be caught when it is opened.
+ */
+
+#include "sensors_host.h"
+
+static char sDir[256];
+
+static void node_write(const char *node, const char *name)
+{
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s/%s", sDir, node);
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+    write(fd, name, strlen(name));
+    close(fd);
+}
+
+static void node_remove(const char *node)
+{
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s/%s", sDir, node);
+    unlink(path);
+}
+
+/*
+ * Open the inputs through the cache, returns how many nodes were opened
+ * and checks every device was found at the node expected, if any.
+ */
+static int open_check(struct input_cache_t *cache, const char * const *nodes)
+{
+    uint32_t opens = sHostOpens;
+    int fds[NUM_BACKENDS];
+    int i, err;
+
+    err = input_cache_open(cache, O_RDONLY, fds);
+    CHECK(!err == !!nodes);
+    for (i = 0; i < NUM_BACKENDS; i++) {
+        if (nodes) {
+            char path[PATH_MAX];
+            snprintf(path, sizeof(path), "%s/%s", sDir, nodes[i]);
+            CHECK(fds[i] >= 0);
+            CHECK(!strcmp(cache->paths[i], path));
+        }
+        if (fds[i] >= 0)
+            close(fds[i]);
+    }
+    return sHostOpens - opens;
+}
+
+int main(void)
+{
+    static struct input_cache_t cache = {
+        .lock = PTHREAD_MUTEX_INITIALIZER,
+        .inotify_fd = -1,
+    };
+    static const char * const first[NUM_BACKENDS] = {
+        [BACKEND_AKM] = "event0",
+        [BACKEND_CM] = "event1",
+        [BACKEND_LIGHT] = "event2",
+    };
+    static const char * const moved[NUM_BACKENDS] = {
+        [BACKEND_AKM] = "event0",
+        [BACKEND_CM] = "event5",
+        [BACKEND_LIGHT] = "event2",
+    };
+    static const char * const swapped[NUM_BACKENDS] = {
+        [BACKEND_AKM] = "event2",
+        [BACKEND_CM] = "event5",
+        [BACKEND_LIGHT] = "event0",
+    };
+    const char *tmp = getenv("TMPDIR");
+    int n;
+
+    snprintf(sDir, sizeof(sDir), "%s/sensors-input-XXXXXX", tmp ? tmp : "/tmp");
+    if (!mkdtemp(sDir)) {
+        fprintf(stderr, "Couldn't create %s (%s)\n", sDir, strerror(errno));
+        return 1;
+    }
+    input_cache_set_dir(&cache, sDir);
+
+    // nothing there yet
+    CHECK(open_check(&cache, NULL) == 0);
+
+    // the sensors show up along with a keypad: one scan opens everything
+    node_write("event0", "compass");
+    node_write("event1", "proximity");
+    node_write("event2", "lightsensor-level");
+    node_write("event3", "bravo-keypad");
+    n = open_check(&cache, first);
+    CHECK(n == 4);
+
+    // then only the cached nodes are opened
+    n = open_check(&cache, first);
+    CHECK(n == NUM_BACKENDS);
+    n = open_check(&cache, first);
+    CHECK(n == NUM_BACKENDS);
+
+    // a new node means a new scan, after which the cache is good again
+    node_write("event4", "h2w headset");
+    n = open_check(&cache, first);
+    CHECK(n == 5);
+    CHECK(open_check(&cache, first) == NUM_BACKENDS);
+
+    // a device going away and coming back at another node
+    node_remove("event1");
+    n = open_check(&cache, NULL);
+    CHECK(n == 4);
+    node_write("event5", "proximity");
+    n = open_check(&cache, moved);
+    CHECK(n == 5);
+    CHECK(open_check(&cache, moved) == NUM_BACKENDS);
+
+    // two nodes trading names in place, which inotify doesn't report: the
+    // first cached node opened turns out stale and forces a scan
+    node_write("event0", "lightsensor-level");
+    node_write("event2", "compass");
+    n = open_check(&cache, swapped);
+    CHECK(n == 1 + 5);
+    CHECK(open_check(&cache, swapped) == NUM_BACKENDS);
+
+    // pointed at another directory, the cache starts over
+    input_cache_set_dir(&cache, "/nonexistent");
+    CHECK(open_check(&cache, NULL) == 0);
+    input_cache_set_dir(&cache, sDir);
+    CHECK(open_check(&cache, swapped) == 5);
+
+    node_remove("event0");
+    node_remove("event2");
+    node_remove("event3");
+    node_remove("event4");
+    node_remove("event5");
+    rmdir(sDir);
+
+    return host_result();
+}
@@ -0,0 +1,169 @@
+/*
+ * Copyright (C) 2010 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * What reading the latest values through sensors_latest_map() costs while
+ * a data device keeps writing them: the accelerometer is fed at 1 kHz and
+ * as fast as the pipe takes it, and 0 to 8 threads read its latest value
+ * in a loop. Every frame has the same raw value on the three axes, so a
+ * torn read shows as axes that disagree.
+ *
+ *   sensors_latest_bench [seconds]
+ */
+
+#include <pthread.h>
+
+#include "sensors_host.h"
+
+#define MAX_READERS     8
+
+struct reader_t {
+    pthread_t thread;
+    uint32_t reads;
+    uint32_t retries;
+    uint32_t torn;
+    int64_t cpu;
+};
+
+static struct host_sensors_t sHost;
+static struct sensors_latest_t *sLatest;
+static volatile int sStop;
+static int sPeriodUs;
+
+static void *feed_thread(void *arg)
+{
+    int64_t start = clock_ns(CLOCK_MONOTONIC);
+    int frame;
+
+    for (frame = 0; !sStop; frame++) {
+        int value = frame % 500 + 1;
+        int64_t due = start + frame * sPeriodUs * 1000LL, now;
+        while (sPeriodUs && (now = clock_ns(CLOCK_MONOTONIC)) < due) {
+            struct timespec ts = { 0, due - now };
+            nanosleep(&ts, NULL);
+        }
+        host_event(&sHost, BACKEND_AKM, EV_ABS, EVENT_TYPE_ACCEL_X, value);
+        host_event(&sHost, BACKEND_AKM, EV_ABS, EVENT_TYPE_ACCEL_Y, value);
+        host_event(&sHost, BACKEND_AKM, EV_ABS, EVENT_TYPE_ACCEL_Z, value);
+        host_event(&sHost, BACKEND_AKM, EV_SYN, SYN_REPORT, 0);
+    }
+    return NULL;
+}
+
+static void *read_thread(void *arg)
+{
+    struct reader_t *reader = arg;
+    int64_t cpu = clock_ns(CLOCK_THREAD_CPUTIME_ID);
+    sensors_data_t data;
+
+    while (!sStop) {
+        int err = sensors_latest_read(sLatest, SENSORS_HANDLE_BASE + ID_A,
+                                      &data);
+        if (err == -EAGAIN)
+            reader->retries++;
+        if (err)
+            continue;
+        reader->reads++;
+        long x = lrintf(data.vector.v[0] / sAkmScales[ID_A][0]);
+        if (lrintf(data.vector.v[1] / sAkmScales[ID_A][1]) != x ||
+                lrintf(data.vector.v[2] / sAkmScales[ID_A][2]) != x)
+            reader->torn++;
+    }
+    reader->cpu = clock_ns(CLOCK_THREAD_CPUTIME_ID) - cpu;
+    return NULL;
+}
+
+/* map the values the way another process holding the data source would */
+static struct sensors_latest_t *map_latest(void)
+{
+    native_handle_t *handle;
+    struct sensors_latest_t *latest;
+    int i;
+
+    handle = native_handle_create(SENSORS_LATEST_FD_INDEX + 1, 0);
+    for (i = 0; i < handle->numFds; i++)
+        handle->data[i] = -1;
+    handle->data[SENSORS_LATEST_FD_INDEX] = dup(sHost.control->shared_fd);
+    latest = sensors_latest_map(handle);
+    close(handle->data[SENSORS_LATEST_FD_INDEX]);
+    native_handle_delete(handle);
+    return latest;
+}
+
+static void run(int rate, int readers, int seconds)
+{
+    struct reader_t reader[MAX_READERS];
+    sensors_data_t data[16];
+    pthread_t feeder;
+    uint32_t samples = 0, reads = 0, retries = 0, torn = 0;
+    int64_t start, cpu, readCpu = 0;
+    int i;
+
+    if (host_sensors_open(&sHost, SENSORS_AKM_ACCELERATION) < 0) {
+        fprintf(stderr, "Couldn't open the sensors\n");
+        exit(1);
+    }
+    sLatest = map_latest();
+    if (!sLatest) {
+        fprintf(stderr, "Couldn't map the latest values\n");
+        exit(1);
+    }
+    sStop = 0;
+    sPeriodUs = rate ? 1000000 / rate : 0;
+    memset(reader, 0, sizeof(reader));
+    pthread_create(&feeder, NULL, feed_thread, NULL);
+    for (i = 0; i < readers; i++)
+        pthread_create(&reader[i].thread, NULL, read_thread, &reader[i]);
+
+    cpu = clock_ns(CLOCK_THREAD_CPUTIME_ID);
+    start = clock_ns(CLOCK_MONOTONIC);
+    while (clock_ns(CLOCK_MONOTONIC) - start < seconds * 1000000000LL) {
+        int n = data__poll_batch(sHost.data, data, ARRAY_SIZE(data));
+        if (n <= 0)
+            break;
+        samples += n;
+    }
+    cpu = clock_ns(CLOCK_THREAD_CPUTIME_ID) - cpu;
+    sStop = 1;
+    pthread_join(feeder, NULL);
+    for (i = 0; i < readers; i++) {
+        pthread_join(reader[i].thread, NULL);
+        reads += reader[i].reads;
+        retries += reader[i].retries;
+        torn += reader[i].torn;
+        readCpu += reader[i].cpu;
+    }
+
+    printf("%-8s %d readers: %8u samples, %5lld ns of poll cpu per sample, "
+           "%10u reads/s, %4lld ns per read, %u gave up, %u torn\n",
+           rate ? "1000 Hz" : "flat out", readers, samples,
+           (long long)(cpu / (samples ? samples : 1)), reads / seconds,
+           (long long)(readCpu / (reads ? reads : 1)), retries, torn);
+    sensors_latest_unmap(sLatest);
+    host_sensors_close(&sHost);
+}
+
+int main(int argc, char **argv)
+{
+    int seconds = argc > 1 ? atoi(argv[1]) : 5;
+    int readers;
+
+    for (readers = 0; readers <= MAX_READERS; readers = readers ? readers * 2 : 1)
+        run(1000, readers, seconds);
+    for (readers = 0; readers <= MAX_READERS; readers = readers ? readers * 2 : 1)
+        run(0, readers, seconds);
+    return 0;
+}
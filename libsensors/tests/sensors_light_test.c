@@ -0,0 +1,73 @@
+/*
+ * Copyright (C) 2010 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Checks that decoding the light and proximity events is only arithmetic
+ * on what data_open read from the drivers: no ioctl per event, where the
+ * light decoder used to make one, and the right lux and distance for
+ * every value.
+ */
+
+#include "sensors_host.h"
+
+#define EVENTS          100
+#define LIGHT_LEVELS    10
+
+int main(void)
+{
+    struct host_sensors_t host;
+    sensors_data_t data;
+    uint32_t ioctls;
+    int i, level;
+
+    setenv("ro_sensors_reader_thread", "0", 1);
+    host_set_abs(BACKEND_CM, EVENT_TYPE_PROXIMITY, 1, 0, 1);
+    host_set_abs(BACKEND_LIGHT, EVENT_TYPE_LIGHT, 0, 0, LIGHT_LEVELS - 1);
+    if (host_sensors_open(&host, SENSORS_CM_PROXIMITY | SENSORS_LIGHT) < 0) {
+        CHECK(!"host_sensors_open");
+        return host_result();
+    }
+
+    // the values there were at open
+    CHECK(data__poll(host.data, &data) >= 0);
+    CHECK(data__poll(host.data, &data) >= 0);
+
+    ioctls = sHostIoctls;
+    for (i = 0; i < EVENTS; i++) {
+        level = i % LIGHT_LEVELS;
+        host_event(&host, BACKEND_LIGHT, EV_ABS, EVENT_TYPE_LIGHT, level);
+        host_event(&host, BACKEND_LIGHT, EV_SYN, SYN_REPORT, 0);
+        CHECK(data__poll(host.data, &data) == ID_L);
+        // the levels above the table read as its last value
+        if (level >= (int)ARRAY_SIZE(sLuxValues))
+            level = ARRAY_SIZE(sLuxValues) - 1;
+        CHECK(data.light == sLuxValues[level]);
+    }
+    printf("%.2f ioctls per light event\n",
+           (float)(sHostIoctls - ioctls) / EVENTS);
+    CHECK(sHostIoctls == ioctls);
+
+    for (i = 0; i < EVENTS; i++) {
+        host_event(&host, BACKEND_CM, EV_ABS, EVENT_TYPE_PROXIMITY, i & 1);
+        host_event(&host, BACKEND_CM, EV_SYN, SYN_REPORT, 0);
+        CHECK(data__poll(host.data, &data) == ID_P);
+        CHECK(data.distance == ((i & 1) ? PROXIMITY_THRESHOLD_CM : 0.0f));
+    }
+    CHECK(sHostIoctls == ioctls);
+
+    host_sensors_close(&host);
+    return host_result();
+}
@@ -0,0 +1,285 @@
+/*
+ * Copyright (C) 2010 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * How the data device orders the samples of sensors running at different
+ * rates, and how long each sensor waits to be returned.
+ *
+ * The merge itself is first run on a simulated clock, filling the queues
+ * of a data device directly, against the policy it replaced (the highest
+ * numbered pending sensor first): the compass at 200 Hz with the fused
+ * sensors, proximity at 5 Hz and light at about 10 Hz, read by a consumer
+ * that stalls for 100 ms every 500 ms. The same is then run with a light
+ * sensor flooding the queues with samples stamped 10 s in the past, to
+ * show the skip bound keeps the other sensors going. Last, the whole data device is run in
+ * real time, fed through the input pipes.
+ *
+ *   sensors_merge_bench [seconds]
+ */
+
+#include <pthread.h>
+
+#include "sensors_host.h"
+
+#define MS                      1000000LL
+
+#define AKM_PERIOD_MS           5
+#define PROXIMITY_PERIOD_MS     200
+#define LIGHT_PERIOD_MS         97
+#define READ_PERIOD_MS          10
+#define READ_BURST              32
+#define STALL_EVERY_MS          500
+#define STALL_MS                100
+#define QUEUE_DEPTH             "64"
+// more than READ_BURST per READ_PERIOD_MS
+#define SKEWED_LIGHT_PER_MS     4
+
+static const int sAkmIds[] = { ID_A, ID_M, ID_O, ID_T, ID_RV, ID_G, ID_LA };
+
+static const char *sNames[MAX_NUM_SENSORS] = {
+    [ID_A] = "acc", [ID_M] = "mag", [ID_O] = "ori", [ID_T] = "tmp",
+    [ID_P] = "prx", [ID_L] = "lux", [ID_RV] = "rv", [ID_G] = "grv",
+    [ID_LA] = "lin",
+};
+
+struct merge_stats_t {
+    uint32_t samples[MAX_NUM_SENSORS];
+    int64_t max_wait[MAX_NUM_SENSORS];
+    int64_t total_wait[MAX_NUM_SENSORS];
+    uint32_t inversions;
+    int64_t max_inversion;
+    int64_t last;
+};
+
+static void stats_add(struct merge_stats_t *stats, int id, int64_t t,
+                      int64_t now)
+{
+    int64_t wait = now - t;
+    stats->samples[id]++;
+    stats->total_wait[id] += wait;
+    if (wait > stats->max_wait[id])
+        stats->max_wait[id] = wait;
+    if (t < stats->last) {
+        stats->inversions++;
+        if (stats->last - t > stats->max_inversion)
+            stats->max_inversion = stats->last - t;
+    } else {
+        stats->last = t;
+    }
+}
+
+static void stats_print(const char *name, struct merge_stats_t *stats,
+                        uint32_t ids)
+{
+    int i;
+    printf("%-22s %6u inversions (max %4lld ms), max/mean wait ms:",
+           name, stats->inversions, (long long)(stats->max_inversion / MS));
+    for (i = 0; i < MAX_NUM_SENSORS; i++) {
+        if (!(ids & (1<<i)) || !stats->samples[i])
+            continue;
+        printf(" %s %lld/%.1f", sNames[i],
+               (long long)(stats->max_wait[i] / MS),
+               stats->samples[i] ? stats->total_wait[i] /
+                       (double)stats->samples[i] / MS : 0.0);
+    }
+    printf("\n");
+}
+
+/* the policy pick_sensor() replaced */
+static int pick_highest(struct sensors_data_context_t *dev,
+                        sensors_data_t *values)
+{
+    int i = 31 - __builtin_clz(dev->pendingSensors);
+    struct sensor_queue_t *q = &dev->queues[i];
+    sensor_queue_pop(q, values);
+    if (!q->count)
+        dev->pendingSensors &= ~(1<<i);
+    values->sensor = id_to_sensor[i];
+    return i;
+}
+
+static void push(struct sensors_data_context_t *dev, int id, int64_t t)
+{
+    sensors_data_t data;
+    memset(&data, 0, sizeof(data));
+    data.time = t;
+    sensor_queue_push(&dev->queues[id], &data);
+    dev->pendingSensors |= 1<<id;
+}
+
+static void reset(struct sensors_data_context_t *dev)
+{
+    int i;
+    for (i = 0; i < MAX_NUM_SENSORS; i++) {
+        struct sensor_queue_t *q = &dev->queues[i];
+        q->head = q->count = q->drops = q->skips = 0;
+    }
+    dev->pendingSensors = 0;
+    dev->lastPicked = 0;
+}
+
+/*
+ * Run the merge on a simulated clock for 'seconds'. With light_skew, the
+ * light samples are stamped that much in the past and come faster than
+ * they are read.
+ */
+static void simulate(struct sensors_data_context_t *dev, int old_policy,
+                     int64_t light_skew, int seconds,
+                     struct merge_stats_t *stats)
+{
+    int64_t now;
+    uint32_t i;
+
+    reset(dev);
+    memset(stats, 0, sizeof(*stats));
+    for (now = 0; now < seconds * 1000 * MS; now += MS) {
+        int ms = now / MS;
+        if (ms % AKM_PERIOD_MS == 0) {
+            for (i = 0; i < ARRAY_SIZE(sAkmIds); i++)
+                push(dev, sAkmIds[i], now);
+        }
+        if (ms % PROXIMITY_PERIOD_MS == 3)
+            push(dev, ID_P, now);
+        if (light_skew) {
+            for (i = 0; i < SKEWED_LIGHT_PER_MS; i++)
+                push(dev, ID_L, now - light_skew);
+        } else if (ms % LIGHT_PERIOD_MS == 0) {
+            push(dev, ID_L, now);
+        }
+
+        if (ms % READ_PERIOD_MS || ms % STALL_EVERY_MS < STALL_MS)
+            continue;
+        for (i = 0; i < READ_BURST && dev->pendingSensors; i++) {
+            sensors_data_t data;
+            int id = old_policy ? pick_highest(dev, &data) :
+                    pick_sensor(dev, &data);
+            // the skewed light stamps are bogus, don't count them
+            stats_add(stats, id, data.time + (id == ID_L ? light_skew : 0),
+                      now);
+        }
+    }
+}
+
+/*****************************************************************************/
+
+static struct host_sensors_t sHost;
+static volatile int sStop;
+
+static void *feed_thread(void *arg)
+{
+    int64_t start = clock_ns(CLOCK_MONOTONIC);
+    int ms;
+
+    for (ms = 0; !sStop; ms++) {
+        int64_t due = start + ms * MS, now;
+        while ((now = clock_ns(CLOCK_MONOTONIC)) < due) {
+            struct timespec ts = { 0, due - now };
+            nanosleep(&ts, NULL);
+        }
+        if (ms % AKM_PERIOD_MS == 0) {
+            host_event(&sHost, BACKEND_AKM, EV_ABS, EVENT_TYPE_ACCEL_X, ms);
+            host_event(&sHost, BACKEND_AKM, EV_ABS, EVENT_TYPE_MAGV_X, ms);
+            host_event(&sHost, BACKEND_AKM, EV_ABS, EVENT_TYPE_YAW, ms);
+            host_event(&sHost, BACKEND_AKM, EV_ABS, EVENT_TYPE_TEMPERATURE, 25);
+            host_event(&sHost, BACKEND_AKM, EV_SYN, SYN_REPORT, 0);
+        }
+        if (ms % PROXIMITY_PERIOD_MS == 3) {
+            host_event(&sHost, BACKEND_CM, EV_ABS, EVENT_TYPE_PROXIMITY,
+                       (ms / PROXIMITY_PERIOD_MS) & 1);
+            host_event(&sHost, BACKEND_CM, EV_SYN, SYN_REPORT, 0);
+        }
+        if (ms % LIGHT_PERIOD_MS == 0) {
+            host_event(&sHost, BACKEND_LIGHT, EV_ABS, EVENT_TYPE_LIGHT,
+                       (ms / LIGHT_PERIOD_MS) % 10);
+            host_event(&sHost, BACKEND_LIGHT, EV_SYN, SYN_REPORT, 0);
+        }
+    }
+    return NULL;
+}
+
+static void run_device(int seconds, struct merge_stats_t *stats)
+{
+    int64_t start, next_stall;
+    pthread_t feeder;
+
+    memset(stats, 0, sizeof(*stats));
+    pthread_create(&feeder, NULL, feed_thread, NULL);
+    start = clock_ns(CLOCK_MONOTONIC);
+    next_stall = start + STALL_EVERY_MS * MS;
+    while (1) {
+        sensors_data_t data[8];
+        int64_t now = clock_ns(CLOCK_MONOTONIC);
+        int i, n;
+        if (now - start > seconds * 1000 * MS)
+            break;
+        if (now > next_stall) {
+            usleep(STALL_MS * 1000);
+            next_stall += STALL_EVERY_MS * MS;
+        }
+        n = data__poll_batch(sHost.data, data, ARRAY_SIZE(data));
+        now = clock_ns(CLOCK_MONOTONIC);
+        for (i = 0; i < n; i++)
+            stats_add(stats, sensor_to_id(data[i].sensor), data[i].time, now);
+    }
+    sStop = 1;
+    pthread_join(feeder, NULL);
+}
+
+int main(int argc, char **argv)
+{
+    struct merge_stats_t stats;
+    uint32_t all = 0;
+    uint32_t i;
+    int seconds = argc > 1 ? atoi(argv[1]) : 10;
+
+    for (i = 0; i < ARRAY_SIZE(sAkmIds); i++)
+        all |= 1 << sAkmIds[i];
+    all |= SENSORS_CM_PROXIMITY | SENSORS_LIGHT;
+    // deep enough for a stall, so samples wait rather than get dropped
+    setenv("ro_sensors_queue_depth", QUEUE_DEPTH, 1);
+    if (host_sensors_open(&sHost, all) < 0) {
+        fprintf(stderr, "Couldn't open the sensors\n");
+        return 1;
+    }
+    struct sensors_data_context_t *dev = sHost.data;
+
+    printf("simulated, %d s, queues of %u, skip bound %u:\n", seconds,
+           dev->queues[0].depth, dev->maxSkips);
+    simulate(dev, 1, 0, seconds, &stats);
+    stats_print("highest id first", &stats, all);
+    simulate(dev, 0, 0, seconds, &stats);
+    stats_print("oldest first", &stats, all);
+
+    printf("simulated, light at %d kHz stamped 10 s late:\n",
+           SKEWED_LIGHT_PER_MS);
+    simulate(dev, 1, 10000 * MS, seconds, &stats);
+    stats_print("highest id first", &stats, all);
+    uint32_t bound = dev->maxSkips;
+    dev->maxSkips = UINT32_MAX;
+    simulate(dev, 0, 10000 * MS, seconds, &stats);
+    stats_print("oldest first, no bound", &stats, all);
+    dev->maxSkips = bound;
+    simulate(dev, 0, 10000 * MS, seconds, &stats);
+    stats_print("oldest first", &stats, all);
+    reset(dev);
+
+    printf("data device, real time, %d s:\n", seconds);
+    run_device(seconds, &stats);
+    stats_print("oldest first", &stats, all);
+
+    host_sensors_close(&sHost);
+    return 0;
+}
@@ -0,0 +1,214 @@
+/*
+ * Copyright (C) 2010 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * What watching for the device to be picked up costs, with the
+ * significant motion sensor and with an app reading the accelerometer
+ * itself at 20 and 200 ms. There is no current to measure on the host:
+ * the time the accelerometer is on and the frames it sends stand in for
+ * it, along with the wakeups and the cpu of the caller of poll_batch().
+ * A fake BMA150 samples at the delay programmed, only while it is on.
+ * The device lies on a table, is knocked a third of the way through, and
+ * is picked up at the end.
+ *
+ *   sensors_motion_bench [seconds]
+ */
+
+#include <math.h>
+#include <pthread.h>
+
+#include "sensors_host.h"
+
+// how often the fake driver looks at its flag, the resolution of on-time
+#define TICK_MS         10
+// how long after the pickup the app is watched for
+#define AFTER_MS        3000
+
+static struct host_sensors_t sHost;
+static volatile int sStop;
+static int sSeconds;
+static int64_t sStart;
+
+// kept by the driver thread
+static int64_t sOnNs;
+static int64_t sPickedUp;
+static volatile int sFrames;
+static int sTableFrames;
+
+static double gauss(void)
+{
+    double u = (rand() + 1.0) / (RAND_MAX + 2.0);
+    double v = (rand() + 1.0) / (RAND_MAX + 2.0);
+    return sqrt(-2.0 * log(u)) * cos(2.0 * M_PI * v);
+}
+
+static int accel_on(void)
+{
+    int j;
+    for (j = 0; j < sBackends[BACKEND_AKM].num_flags; j++) {
+        if (sAkmFlags[j].sensors == SENSORS_AKM_ACCELERATION)
+            return sHostDrivers[BACKEND_AKM].flags[j];
+    }
+    return 0;
+}
+
+/* a frame of the device at 't' s, a in m/s^2 */
+static void frame(double t)
+{
+    const float *scale = sAkmScales[ID_A];
+    double a[3] = { 0.0, 0.0, 9.81 };
+    int i;
+
+    // knocked on the table
+    if (t >= sSeconds / 3.0 && t < sSeconds / 3.0 + 0.05)
+        a[2] += 6.0;
+    // picked up: tilted towards the user over a second, and shaking
+    if (t >= sSeconds) {
+        double tilt = (t - sSeconds < 1.0 ? t - sSeconds : 1.0) * 1.2;
+        a[1] = 9.81 * sin(tilt);
+        a[2] = 9.81 * cos(tilt);
+        a[0] = 0.8 * sin(2.0 * M_PI * 1.5 * t);
+        if (!sPickedUp)
+            sPickedUp = clock_ns(CLOCK_MONOTONIC);
+    }
+    for (i = 0; i < 3; i++)
+        a[i] += 0.15 * gauss();
+    host_event(&sHost, BACKEND_AKM, EV_ABS, EVENT_TYPE_ACCEL_X,
+               (int)lrint(a[0] / scale[0]));
+    host_event(&sHost, BACKEND_AKM, EV_ABS, EVENT_TYPE_ACCEL_Y,
+               (int)lrint(a[1] / scale[1]));
+    host_event(&sHost, BACKEND_AKM, EV_ABS, EVENT_TYPE_ACCEL_Z,
+               (int)lrint(a[2] / scale[2]));
+    host_event(&sHost, BACKEND_AKM, EV_SYN, SYN_REPORT, 0);
+    sFrames++;
+    if (t < sSeconds)
+        sTableFrames++;
+}
+
+/* the BMA150, until sStop */
+static void *driver_thread(void *arg)
+{
+    int64_t tick = sStart, due = sStart;
+    int woken = 0;
+
+    (void)arg;
+    while (!sStop) {
+        int64_t now;
+        while ((now = clock_ns(CLOCK_MONOTONIC)) < tick) {
+            struct timespec ts = { 0, tick - now };
+            nanosleep(&ts, NULL);
+        }
+        tick += TICK_MS * 1000000LL;
+        if (!accel_on()) {
+            due = tick;
+        } else {
+            sOnNs += TICK_MS * 1000000LL;
+            if (now >= due) {
+                int delay = sHostDrivers[BACKEND_AKM].delay;
+                due += (delay > TICK_MS ? delay : TICK_MS) * 1000000LL;
+                frame((now - sStart) / 1e9);
+            }
+        }
+        // an app that is never told the device was picked up gives up
+        if (!woken && now - sStart >
+                sSeconds * 1000000000LL + AFTER_MS * 1000000LL) {
+            control__wake(sHost.control);
+            woken = 1;
+        }
+    }
+    return NULL;
+}
+
+/* delay < 0 for the significant motion, the app's delay in ms otherwise */
+static void run(int delay)
+{
+    const char *name = delay < 0 ? "significant motion" : "app reading";
+    sensors_data_t data[16];
+    pthread_t driver;
+    int returns = 0, accel = 0, fired = 0;
+    int64_t cpu, firedAt = 0, end;
+    int i, n;
+
+    if (host_sensors_open(&sHost, 0) < 0) {
+        fprintf(stderr, "Couldn't open the sensors\n");
+        exit(1);
+    }
+    if (delay < 0) {
+        control__activate(sHost.control, SENSORS_HANDLE_BASE + ID_SM, 1);
+    } else {
+        control__set_delay_handle(sHost.control, SENSORS_HANDLE_BASE + ID_A,
+                                  delay);
+        control__activate(sHost.control, SENSORS_HANDLE_BASE + ID_A, 1);
+    }
+
+    sStop = 0;
+    sOnNs = sPickedUp = 0;
+    sFrames = sTableFrames = 0;
+    srand(1);
+    sStart = clock_ns(CLOCK_MONOTONIC);
+    pthread_create(&driver, NULL, driver_thread, NULL);
+
+    cpu = clock_ns(CLOCK_THREAD_CPUTIME_ID);
+    while (!fired && (n = data__poll_batch(sHost.data, data,
+                                           ARRAY_SIZE(data))) > 0) {
+        returns++;
+        for (i = 0; i < n; i++) {
+            if (data[i].sensor == id_to_sensor[ID_A])
+                accel++;
+            if (data[i].sensor == id_to_sensor[ID_SM]) {
+                fired++;
+                firedAt = clock_ns(CLOCK_MONOTONIC);
+            }
+        }
+    }
+    cpu = clock_ns(CLOCK_THREAD_CPUTIME_ID) - cpu;
+
+    // the app stops, then the accelerometer goes off after its grace period
+    if (delay >= 0)
+        control__activate(sHost.control, SENSORS_HANDLE_BASE + ID_A, 0);
+    end = sStart + sSeconds * 1000000000LL + AFTER_MS * 1000000LL;
+    while (clock_ns(CLOCK_MONOTONIC) < end)
+        usleep(TICK_MS * 1000);
+    sStop = 1;
+    pthread_join(driver, NULL);
+
+    if (delay < 0)
+        printf("%-18s       ", name);
+    else
+        printf("%-18s %3d ms", name, delay);
+    printf(" %5d frames/min on the table, accel on %5.1f of %4.1f s, "
+           "%5d poll returns, %5d accel samples, %6lld us of poll cpu",
+           sTableFrames * 60 / sSeconds, sOnNs / 1e9,
+           sSeconds + AFTER_MS / 1000.0, returns, accel,
+           (long long)(cpu / 1000));
+    if (delay < 0)
+        printf(", fired %d %lld ms after the pickup", fired,
+               firedAt ? (long long)((firedAt - sPickedUp) / 1000000) : -1LL);
+    printf("\n");
+    host_sensors_close(&sHost);
+}
+
+int main(int argc, char **argv)
+{
+    sSeconds = argc > 1 ? atoi(argv[1]) : 20;
+    if (sSeconds <= 0)
+        sSeconds = 20;
+
+    run(-1);
+    run(20);
+    run(200);
+    return 0;
+}
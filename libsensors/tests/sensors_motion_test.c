@@ -0,0 +1,83 @@
+/*
+ * Copyright (C) 2010 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Checks significant motion fires again without a shared block, where
+ * nothing tells the data device it was enabled again: it must be armed
+ * again right after it fired, from the position the device ended up in.
+ */
+
+#include "sensors_host.h"
+
+static int64_t sTime;
+
+/* 'frames' accelerometer frames SIGNIFICANT_MOTION_DELAY_MS apart */
+static int motion(struct sensors_data_context_t *dev, float x, float y,
+                  float z, int frames)
+{
+    int fired = 0;
+    while (frames--) {
+        dev->sensors[ID_A].acceleration.x = x;
+        dev->sensors[ID_A].acceleration.y = y;
+        dev->sensors[ID_A].acceleration.z = z;
+        sTime += SIGNIFICANT_MOTION_DELAY_MS * 1000000LL;
+        if (data__significant_motion(dev, SENSORS_AKM_ACCELERATION, sTime) &
+                SENSORS_SIGNIFICANT_MOTION)
+            fired++;
+    }
+    return fired;
+}
+
+int main(void)
+{
+    struct hw_device_t *device = NULL;
+    struct sensors_data_context_t *dev;
+    native_handle_t *handle;
+    int p[NUM_BACKENDS][2];
+    int i;
+
+    // the data source of an old framework: the input devices and no more
+    open_sensors(&HAL_MODULE_INFO_SYM.common, SENSORS_HARDWARE_DATA, &device);
+    CHECK(device);
+    if (!device)
+        return 1;
+    dev = (struct sensors_data_context_t *)device;
+    handle = native_handle_create(NUM_BACKENDS, 0);
+    for (i = 0; i < NUM_BACKENDS; i++) {
+        pipe(p[i]);
+        handle->data[i] = p[i][0];
+    }
+    CHECK(!data__data_open(dev, handle));
+    CHECK(!dev->shared);
+
+    // lying on the table, then picked up
+    CHECK(!motion(dev, 0.0f, 0.0f, 9.81f, 10));
+    CHECK(motion(dev, 0.0f, 6.0f, 7.7f, 5) == 1);
+
+    // held where it was picked up to
+    CHECK(!motion(dev, 0.0f, 6.0f, 7.7f, 10));
+
+    // and put down again
+    CHECK(motion(dev, 0.0f, 0.0f, 9.81f, 5) == 1);
+
+    data__close(device);
+    for (i = 0; i < NUM_BACKENDS; i++) {
+        close(p[i][0]);
+        close(p[i][1]);
+    }
+
+    return host_result();
+}
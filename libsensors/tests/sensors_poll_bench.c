@@ -0,0 +1,111 @@
+/*
+ * Copyright (C) 2010 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * What returning one sample per poll() call costs next to poll_batch():
+ * the compass is fed at 200 Hz and 1 kHz, each frame updating the
+ * accelerometer, magnetic field, orientation and temperature and the fused
+ * sensors, and read with poll() and with poll_batch() 16 at a time.
+ *
+ *   sensors_poll_bench [seconds]
+ */
+
+#include <pthread.h>
+#include <sys/resource.h>
+
+#include "sensors_host.h"
+
+static struct host_sensors_t sHost;
+static volatile int sStop;
+static int sPeriodUs;
+
+static void *feed_thread(void *arg)
+{
+    int64_t start = clock_ns(CLOCK_MONOTONIC);
+    int frame;
+
+    for (frame = 0; !sStop; frame++) {
+        int64_t due = start + frame * sPeriodUs * 1000LL, now;
+        while ((now = clock_ns(CLOCK_MONOTONIC)) < due) {
+            struct timespec ts = { 0, due - now };
+            nanosleep(&ts, NULL);
+        }
+        host_event(&sHost, BACKEND_AKM, EV_ABS, EVENT_TYPE_ACCEL_X, frame & 63);
+        host_event(&sHost, BACKEND_AKM, EV_ABS, EVENT_TYPE_ACCEL_Z, -700);
+        host_event(&sHost, BACKEND_AKM, EV_ABS, EVENT_TYPE_MAGV_X, 120);
+        host_event(&sHost, BACKEND_AKM, EV_ABS, EVENT_TYPE_YAW, frame % 360);
+        host_event(&sHost, BACKEND_AKM, EV_ABS, EVENT_TYPE_TEMPERATURE, 25);
+        host_event(&sHost, BACKEND_AKM, EV_SYN, SYN_REPORT, 0);
+    }
+    return NULL;
+}
+
+static void run(int rate, int batch, int seconds)
+{
+    sensors_data_t data[16];
+    struct rusage r0, r1;
+    pthread_t feeder;
+    uint32_t calls = 0, samples = 0;
+    int64_t start, cpu;
+
+    if (host_sensors_open(&sHost, SENSORS_AKM_GROUP | fusion_sensors()) < 0) {
+        fprintf(stderr, "Couldn't open the sensors\n");
+        exit(1);
+    }
+    sStop = 0;
+    sPeriodUs = 1000000 / rate;
+    pthread_create(&feeder, NULL, feed_thread, NULL);
+
+    getrusage(RUSAGE_THREAD, &r0);
+    cpu = clock_ns(CLOCK_THREAD_CPUTIME_ID);
+    start = clock_ns(CLOCK_MONOTONIC);
+    while (clock_ns(CLOCK_MONOTONIC) - start < seconds * 1000000000LL) {
+        int n;
+        if (batch) {
+            n = data__poll_batch(sHost.data, data, batch);
+        } else {
+            n = data__poll(sHost.data, data);
+            n = n == 0x7FFFFFFF ? 0 : n >= 0;
+        }
+        if (n <= 0)
+            break;
+        calls++;
+        samples += n;
+    }
+    cpu = clock_ns(CLOCK_THREAD_CPUTIME_ID) - cpu;
+    getrusage(RUSAGE_THREAD, &r1);
+    sStop = 1;
+    pthread_join(feeder, NULL);
+
+    long switches = (r1.ru_nvcsw - r0.ru_nvcsw) + (r1.ru_nivcsw - r0.ru_nivcsw);
+    printf("%4d Hz %-15s %7u samples, %7u calls/s, %5.2f samples/call, "
+           "%6lld ns of cpu per sample, %5ld switches/s\n",
+           rate, batch ? "poll_batch(16)" : "poll", samples, calls / seconds,
+           calls ? samples / (double)calls : 0.0,
+           (long long)(cpu / (samples ? samples : 1)), switches / seconds);
+    host_sensors_close(&sHost);
+}
+
+int main(int argc, char **argv)
+{
+    int seconds = argc > 1 ? atoi(argv[1]) : 5;
+
+    run(200, 0, seconds);
+    run(200, 16, seconds);
+    run(1000, 0, seconds);
+    run(1000, 16, seconds);
+    return 0;
+}
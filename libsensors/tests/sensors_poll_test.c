@@ -0,0 +1,59 @@
+/*
+ * Copyright (C) 2010 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Checks that data__poll only ever reports a wake when control__wake()
+ * asked for one: a pending bit no queue stands behind is dropped, and
+ * data__poll goes on waiting for a real sample.
+ */
+
+#include "sensors_host.h"
+
+// a data__poll still waiting by then is waiting for good
+#define TIMEOUT_S       5
+
+int main(void)
+{
+    struct host_sensors_t host;
+    sensors_data_t values[4];
+    uint32_t stale = 1 << MAX_NUM_SENSORS;
+    int n;
+
+    setenv("ro_sensors_reader_thread", "0", 1);
+    if (host_sensors_open(&host, SENSORS_AKM_ACCELERATION) < 0) {
+        CHECK(!"host_sensors_open");
+        return host_result();
+    }
+    alarm(TIMEOUT_S);
+
+    // only a stale bit is pending: no wake, the next frame is returned
+    host.data->pendingSensors = stale;
+    host_event(&host, BACKEND_AKM, EV_ABS, EVENT_TYPE_ACCEL_X, 1);
+    host_event(&host, BACKEND_AKM, EV_SYN, SYN_REPORT, 0);
+    n = data__poll_batch(host.data, values, ARRAY_SIZE(values));
+    CHECK(n == 1);
+    CHECK(values[0].sensor == id_to_sensor[ID_A]);
+    CHECK(!(host.data->pendingSensors & stale));
+
+    // and a wake is still one
+    control__wake(host.control);
+    CHECK(data__poll_batch(host.data, values, ARRAY_SIZE(values)) == 0);
+    control__wake(host.control);
+    CHECK(data__poll(host.data, values) == 0x7FFFFFFF);
+
+    host_sensors_close(&host);
+    return host_result();
+}
@@ -0,0 +1,69 @@
+/*
+ * Copyright (C) 2010 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Checks that data__poll fails, instead of waiting forever, once the
+ * reader thread can't read the input devices any more, and that what it
+ * decoded before that is still returned first.
+ */
+
+#include "sensors_host.h"
+
+// a data__poll still waiting by then is waiting for good
+#define TIMEOUT_S       5
+
+static void accel_frame(struct host_sensors_t *host, int value)
+{
+    host_event(host, BACKEND_AKM, EV_ABS, EVENT_TYPE_ACCEL_X, value);
+    host_event(host, BACKEND_AKM, EV_SYN, SYN_REPORT, 0);
+}
+
+int main(void)
+{
+    struct host_sensors_t host;
+    sensors_data_t values[4];
+    int fd, n;
+
+    setenv("ro_sensors_reader_thread", "1", 1);
+    if (host_sensors_open(&host, SENSORS_AKM_ACCELERATION) < 0) {
+        CHECK(!"host_sensors_open");
+        return host_result();
+    }
+    CHECK(host.data->use_reader);
+    alarm(TIMEOUT_S);
+
+    /*
+     * Once the reader thread has queued the frame and is back waiting on
+     * its epoll fd, swap that for something that isn't one: the next
+     * event wakes it up, and its next epoll_wait() fails.
+     */
+    accel_frame(&host, 1);
+    usleep(20000);
+    fd = open("/dev/null", O_RDONLY);
+    dup2(fd, host.data->reader.epoll_fd);
+    close(fd);
+    host_event(&host, BACKEND_AKM, EV_SYN, SYN_REPORT, 0);
+
+    n = data__poll_batch(host.data, values, ARRAY_SIZE(values));
+    CHECK(n == 1);
+    CHECK(values[0].sensor == id_to_sensor[ID_A]);
+    CHECK(data__poll_batch(host.data, values, ARRAY_SIZE(values)) == -1);
+    CHECK(data__poll(host.data, values) == -1);
+    CHECK(host.data->reader.dead);
+
+    host_sensors_close(&host);
+    return host_result();
+}
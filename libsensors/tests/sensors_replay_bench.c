@@ -0,0 +1,229 @@
+/*
+ * Copyright (C) 2010 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Replays a recording through a data device and reports what
+ * data__poll_batch() makes of it. Without a recording, makes up a minute
+ * of the compass at 1 kHz, with proximity changing every 2 s and light
+ * every 250 ms.
+ *
+ *   sensors_replay_bench [-r] [recording]
+ *
+ * By default the recording is sent as fast as it is read, which measures
+ * how many frames the data device decodes per second; the queues then drop
+ * most samples. With -r it is paced like it was recorded, which
+ * measures latency. The HAL logs the latency percentiles and the CPU use
+ * of the process when the replay stops, this adds the frame rate and the
+ * CPU use of the polling thread.
+ */
+
+#include <pthread.h>
+
+#include "sensors_host.h"
+
+#define SYNTHETIC_FRAMES        60000
+#define SYNTHETIC_PERIOD_NS     1000000LL
+
+// no sample for this long means the recording is over
+#define IDLE_NS                 300000000LL
+
+struct chunk_t {
+    struct sensors_record_chunk_t header;
+    struct input_event events[12];
+};
+
+static void chunk_add(struct chunk_t *chunk, int64_t t, int type, int code,
+                      int value)
+{
+    struct input_event *event = &chunk->events[chunk->header.count++];
+    memset(event, 0, sizeof(*event));
+    event->time.tv_sec = t / 1000000000LL;
+    event->time.tv_usec = (t % 1000000000LL) / 1000;
+    event->type = type;
+    event->code = code;
+    event->value = value;
+}
+
+static void chunk_write(int fd, struct chunk_t *chunk)
+{
+    write(fd, chunk, sizeof(chunk->header) +
+          chunk->header.count * sizeof(chunk->events[0]));
+    chunk->header.count = 0;
+}
+
+static int make_recording(const char *path)
+{
+    struct sensors_record_header_t header = {
+        .magic = SENSORS_RECORD_MAGIC,
+        .version = SENSORS_RECORD_VERSION,
+        .num_devices = NUM_BACKENDS,
+    };
+    struct chunk_t chunk;
+    int64_t t = clock_ns(CLOCK_REALTIME);
+    int fd, i;
+
+    fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+    if (fd < 0)
+        return -1;
+    write(fd, &header, sizeof(header));
+    for (i = 0; i < NUM_BACKENDS; i++) {
+        struct sensors_record_device_t device;
+        memset(&device, 0, sizeof(device));
+        strncpy(device.name, sBackends[i].input_name, sizeof(device.name) - 1);
+        write(fd, &device, sizeof(device));
+    }
+
+    memset(&chunk, 0, sizeof(chunk));
+    for (i = 0; i < SYNTHETIC_FRAMES; i++, t += SYNTHETIC_PERIOD_NS) {
+        int wobble = (i % 64) - 32;
+        chunk.header.device = BACKEND_AKM;
+        chunk_add(&chunk, t, EV_ABS, EVENT_TYPE_ACCEL_X, wobble);
+        chunk_add(&chunk, t, EV_ABS, EVENT_TYPE_ACCEL_Y, 40 + wobble);
+        chunk_add(&chunk, t, EV_ABS, EVENT_TYPE_ACCEL_Z, -700);
+        chunk_add(&chunk, t, EV_ABS, EVENT_TYPE_MAGV_X, 120 + wobble);
+        chunk_add(&chunk, t, EV_ABS, EVENT_TYPE_MAGV_Y, -40);
+        chunk_add(&chunk, t, EV_ABS, EVENT_TYPE_MAGV_Z, -300 - wobble);
+        chunk_add(&chunk, t, EV_ABS, EVENT_TYPE_YAW, 90 + wobble / 8);
+        chunk_add(&chunk, t, EV_ABS, EVENT_TYPE_PITCH, -10);
+        chunk_add(&chunk, t, EV_ABS, EVENT_TYPE_ROLL, 2);
+        chunk_add(&chunk, t, EV_ABS, EVENT_TYPE_TEMPERATURE, 25);
+        chunk_add(&chunk, t, EV_SYN, SYN_REPORT, 0);
+        chunk_write(fd, &chunk);
+        if (i % 2000 == 0) {
+            chunk.header.device = BACKEND_CM;
+            chunk_add(&chunk, t, EV_ABS, EVENT_TYPE_PROXIMITY, (i / 2000) & 1);
+            chunk_add(&chunk, t, EV_SYN, SYN_REPORT, 0);
+            chunk_write(fd, &chunk);
+        }
+        if (i % 250 == 0) {
+            chunk.header.device = BACKEND_LIGHT;
+            chunk_add(&chunk, t, EV_ABS, EVENT_TYPE_LIGHT, (i / 250) % 10);
+            chunk_add(&chunk, t, EV_SYN, SYN_REPORT, 0);
+            chunk_write(fd, &chunk);
+        }
+    }
+    close(fd);
+    return 0;
+}
+
+static volatile uint32_t sSamples;
+static volatile int sDone;
+
+/* wake the poller up once the samples stopped coming */
+static void *idle_thread(void *arg)
+{
+    struct host_sensors_t *host = arg;
+    uint32_t last = 0;
+    int64_t since = clock_ns(CLOCK_MONOTONIC);
+
+    while (!sDone) {
+        usleep(IDLE_NS / 10000);
+        int64_t now = clock_ns(CLOCK_MONOTONIC);
+        if (sSamples != last) {
+            last = sSamples;
+            since = now;
+        } else if (last && now - since > IDLE_NS) {
+            control__wake(host->control);
+            since = now;
+        }
+    }
+    return NULL;
+}
+
+int main(int argc, char **argv)
+{
+    struct host_sensors_t host;
+    sensors_data_t data[16];
+    uint32_t counts[MAX_NUM_SENSORS];
+    char path[PATH_MAX];
+    pthread_t idle;
+    int64_t start, last, cpu;
+    uint32_t calls = 0, frames = 0, drops = 0;
+    int realtime = argc > 1 && !strcmp(argv[1], "-r");
+    int i, n;
+
+    if (realtime) {
+        argc--;
+        argv++;
+    }
+    if (argc > 1) {
+        strncpy(path, argv[1], sizeof(path) - 1);
+        path[sizeof(path) - 1] = 0;
+    } else {
+        const char *dir = getenv("TMPDIR");
+        snprintf(path, sizeof(path), "%s/sensors-%d.rec",
+                 dir ? dir : "/tmp", getpid());
+        if (make_recording(path) < 0) {
+            fprintf(stderr, "Couldn't write %s (%s)\n", path, strerror(errno));
+            return 1;
+        }
+    }
+
+    setenv("ro_debuggable", "1", 1);
+    setenv("debug_sensors_replay", path, 1);
+    setenv("debug_sensors_replay_fast", realtime ? "0" : "1", 1);
+    if (host_sensors_open(&host, SUPPORTED_SENSORS & ~SENSORS_EVENTS) < 0) {
+        fprintf(stderr, "Couldn't open the sensors\n");
+        return 1;
+    }
+    if (!host.data->replay) {
+        fprintf(stderr, "Couldn't replay %s\n", path);
+        return 1;
+    }
+
+    memset(counts, 0, sizeof(counts));
+    pthread_create(&idle, NULL, idle_thread, &host);
+    start = last = clock_ns(CLOCK_MONOTONIC);
+    cpu = clock_ns(CLOCK_THREAD_CPUTIME_ID);
+    while ((n = data__poll_batch(host.data, data, ARRAY_SIZE(data))) > 0) {
+        last = clock_ns(CLOCK_MONOTONIC);
+        calls++;
+        for (i = 0; i < n; i++)
+            counts[sensor_to_id(data[i].sensor)]++;
+        sSamples += n;
+    }
+    cpu = clock_ns(CLOCK_THREAD_CPUTIME_ID) - cpu;
+    sDone = 1;
+    pthread_join(idle, NULL);
+
+    // when the recording comes faster than it is polled, the queues drop
+    for (i = 0; i < NUM_BACKENDS; i++)
+        frames += host.data->frames[i].frames;
+    for (i = 0; i < MAX_NUM_SENSORS; i++) {
+        struct sensors_queue_stats_t stats;
+        if (!data__get_queue_stats(host.data, SENSORS_HANDLE_BASE + i, &stats))
+            drops += stats.drops;
+    }
+    int64_t elapsed = last > start ? last - start : 1;
+    printf("%u frames, %u samples returned in %u calls, %u dropped, "
+           "over %lld ms\n", frames, sSamples, calls, drops,
+           (long long)(elapsed / 1000000));
+    printf("%lld frames/s, %lld ns of polling thread cpu per frame, "
+           "%lld per sample returned\n",
+           (long long)(frames * 1000000000LL / elapsed),
+           (long long)(cpu / (frames ? frames : 1)),
+           (long long)(cpu / (sSamples ? sSamples : 1)));
+    for (i = 0; i < (int)ARRAY_SIZE(sSensorList); i++) {
+        int id = sSensorList[i].handle - SENSORS_HANDLE_BASE;
+        if (counts[id])
+            printf("  %s: %u\n", sSensorList[i].name, counts[id]);
+    }
+
+    host_sensors_close(&host);
+    if (argc <= 1)
+        unlink(path);
+    return 0;
+}
@@ -0,0 +1,191 @@
+/*
+ * Copyright (C) 2010 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Checks what a data device outside the process of the control device can
+ * do to the others: nothing. Its mapping of the shared state is read-only
+ * and it gets no channel. The values it decodes never become the latest
+ * ones, and the significant motion and the firmware steps it finds never
+ * reach the control device: the significant motion stays on,
+ * fired for it alone until enabled again, and the accelerometer keeps the
+ * rate the steps need. A data device of the process of the control device
+ * has the significant motion turned off when it fires.
+ */
+
+#include <setjmp.h>
+#include <signal.h>
+#include <sys/wait.h>
+
+#include "sensors_host.h"
+
+static int64_t sTime;
+static sigjmp_buf sFault;
+
+/* 'frames' accelerometer frames SIGNIFICANT_MOTION_DELAY_MS apart */
+static int motion(struct sensors_data_context_t *dev, float x, float y,
+                  float z, int frames)
+{
+    int fired = 0;
+    while (frames--) {
+        dev->sensors[ID_A].acceleration.x = x;
+        dev->sensors[ID_A].acceleration.y = y;
+        dev->sensors[ID_A].acceleration.z = z;
+        sTime += SIGNIFICANT_MOTION_DELAY_MS * 1000000LL;
+        if (data__significant_motion(dev, SENSORS_AKM_ACCELERATION, sTime) &
+                SENSORS_SIGNIFICANT_MOTION)
+            fired++;
+    }
+    return fired;
+}
+
+static void on_fault(int sig)
+{
+    (void)sig;
+    siglongjmp(sFault, 1);
+}
+
+/* whether writing to 'p' faults */
+static int read_only(volatile int32_t *p)
+{
+    struct sigaction action, old;
+    int faulted;
+
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = on_fault;
+    sigaction(SIGSEGV, &action, &old);
+    faulted = sigsetjmp(sFault, 1);
+    if (!faulted)
+        *p = *p;
+    sigaction(SIGSEGV, &old, NULL);
+    return faulted;
+}
+
+/* in a process of its own, exits with the number of failures */
+static void outsider_main(struct host_sensors_t *host, int done, int again)
+{
+    struct host_sensors_t outsider = *host;
+    struct sensors_data_context_t *dev;
+    char c;
+
+    if (host_data_open(&outsider) < 0)
+        _exit(1);
+    dev = outsider.data;
+    CHECK(!dev->trusted);
+    CHECK(dev->shared);
+    CHECK(!dev->channel);
+    CHECK(read_only(&dev->shared->active));
+    CHECK(read_only(&dev->shared->fired));
+    CHECK(read_only(&dev->shared->firmware_steps));
+    CHECK(read_only(&dev->shared->latest[ID_A].seq));
+
+    // picked up: it fires, once
+    CHECK(!motion(dev, 0.0f, 0.0f, 9.81f, 10));
+    CHECK(motion(dev, 0.0f, 6.0f, 7.7f, 5) == 1);
+    CHECK(!motion(dev, 0.0f, 0.0f, 9.81f, 10));
+
+    // the firmware counts the steps
+    host_event(&outsider, BACKEND_AKM, EV_ABS, EVENT_TYPE_STEP_COUNT, 500);
+    host_event(&outsider, BACKEND_AKM, EV_SYN, SYN_REPORT, 0);
+    while (data__poll_inputs(dev, dev->epoll_fd, 100) > 0 &&
+           !dev->stepFromFirmware)
+        ;
+    CHECK(dev->stepFromFirmware);
+
+    // enabled again, it fires again
+    write(done, "", 1);
+    read(again, &c, 1);
+    CHECK(!motion(dev, 0.0f, 0.0f, 9.81f, 10));
+    CHECK(motion(dev, 0.0f, 6.0f, 7.7f, 5) == 1);
+
+    // decoded, not published
+    host_event(&outsider, BACKEND_AKM, EV_ABS, EVENT_TYPE_ACCEL_X, 100);
+    host_event(&outsider, BACKEND_AKM, EV_SYN, SYN_REPORT, 0);
+    while (data__poll_inputs(dev, dev->epoll_fd, 100) > 0 &&
+           !dev->sensors[ID_A].acceleration.x)
+        ;
+    CHECK(dev->sensors[ID_A].acceleration.x == 100 * sAkmScales[ID_A][0]);
+    CHECK(!dev->shared->latest[ID_A].seq);
+
+    host_data_close(&outsider);
+    _exit(sFailures);
+}
+
+int main(void)
+{
+    struct host_sensors_t host;
+    sensors_data_t latest;
+    int done[2], again[2];
+    int32_t oneshots;
+    pid_t outsider;
+    int i, status;
+    char c;
+
+    setenv("ro_sensors_reader_thread", "0", 1);
+    if (host_sensors_open(&host, SENSORS_STEP_COUNTER |
+                          SENSORS_SIGNIFICANT_MOTION) < 0) {
+        fprintf(stderr, "Couldn't open the sensors\n");
+        return 1;
+    }
+    CHECK(host.data->trusted);
+    control__set_delay_handle(host.control, SENSORS_HANDLE_BASE + ID_SC,
+                              STEP_DELAY_MS * 2);
+    CHECK(sHostDrivers[BACKEND_AKM].delay == STEP_DELAY_MS);
+    oneshots = host.control->shared->oneshots;
+
+    pipe(done);
+    pipe(again);
+    outsider = fork();
+    if (!outsider)
+        outsider_main(&host, done[1], again[0]);
+    CHECK(read(done[0], &c, 1) == 1);
+    // give the one-shot thread the time to see anything
+    usleep(50000);
+    CHECK(!host.control->shared->fired);
+    CHECK(!host.control->shared->firmware_steps);
+    CHECK(host.control->shared->oneshots == oneshots);
+    CHECK(host.control->requested_sensors & SENSORS_SIGNIFICANT_MOTION);
+    CHECK(sHostDrivers[BACKEND_AKM].delay == STEP_DELAY_MS);
+
+    control__activate(host.control, SENSORS_HANDLE_BASE + ID_SM, 0);
+    control__activate(host.control, SENSORS_HANDLE_BASE + ID_SM, 1);
+    write(again[1], "", 1);
+    CHECK(waitpid(outsider, &status, 0) == outsider);
+    CHECK(WIFEXITED(status) && !WEXITSTATUS(status));
+    CHECK(host.control->requested_sensors & SENSORS_SIGNIFICANT_MOTION);
+
+    // in this process, the significant motion is turned off once fired
+    CHECK(!motion(host.data, 0.0f, 0.0f, 9.81f, 10));
+    CHECK(motion(host.data, 0.0f, 6.0f, 7.7f, 5) == 1);
+    for (i = 0; i < 100 && (host.control->requested_sensors &
+                            SENSORS_SIGNIFICANT_MOTION); i++)
+        usleep(10000);
+    CHECK(!(host.control->requested_sensors & SENSORS_SIGNIFICANT_MOTION));
+
+    // and the values decoded are the latest ones
+    CHECK(control__get_latest(host.control, SENSORS_HANDLE_BASE + ID_A,
+                              &latest) == -ENODATA);
+    host_event(&host, BACKEND_AKM, EV_ABS, EVENT_TYPE_ACCEL_X, 200);
+    host_event(&host, BACKEND_AKM, EV_SYN, SYN_REPORT, 0);
+    while (data__poll_inputs(host.data, host.data->epoll_fd, 100) > 0 &&
+           !host.data->sensors[ID_A].acceleration.x)
+        ;
+    CHECK(!control__get_latest(host.control, SENSORS_HANDLE_BASE + ID_A,
+                               &latest));
+    CHECK(latest.acceleration.x == 200 * sAkmScales[ID_A][0]);
+
+    host_sensors_close(&host);
+    return host_result();
+}
@@ -0,0 +1,151 @@
+/*
+ * Copyright (C) 2010 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Checks what a data device publishes of the values the drivers hold:
+ * nothing when it opens, and the current value of an on-change sensor
+ * every time it gets enabled, with and without the reader thread. The
+ * compass values must only seed the decoding, never reach the filters.
+ * Nothing is published while the driver of the sensor can't be turned on.
+ */
+
+#include "sensors_host.h"
+
+#define LIGHT_LEVEL     3
+
+/* the samples already published, without waiting for any */
+static uint32_t published(struct host_sensors_t *host)
+{
+    struct sensors_data_context_t *dev = host->data;
+
+    if (dev->use_reader) {
+        // give the reader thread the time to look at the kick
+        usleep(20000);
+        data__ring_drain(dev);
+    } else {
+        while (data__poll_inputs(dev, dev->epoll_fd, 0) > 0)
+            ;
+    }
+    return dev->pendingSensors;
+}
+
+static void enable(struct host_sensors_t *host, int id, int enabled)
+{
+    control__activate(host->control, SENSORS_HANDLE_BASE + id, enabled);
+}
+
+static void check_snapshot(int reader)
+{
+    struct host_sensors_t host;
+    sensors_data_t values[4];
+    int64_t before;
+    int n;
+
+    setenv("ro_sensors_reader_thread", reader ? "1" : "0", 1);
+    if (host_sensors_open(&host, 0) < 0) {
+        CHECK(!"host_sensors_open");
+        return;
+    }
+    CHECK(host.data->use_reader == reader);
+
+    // nothing is enabled, nothing is published, the compass only seeded
+    CHECK(!published(&host));
+    CHECK(host.data->akmRaw[ID_A][0] == 100);
+    CHECK(host.data->akmRaw[ID_M][2] == -40);
+    CHECK(!host.data->fusionUpdates);
+
+    // enabling the light publishes its current level
+    before = data__now();
+    enable(&host, ID_L, 1);
+    CHECK(published(&host) == SENSORS_LIGHT);
+    n = data__poll_batch(host.data, values, ARRAY_SIZE(values));
+    CHECK(n == 1);
+    CHECK(values[0].sensor == id_to_sensor[ID_L]);
+    CHECK(values[0].light == sLuxValues[LIGHT_LEVEL]);
+    CHECK(values[0].time >= before && values[0].time <= data__now());
+
+    // only once
+    CHECK(!published(&host));
+
+    // the proximity along with the accelerometer, which has no snapshot
+    enable(&host, ID_A, 1);
+    enable(&host, ID_P, 1);
+    CHECK(published(&host) == SENSORS_CM_PROXIMITY);
+    n = data__poll_batch(host.data, values, ARRAY_SIZE(values));
+    CHECK(n == 1);
+    CHECK(values[0].sensor == id_to_sensor[ID_P]);
+    CHECK(values[0].distance == PROXIMITY_THRESHOLD_CM);
+
+    // enabled again: published again
+    enable(&host, ID_L, 0);
+    CHECK(!published(&host));
+    enable(&host, ID_L, 1);
+    CHECK(published(&host) == SENSORS_LIGHT);
+    n = data__poll_batch(host.data, values, ARRAY_SIZE(values));
+    CHECK(n == 1);
+
+    // even when the data device didn't see it go off
+    enable(&host, ID_L, 0);
+    enable(&host, ID_L, 1);
+    CHECK(published(&host) == SENSORS_LIGHT);
+    n = data__poll_batch(host.data, values, ARRAY_SIZE(values));
+    CHECK(n == 1);
+
+    CHECK(!host.data->fusionUpdates);
+    host_sensors_close(&host);
+}
+
+/* nothing is published for a sensor whose driver couldn't be turned on */
+static void check_missing_driver(void)
+{
+    struct host_sensors_t host;
+    sensors_data_t values[4];
+
+    setenv("ro_sensors_reader_thread", "0", 1);
+    if (host_sensors_open(&host, 0) < 0) {
+        CHECK(!"host_sensors_open");
+        return;
+    }
+
+    sHostDrivers[BACKEND_LIGHT].missing = 1;
+    enable(&host, ID_L, 1);
+    CHECK(!host.data->shared->enables[ID_L]);
+    CHECK(!published(&host));
+
+    // until it can
+    sHostDrivers[BACKEND_LIGHT].missing = 0;
+    enable(&host, ID_L, 0);
+    enable(&host, ID_L, 1);
+    CHECK(sHostDrivers[BACKEND_LIGHT].flags[0]);
+    CHECK(published(&host) == SENSORS_LIGHT);
+    CHECK(data__poll_batch(host.data, values, ARRAY_SIZE(values)) == 1);
+
+    host_sensors_close(&host);
+}
+
+int main(void)
+{
+    host_set_abs(BACKEND_AKM, EVENT_TYPE_ACCEL_X, 100, -1024, 1023);
+    host_set_abs(BACKEND_AKM, EVENT_TYPE_MAGV_Z, -40, -2048, 2047);
+    host_set_abs(BACKEND_CM, EVENT_TYPE_PROXIMITY, 1, 0, 1);
+    host_set_abs(BACKEND_LIGHT, EVENT_TYPE_LIGHT, LIGHT_LEVEL, 0, 9);
+
+    check_snapshot(0);
+    check_snapshot(1);
+    check_missing_driver();
+
+    return host_result();
+}
@@ -0,0 +1,218 @@
+/*
+ * Copyright (C) 2010 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Checks the rate the accelerometer runs at for the step sensors: forced
+ * to STEP_DELAY_MS while the steps are found in the acceleration, the one
+ * asked for once the firmware counts them. Checks the steps found too: a
+ * minute of walking at 1.8 Hz is about 108 steps, lying still, a bump
+ * every few seconds or handling the device are none. The step detector
+ * reports an event for every step counted, including the ones a run only
+ * gets counted with once it is long enough, and the ones a firmware count
+ * moved by.
+ */
+
+#include <math.h>
+
+#include "sensors_host.h"
+
+#define STEP_DELAY      200
+
+// a minute of frames at STEP_DELAY_MS
+#define FRAMES          (60000 / STEP_DELAY_MS)
+
+enum { STILL, WALK, BUMPS, HANDLING };
+
+struct steps_t {
+    int detector;
+    int counter;
+    float count;
+};
+
+static int64_t sTime;
+
+static void firmware_count(struct host_sensors_t *host, int count)
+{
+    host_event(host, BACKEND_AKM, EV_ABS, EVENT_TYPE_STEP_COUNT, count);
+    host_event(host, BACKEND_AKM, EV_SYN, SYN_REPORT, 0);
+    while (data__poll_inputs(host->data, host->data->epoll_fd, 100) > 0 &&
+           !host->data->stepFromFirmware)
+        ;
+}
+
+/* decode what was written, count the step events */
+static void drain(struct host_sensors_t *host, struct steps_t *steps)
+{
+    struct sensors_data_context_t *dev = host->data;
+    sensors_data_t data;
+
+    while (data__poll_inputs(dev, dev->epoll_fd, 0) > 0)
+        ;
+    while (dev->pendingSensors && pick_sensor(dev, &data) >= 0) {
+        if (data.sensor == id_to_sensor[ID_SD])
+            steps->detector++;
+        if (data.sensor == id_to_sensor[ID_SC]) {
+            steps->counter++;
+            steps->count = data.vector.v[0];
+        }
+    }
+}
+
+/* an accelerometer frame, a in m/s^2, STEP_DELAY_MS after the last one */
+static void frame(struct host_sensors_t *host, double x, double y, double z)
+{
+    const float *scale = sAkmScales[ID_A];
+
+    host_event_at(host, BACKEND_AKM, EV_ABS, EVENT_TYPE_ACCEL_X,
+                  (int)lrint(x / scale[0]), sTime);
+    host_event_at(host, BACKEND_AKM, EV_ABS, EVENT_TYPE_ACCEL_Y,
+                  (int)lrint(y / scale[1]), sTime);
+    host_event_at(host, BACKEND_AKM, EV_ABS, EVENT_TYPE_ACCEL_Z,
+                  (int)lrint(z / scale[2]), sTime);
+    host_event_at(host, BACKEND_AKM, EV_SYN, SYN_REPORT, 0, sTime);
+    sTime += STEP_DELAY_MS * 1000000LL;
+}
+
+static double noise(void)
+{
+    return (rand() / (double)RAND_MAX - 0.5) * 0.3;
+}
+
+/* a minute of 'kind' with a fresh step detector */
+static struct steps_t scenario(struct host_sensors_t *host, int kind)
+{
+    struct steps_t steps = { 0, 0, 0.0f };
+    double lp[3] = { 0.0, 0.0, 0.0 };
+    int i, j;
+
+    sensors_step_init(&host->data->step);
+    host->data->stepCount = 0;
+    sTime += 5000000000LL;
+    for (i = 0; i < FRAMES; i++) {
+        double t = i * STEP_DELAY_MS / 1000.0;
+        double a[3] = { 0.0, 9.81, 0.0 };
+        switch (kind) {
+        case WALK:
+            a[1] += 2.5 * sin(2 * M_PI * 1.8 * t);
+            // swaying every other step
+            a[0] += 0.75 * sin(M_PI * 1.8 * t);
+            break;
+        case BUMPS:
+            if (i % 250 < 10)
+                a[1] += 6.0;
+            break;
+        case HANDLING:
+            for (j = 0; j < 3; j++) {
+                lp[j] += (noise() * 20.0 - lp[j]) * 0.15;
+                a[j] += lp[j];
+            }
+            break;
+        }
+        frame(host, a[0] + noise(), a[1] + noise(), a[2] + noise());
+        if (i % 10 == 9)
+            drain(host, &steps);
+    }
+    drain(host, &steps);
+    return steps;
+}
+
+static void check_detection(void)
+{
+    static const char *names[] = { "still", "walking", "bumps", "handling" };
+    struct host_sensors_t host;
+    struct steps_t steps;
+    int kind;
+
+    if (host_sensors_open(&host, SENSORS_STEP_GROUP) < 0) {
+        CHECK(!"host_sensors_open");
+        return;
+    }
+    sTime = clock_ns(CLOCK_REALTIME);
+    srand(1);
+    for (kind = STILL; kind <= HANDLING; kind++) {
+        steps = scenario(&host, kind);
+        printf("%-9s %3d detector events, %3d counter events, count %.0f\n",
+               names[kind], steps.detector, steps.counter, steps.count);
+        // every step counted has its detector event
+        CHECK(steps.detector == (int)steps.count);
+        if (kind == WALK)
+            CHECK(steps.count >= 100 && steps.count <= 110);
+        else
+            CHECK(!steps.count);
+    }
+
+    // the firmware counts 10 steps at once, the detector reports 10
+    memset(&steps, 0, sizeof(steps));
+    host.data->stepCount = 0;
+    host_event(&host, BACKEND_AKM, EV_ABS, EVENT_TYPE_STEP_COUNT, 500);
+    host_event(&host, BACKEND_AKM, EV_SYN, SYN_REPORT, 0);
+    drain(&host, &steps);
+    host_event(&host, BACKEND_AKM, EV_ABS, EVENT_TYPE_STEP_COUNT, 510);
+    host_event(&host, BACKEND_AKM, EV_SYN, SYN_REPORT, 0);
+    drain(&host, &steps);
+    printf("firmware  %3d detector events, %3d counter events, count %.0f\n",
+           steps.detector, steps.counter, steps.count);
+    CHECK(steps.detector == 10);
+    CHECK(steps.counter == 1 && steps.count == 10.0f);
+
+    host_sensors_close(&host);
+}
+
+/* the control device applies the new rate from its own thread */
+static int wait_delay(int delay)
+{
+    int i;
+    for (i = 0; i < 100 && sHostDrivers[BACKEND_AKM].delay != delay; i++)
+        usleep(10000);
+    return sHostDrivers[BACKEND_AKM].delay;
+}
+
+int main(void)
+{
+    struct host_sensors_t host;
+    sensors_data_t values[4];
+    int n;
+
+    if (host_sensors_open(&host, SENSORS_STEP_COUNTER) < 0) {
+        fprintf(stderr, "Couldn't open the sensors\n");
+        return 1;
+    }
+    control__set_delay_handle(host.control, SENSORS_HANDLE_BASE + ID_SC,
+                              STEP_DELAY);
+    CHECK(sHostDrivers[BACKEND_AKM].delay == STEP_DELAY_MS);
+
+    // the first count is where the firmware stands, no steps yet
+    firmware_count(&host, 500);
+    CHECK(host.data->stepFromFirmware);
+    CHECK(!host.data->pendingSensors);
+    CHECK(wait_delay(STEP_DELAY) == STEP_DELAY);
+
+    firmware_count(&host, 510);
+    n = data__poll_batch(host.data, values, ARRAY_SIZE(values));
+    CHECK(n == 1);
+    CHECK(values[0].sensor == id_to_sensor[ID_SC]);
+    CHECK(values[0].vector.v[0] == 10.0f);
+
+    // asking for another rate doesn't bring the forced one back
+    control__set_delay_handle(host.control, SENSORS_HANDLE_BASE + ID_SC,
+                              STEP_DELAY / 2);
+    CHECK(sHostDrivers[BACKEND_AKM].delay == STEP_DELAY / 2);
+
+    host_sensors_close(&host);
+
+    check_detection();
+    return host_result();
+}
@@ -0,0 +1,108 @@
+/*
+ * Copyright (C) 2010 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Checks the timestamps of the samples: stamped by evdev with the wall
+ * clock, they come out on CLOCK_MONOTONIC, and the scheduling noise of a
+ * steady compass is mostly smoothed out of them while a frame far off
+ * keeps its own. Also checks the rate estimates get_sensor_stats returns.
+ */
+
+#include "sensors_host.h"
+
+#define FRAMES          200
+#define PERIOD_NS       20000000LL
+#define NOISE_NS        2000000LL
+
+// how far a smoothed timestamp may be from the rebased one
+#define SLACK_NS        (NOISE_NS * 3 / 4 + 1000000LL)
+#define SETTLE          10
+
+static int64_t noise(void)
+{
+    return (int64_t)(rand() % (2 * NOISE_NS / 1000 + 1)) * 1000 - NOISE_NS;
+}
+
+/* the mean distance of the intervals between times[] to the period */
+static int64_t jitter(const int64_t *times, int count)
+{
+    int64_t sum = 0;
+    int i;
+    for (i = 1; i < count; i++)
+        sum += llabs(times[i] - times[i - 1] - PERIOD_NS);
+    return sum / (count - 1);
+}
+
+int main(void)
+{
+    struct host_sensors_t host;
+    struct sensors_sensor_stats_t stats;
+    sensors_data_t data;
+    int64_t stamped[FRAMES], rebased[FRAMES], returned[FRAMES];
+    int64_t start, offset;
+    int i;
+
+    srand(1);
+    setenv("ro_sensors_reader_thread", "0", 1);
+    if (host_sensors_open(&host, SENSORS_AKM_ACCELERATION) < 0) {
+        CHECK(!"host_sensors_open");
+        return host_result();
+    }
+
+    // the last few seconds of a compass at 50 Hz, in the wall clock
+    offset = clock_ns(CLOCK_MONOTONIC) - clock_ns(CLOCK_REALTIME);
+    start = clock_ns(CLOCK_REALTIME) - FRAMES * PERIOD_NS;
+    for (i = 0; i < FRAMES; i++) {
+        int64_t t = start + i * PERIOD_NS + noise();
+        // one frame a second off by a third of a period
+        if (i % 50 == 25)
+            t += PERIOD_NS / 3;
+        host_event_at(&host, BACKEND_AKM, EV_ABS, EVENT_TYPE_ACCEL_X, i, t);
+        host_event_at(&host, BACKEND_AKM, EV_SYN, SYN_REPORT, 0, t);
+        CHECK(data__poll(host.data, &data) == ID_A);
+        stamped[i] = t;
+        rebased[i] = (t / 1000) * 1000 + offset;
+        returned[i] = data.time;
+    }
+
+    for (i = 0; i < FRAMES; i++) {
+        // the period is only known after a few frames
+        CHECK(llabs(returned[i] - rebased[i]) <
+              (i < SETTLE ? PERIOD_NS / 4 : SLACK_NS));
+        if (i)
+            CHECK(returned[i] > returned[i - 1]);
+        // the one off is taken as it is
+        if (i % 50 == 25 && i > 50)
+            CHECK(llabs(returned[i] - rebased[i]) < 1000000LL);
+    }
+    printf("jitter of the intervals: %lld us stamped, %lld us returned\n",
+           (long long)(jitter(stamped, FRAMES) / 1000),
+           (long long)(jitter(returned, FRAMES) / 1000));
+    CHECK(jitter(returned, FRAMES) < jitter(stamped, FRAMES) / 2);
+
+    CHECK(!data__get_sensor_stats(host.data, SENSORS_HANDLE_BASE + ID_A,
+                                  &stats));
+    CHECK(stats.samples == FRAMES);
+    CHECK(llabs(stats.period_ns - PERIOD_NS) < PERIOD_NS / 20);
+    CHECK(stats.rate > 47.5f && stats.rate < 52.5f);
+    CHECK(stats.jitter_ns < NOISE_NS);
+    // returned right after they were decoded, some seconds after they
+    // were taken
+    CHECK(stats.latency_ns > 0);
+
+    host_sensors_close(&host);
+    return host_result();
+}